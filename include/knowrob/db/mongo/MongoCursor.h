@@ -12,6 +12,7 @@
 #include <mongoc.h>
 
 #include <string>
+#include <set>
 // SWI Prolog
 #define PL_SAFE_ARG_MACROS
 #include <SWI-cpp.h>
@@ -38,13 +39,35 @@ public:
 	
 	void aggregate(const PlTerm &query_term);
 
+	/**
+	 * The names of collections the aggregation pipeline of this cursor
+	 * reads from, i.e. the collection of the cursor, and collections
+	 * referenced by $lookup, $graphLookup and $unionWith stages.
+	 */
+	void read_collections(std::set<std::string> &names);
+
+	const std::string& db_name() { return db_name_; }
+
+	/**
+	 * Route the query to members of a replica set according to
+	 * a read preference mode, i.e. one of primary, primaryPreferred,
+	 * secondary, secondaryPreferred, or nearest.
+	 */
+	void read_preference(const char *mode);
+
+	mongoc_client_session_t* session() { return coll_.session(); }
+
 	bool next(const bson_t **doc, bool ignore_empty=false);
 	
 	bool erase();
 	
 private:
 	MongoCollection coll_;
+	std::string db_name_;
+	std::string coll_name_;
 	mongoc_cursor_t *cursor_;
+	mongoc_read_prefs_t *read_prefs_;
+	std::string read_mode_;
 	bson_t *query_;
 	bson_t *opts_;
 	std::string id_;
@@ -17,12 +17,14 @@
 #include <map>
 #include <string>
 #include <mutex>
+#include <memory>
 
 #include <knowrob/db/mongo/MongoException.h>
 #include <knowrob/db/mongo/MongoDatabase.h>
 #include <knowrob/db/mongo/MongoCollection.h>
 #include <knowrob/db/mongo/MongoCursor.h>
 #include <knowrob/db/mongo/MongoWatch.h>
+#include <knowrob/db/mongo/MongoJournal.h>
 
 class MongoInterface {
 public:
@@ -37,6 +39,13 @@ public:
 	
 	void update(const char *db_name, const char *coll_name, const PlTerm &query_term, const PlTerm &update_term);
 	
+	/**
+	 * Atomically update the first document matching a query, or insert
+	 * a new document if none matches.
+	 * @return the document after the update.
+	 */
+	PlTerm find_and_modify(const char *db_name, const char *coll_name, const PlTerm &query_term, const PlTerm &update_term);
+	
 	void remove(const char *db_name, const char *coll_name, const PlTerm &doc_term);
 	
 	void bulk_write(const char *db_name, const char *coll_name, const PlTerm &doc_term);
@@ -54,6 +63,70 @@ public:
 	
 	static MongoWatch* get_watch();
 
+	/**
+	 * Remember the operation time of a write performed in a session.
+	 * Sessions started later are advanced to this time such that
+	 * reads, also the ones routed to secondaries, observe the write.
+	 */
+	void record_write(mongoc_client_session_t *session);
+
+	/**
+	 * Advance the operation and cluster time of a session
+	 * to the time of the last write of this client.
+	 */
+	void advance_session(mongoc_client_session_t *session);
+
+	/**
+	 * Set the read preference mode used by new cursors.
+	 */
+	void set_read_preference(const char *mode);
+
+	/**
+	 * Count a read operation served by some host.
+	 */
+	void record_read(const char *read_mode, const char *host);
+
+	/**
+	 * Number of read operations for each read preference mode and host.
+	 */
+	std::map<std::pair<std::string,std::string>, unsigned long> read_stats();
+
+	/**
+	 * Perform insert, update and remove operations write-behind
+	 * through a journal stored in the given file.
+	 * Reads wait for pending operations if read_wait is true.
+	 */
+	void journal_open(const char *path, size_t capacity,
+		MongoJournal::SyncMode sync_mode, bool read_wait=true);
+
+	/**
+	 * Stop using the journal. Pending operations remain in the
+	 * journal file and are written when it is opened again.
+	 */
+	void journal_close();
+
+	/**
+	 * @return the journal, or a null pointer if no journal is used.
+	 */
+	std::shared_ptr<MongoJournal> journal();
+
+	/**
+	 * Block until pending operations on a collection have been written.
+	 */
+	void journal_wait(const char *db_name, const char *coll_name);
+
+	/**
+	 * Block until all pending operations have been written.
+	 */
+	void journal_flush();
+
+	/**
+	 * Block until pending operations on a collection, or all pending
+	 * operations if db_name is NULL, have been written unless the journal
+	 * was opened without waiting for pending operations in reads.
+	 */
+	void journal_read_wait(const char *db_name=NULL, const char *coll_name=NULL);
+
 private:
 	MongoInterface();
 	~MongoInterface();
@@ -68,6 +141,23 @@ private:
 	MongoWatch *watch_;
 
 	std::mutex mongo_mutex_;
+
+	// causal consistency token of the last write
+	uint32_t op_timestamp_;
+	uint32_t op_increment_;
+	bson_t *cluster_time_;
+	std::mutex causal_mutex_;
+
+	std::string read_mode_;
+	std::map<std::pair<std::string,std::string>, unsigned long> read_stats_;
+	std::mutex stats_mutex_;
+
+	std::shared_ptr<MongoJournal> journal_;
+	bool journal_read_wait_;
+	std::mutex journal_mutex_;
+
+	void journal_bulk_write(MongoJournal &journal,
+		const char *db_name, const char *coll_name, const PlTerm &doc_term);
 };
 
 #endif //__KB_MONGO_IFACE_H__
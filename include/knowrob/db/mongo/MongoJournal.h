@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2021, Daniel Beßler
+ * All rights reserved.
+ *
+ * This file is part of KnowRob, please consult
+ * https://github.com/knowrob/knowrob for license details.
+ */
+
+#ifndef __KB_MONGO_JOURNAL_H__
+#define __KB_MONGO_JOURNAL_H__
+
+#include <mongoc.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/**
+ * A write-behind journal for insert, update and remove operations.
+ * Operations are appended to a memory-mapped file and the caller returns
+ * immediately, a background thread drains the journal into the database
+ * in the order in which operations were appended.
+ * Writers block in case the journal is full (backpressure).
+ * Operations that are pending when the process terminates are
+ * drained the next time the journal is opened.
+ */
+class MongoJournal {
+public:
+	enum SyncMode {
+		// rely on the OS to write back the mapped pages
+		SYNC_NONE,
+		// flush the file each time operations were drained
+		SYNC_BATCH,
+		// flush the file each time an operation was appended
+		SYNC_ALWAYS
+	};
+	enum Operation {
+		OP_INSERT = 'i',
+		OP_REMOVE = 'r',
+		OP_UPDATE = 'u'
+	};
+
+	MongoJournal(mongoc_client_pool_t *pool,
+			const std::string &path,
+			size_t capacity,
+			SyncMode sync_mode);
+	~MongoJournal();
+
+	/**
+	 * @return false if the operation is too large for the journal.
+	 */
+	bool can_append(const char *db_name, const char *coll_name,
+			Operation op, const bson_t *doc1, const bson_t *doc2=NULL) const;
+
+	/**
+	 * Append an operation to the journal.
+	 * An _id is generated for inserted documents that do not have one
+	 * such that inserts can be repeated after a failure without
+	 * creating duplicates.
+	 * Blocks until there is enough free space in the journal.
+	 * @return false if the operation is too large for the journal.
+	 */
+	bool append(const char *db_name, const char *coll_name,
+			Operation op, const bson_t *doc1, const bson_t *doc2=NULL);
+
+	/**
+	 * Block until all operations on a collection appended before
+	 * have been written into the database.
+	 * This is used to make sure that reads observe the journaled writes
+	 * of this process.
+	 */
+	void wait(const char *db_name, const char *coll_name);
+
+	/**
+	 * Block until all operations appended before have been
+	 * written into the database.
+	 */
+	void flush();
+
+	/**
+	 * @return the number of operations that were not written yet.
+	 */
+	unsigned long num_pending();
+
+	/**
+	 * @return the number of operations that were drained, but could
+	 * not be written because the server rejected them.
+	 */
+	unsigned long num_failed();
+
+protected:
+	struct Header {
+		uint64_t magic;
+		// offset of the first operation that was not drained yet
+		uint64_t head;
+		// offset where the next operation is appended
+		uint64_t tail;
+	};
+	struct Record {
+		// size of the record including padding
+		uint32_t size;
+		uint8_t op;
+		uint8_t padding[3];
+		// followed by "db\0coll\0" and one or two BSON documents
+	};
+
+	mongoc_client_pool_t *pool_;
+	std::string path_;
+	int fd_;
+	size_t capacity_;
+	SyncMode sync_mode_;
+	char *data_;
+	Header *header_;
+
+	// sequence numbers of appended and drained operations
+	uint64_t appended_;
+	uint64_t drained_;
+	// number of drained operations that were rejected by the server
+	uint64_t failed_;
+	// sequence number of the last operation on each collection
+	std::map<std::string, uint64_t> last_appended_;
+
+	std::thread *thread_;
+	bool isRunning_;
+	std::mutex lock_;
+	std::condition_variable appended_cond_;
+	std::condition_variable drained_cond_;
+	std::condition_variable stop_cond_;
+
+	void open();
+	void close();
+	void sync(uint64_t begin, uint64_t end);
+	void loop();
+	void drain(uint64_t head, uint64_t tail);
+	uint64_t run_end(uint64_t begin, uint64_t tail, uint64_t &count) const;
+	bool write_run(uint64_t begin, uint64_t end, uint64_t count);
+	uint64_t count_failed(const bson_t *reply, bool is_insert, uint64_t count) const;
+	uint64_t record_size(const char *db_name, const char *coll_name,
+			Operation op, const bson_t *doc1, const bson_t *doc2) const;
+	uint64_t record_at(uint64_t pos) const;
+	std::string record_ns(const Record *record) const;
+	void wait_for(uint64_t seq);
+};
+
+#endif //__KB_MONGO_JOURNAL_H__
@@ -37,6 +37,8 @@ public:
 protected:
 	MongoCollection *collection_;
 	std::string callback_goal_;
+	// module of the callback predicate, empty for the user module
+	std::string callback_module_;
 	mongoc_change_stream_t *stream_;
 };
 
@@ -0,0 +1,80 @@
+#ifndef __KNOWROB_TOKEN_BUFFER__
+#define __KNOWROB_TOKEN_BUFFER__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// ROS
+#include <ros/ros.h>
+#include <knowrob/EventToken.h>
+
+/**
+ * A EventToken listener that reorders tokens by their timestamp.
+ * Tokens are held back in the buffer until either a token with
+ * a timestamp later than the token's timestamp plus the lateness bound
+ * was received, or the token was buffered for longer than the
+ * lateness bound.
+ */
+class TokenBuffer
+{
+public:
+	TokenBuffer(ros::NodeHandle &node,
+			const std::string &topic="/parser/token",
+			double lateness=0.5);
+	~TokenBuffer();
+
+	void set_lateness(double lateness);
+
+	double get_lateness() const;
+
+	/**
+	 * @return the number of tokens that were received after
+	 * later tokens were released already.
+	 */
+	unsigned long get_num_late() const;
+
+	/**
+	 * Add a token to the buffer.
+	 * Tokens received from the topic are added in the same way.
+	 */
+	void push(const knowrob::EventToken &token);
+
+	/**
+	 * Wait until tokens can be released from the buffer,
+	 * and append them to batch ordered by their timestamp.
+	 * All remaining tokens are released once the buffer was closed.
+	 * @return false if the buffer was closed and is empty.
+	 */
+	bool pop(std::vector<knowrob::EventToken> &batch, double timeout);
+
+	/**
+	 * Stop receiving tokens.
+	 */
+	void close();
+
+protected:
+	struct BufferedToken {
+		knowrob::EventToken token;
+		ros::WallTime arrival;
+	};
+	ros::Subscriber subscriber_;
+	std::multimap<double,BufferedToken> buffer_;
+	mutable std::mutex mutex_;
+	std::condition_variable cond_;
+	double lateness_;
+	// the latest timestamp that was received
+	double max_time_;
+	// the latest timestamp that was released
+	double watermark_;
+	unsigned long num_late_;
+	bool is_closed_;
+
+	void callback(const knowrob::EventToken::ConstPtr &msg);
+	bool can_release(const BufferedToken &buffered, const ros::WallTime &now) const;
+	void release(std::vector<knowrob::EventToken> &batch);
+};
+
+#endif //__KNOWROB_TOKEN_BUFFER__
@@ -0,0 +1,105 @@
+#ifndef __KNOWROB_TF_EPISODE_CACHE__
+#define __KNOWROB_TF_EPISODE_CACHE__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// MONGO
+#include <mongoc.h>
+// ROS
+#include <geometry_msgs/TransformStamped.h>
+
+/**
+ * A time interval of an episode decoded from mongo DB.
+ * It holds the transforms within the interval ordered by time,
+ * and the latest transform of each frame before the interval
+ * such that the state at any time of the interval can be restored
+ * without another query.
+ */
+class TFSegment
+{
+public:
+	long index;
+	double begin;
+	double end;
+	// latest transform of each frame before begin
+	std::vector<geometry_msgs::TransformStamped> initial;
+	// transforms in [begin,end) ordered by time
+	std::vector<geometry_msgs::TransformStamped> transforms;
+};
+typedef std::shared_ptr<const TFSegment> TFSegmentPtr;
+
+/**
+ * A cache of decoded episode segments shared by republisher sessions.
+ * Segments are reference counted, i.e. a segment stays in the cache
+ * as long as some session holds it. In addition, the most recently
+ * used segments are kept for sessions that replay the same episode
+ * with some delay.
+ * A segment is decoded only once in case several sessions request it
+ * at the same time.
+ * The segment that includes the current time is not cached as
+ * more transforms may be written into it.
+ */
+class TFEpisodeCache
+{
+public:
+	TFEpisodeCache(double segment_duration=10.0, unsigned int num_recent=16);
+
+	/**
+	 * @return the cache shared by all republisher sessions.
+	 */
+	static TFEpisodeCache& get();
+
+	/**
+	 * @return the index of the segment that includes a timepoint.
+	 */
+	long segment_index(double time) const;
+
+	/**
+	 * Get a segment, and decode it in case it is not cached.
+	 * @return the segment, or an empty pointer if it could not be decoded.
+	 */
+	TFSegmentPtr get_segment(const std::string &db_name,
+			const std::string &db_collection, long index);
+
+	/**
+	 * Remove all segments of a collection from the cache.
+	 * This must be called when the collection was modified,
+	 * e.g. when it was dropped.
+	 */
+	void invalidate(const std::string &db_name, const std::string &db_collection);
+
+	/**
+	 * @return the number of segments that were decoded.
+	 */
+	unsigned long num_decoded() const
+	{ return num_decoded_; }
+
+protected:
+	struct Slot {
+		std::mutex lock;
+		std::weak_ptr<const TFSegment> segment;
+		// true if the slot was removed by invalidate()
+		bool invalidated = false;
+	};
+	double segment_duration_;
+	unsigned int num_recent_;
+	std::atomic<unsigned long> num_decoded_;
+	std::map<std::string, std::shared_ptr<Slot>> slots_;
+	std::list<std::pair<std::shared_ptr<Slot>, TFSegmentPtr>> recent_;
+	std::mutex lock_;
+
+	std::shared_ptr<Slot> get_slot(const std::string &key);
+	void keep_recent(const std::shared_ptr<Slot> &slot, const TFSegmentPtr &segment);
+	bool load_segment(const std::string &db_name,
+			const std::string &db_collection, TFSegment &segment);
+	bool load_initial(const char *db_name, const char *db_collection, TFSegment &segment);
+	bool load_transforms(const char *db_name, const char *db_collection, TFSegment &segment);
+};
+
+#endif //__KNOWROB_TF_EPISODE_CACHE__
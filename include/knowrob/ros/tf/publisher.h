@@ -1,6 +1,7 @@
 #ifndef __KNOWROB_TF_PUBLISHER__
 #define __KNOWROB_TF_PUBLISHER__
 
+#include <string>
 #include <thread>
 
 // ROS
@@ -14,13 +15,16 @@
 
 /**
  * TF publisher for frames that are managed by the KB.
+ * Transforms are published on the TF topic, or on
+ * another topic if one is given.
  */
 class TFPublisher
 {
 public:
 	TFPublisher(TFMemory &memory,
 			double frequency=10.0,
-			bool clear_after_publish=false);
+			bool clear_after_publish=false,
+			const std::string &topic="");
 	~TFPublisher();
 
 protected:
@@ -28,9 +32,11 @@ protected:
 	bool is_running_;
 	double frequency_;
 	bool clear_after_publish_;
+	std::string topic_;
 	std::thread thread_;
 
 	void publishTransforms(tf2_ros::TransformBroadcaster &tf_broadcaster);
+	void publishTransforms(ros::Publisher &publisher);
 	void loop();
 };
 
@@ -2,6 +2,9 @@
 #define __KNOWROB_TF_REPUBLISHER__
 
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 // MONGO
 #include <mongoc.h>
@@ -15,15 +18,19 @@
 
 #include <knowrob/ros/tf/memory.h>
 #include <knowrob/ros/tf/publisher.h>
-#include <knowrob/db/mongo/MongoInterface.h>
+#include <knowrob/ros/tf/episode_cache.h>
 
 /**
  * A TF publisher that publishes data stored in mongo DB.
+ * Each republisher has its own clock and time window,
+ * and publishes on topics within its namespace.
+ * The data is read from segments of the TFEpisodeCache such that
+ * republishers replaying the same episode decode it only once.
  */
 class TFRepublisher
 {
 public:
-	TFRepublisher(double frequency=10.0);
+	TFRepublisher(double frequency=10.0, const std::string &ns="");
 
 	~TFRepublisher();
 
@@ -34,10 +41,10 @@ public:
 	{ loop_ = loop; }
 
 	void set_db_name(std::string db_name)
-	{ db_name_ = db_name; }
+	{ std::lock_guard<std::mutex> scoped_lock(goal_lock_); db_name_ = db_name; }
 
 	void set_db_collection(std::string db_collection)
-	{ db_collection_ = db_collection; }
+	{ std::lock_guard<std::mutex> scoped_lock(goal_lock_); db_collection_ = db_collection; }
 
 	TFMemory& memory()
 	{ return memory_; }
@@ -54,36 +61,38 @@ protected:
 	double realtime_factor_;
 	double frequency_;
 	bool loop_;
-	bool is_running_;
-	bool reset_;
-	bool skip_reset_;
-	bool has_been_skipped_;
-	std::thread thread_;
-	std::thread tick_thread_;
+	// NOTE: the fields below are written by the Prolog and tick threads,
+	//       and read by the replay thread.
+	std::atomic<bool> is_running_;
+	std::atomic<bool> reset_;
+	std::atomic<bool> has_been_skipped_;
 
 	double time_min_;
 	double time_max_;
-	double time_;
+	std::atomic<double> time_;
 
 	std::string db_name_;
 	std::string db_collection_;
-	MongoCollection *collection_;
+	std::string namespace_;
+	std::mutex goal_lock_;
 
-	mongoc_cursor_t *cursor_;
-	geometry_msgs::TransformStamped ts_;
-	bool has_next_;
-	bool has_new_goal_;
+	// the segment that is currently replayed, and the index
+	// of the next transform in the segment
+	TFSegmentPtr segment_;
+	size_t next_;
+	std::atomic<bool> has_new_goal_;
 
 	TFMemory memory_;
 	TFPublisher publisher_;
+	// NOTE: threads are started last when all members are initialized
+	std::thread thread_;
+	std::thread tick_thread_;
 
 	void loop();
 	void tick_loop();
-	void create_cursor(double start_time);
-	void reset_cursor();
-	void advance_cursor();
-	void read_transform(const bson_t *doc);
-	void set_initial_poses(double unix_time);
+	void seek(double time);
+	void advance();
+	void publish_until(double time);
 };
 
 #endif //__KNOWROB_TF_REPUBLISHER__
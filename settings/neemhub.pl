@@ -10,6 +10,9 @@ setting(tf:use_logger, false).
 
 %	Do not drop any triple graphs on startup
 setting(lang_db:drop_graphs, []).
+%	NEEM dumps may not store local names of IRIs, and
+%	they cannot be added as the database is read only
+setting(lang_triple:local_names, false).
 
 %	Mongo DB name
 setting(mng_client:db_name, 'neems').
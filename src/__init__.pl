@@ -35,6 +35,7 @@
 :- use_module('utility/filesystem').
 :- use_module('utility/functional').
 :- use_module('utility/threads').
+:- use_module('utility/startup').
 :- use_module('utility/url').
 :- log_info(kb(initialization(started))).
 
@@ -61,5 +62,8 @@
 % load additional modules
 :- knowrob_load_plugins.
 
+% wait for initialization tasks, search indices
+% are still created in the background.
+:- startup_barrier.
 % done with the initialization
 :- log_info(kb(initialization(finished))).
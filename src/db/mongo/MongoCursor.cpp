@@ -8,9 +8,11 @@
 
 #include "knowrob/db/mongo/MongoCursor.h"
 #include "knowrob/db/mongo/MongoException.h"
+#include "knowrob/db/mongo/MongoInterface.h"
 #include "knowrob/db/mongo/bson_pl.h"
 
 #include <sstream>
+#include <cstring>
 #include <iostream>
 
 // SWI Prolog
@@ -21,8 +23,12 @@ MongoCursor::MongoCursor(
 		mongoc_client_pool_t *pool,
 		const char *db_name,
 		const char *coll_name)
-: cursor_(NULL),
-  coll_(pool, db_name, coll_name),
+: coll_(pool, db_name, coll_name),
+  db_name_(db_name),
+  coll_name_(coll_name),
+  cursor_(NULL),
+  read_prefs_(NULL),
+  read_mode_("primary"),
   is_aggregate_query_(false)
 {
 	query_ = bson_new();
@@ -39,6 +45,9 @@ MongoCursor::~MongoCursor()
 	if(cursor_!=NULL) {
 		mongoc_cursor_destroy(cursor_);
 	}
+	if(read_prefs_!=NULL) {
+		mongoc_read_prefs_destroy(read_prefs_);
+	}
 	bson_destroy(query_);
 	bson_destroy(opts_);
 }
@@ -50,14 +59,16 @@ void MongoCursor::limit(unsigned int limit)
 
 void MongoCursor::ascending(const char *key)
 {
-	static bson_t *doc = BCON_NEW("sort", "{", key, BCON_INT32(1), "}");
+	bson_t *doc = BCON_NEW("sort", "{", key, BCON_INT32(1), "}");
 	bson_concat(opts_,doc);
+	bson_destroy(doc);
 }
 
 void MongoCursor::descending(const char *key)
 {
-	static bson_t *doc = BCON_NEW("sort", "{", key, BCON_INT32(-1), "}");
+	bson_t *doc = BCON_NEW("sort", "{", key, BCON_INT32(-1), "}");
 	bson_concat(opts_,doc);
+	bson_destroy(doc);
 }
 
 void MongoCursor::filter(const PlTerm &query_term)
@@ -83,16 +94,83 @@ void MongoCursor::aggregate(const PlTerm &query_term)
 //	}
 }
 
+static void read_collections_(bson_iter_t *iter, std::set<std::string> &names)
+{
+	while(bson_iter_next(iter)) {
+		const char *key = bson_iter_key(iter);
+		bson_iter_t child;
+		if(BSON_ITER_HOLDS_UTF8(iter)) {
+			if(strcmp(key,"$unionWith")==0) {
+				names.insert(bson_iter_utf8(iter,NULL));
+			}
+			continue;
+		}
+		if(!BSON_ITER_HOLDS_DOCUMENT(iter) && !BSON_ITER_HOLDS_ARRAY(iter)) {
+			continue;
+		}
+		if(BSON_ITER_HOLDS_DOCUMENT(iter) && bson_iter_recurse(iter,&child)) {
+			const char *coll_key = NULL;
+			if(strcmp(key,"$lookup")==0 || strcmp(key,"$graphLookup")==0) {
+				coll_key = "from";
+			}
+			else if(strcmp(key,"$unionWith")==0) {
+				coll_key = "coll";
+			}
+			if(coll_key && bson_iter_find(&child,coll_key) && BSON_ITER_HOLDS_UTF8(&child)) {
+				names.insert(bson_iter_utf8(&child,NULL));
+			}
+		}
+		// sub-pipelines may read from further collections
+		if(bson_iter_recurse(iter,&child)) {
+			read_collections_(&child,names);
+		}
+	}
+}
+
+void MongoCursor::read_collections(std::set<std::string> &names)
+{
+	bson_iter_t iter;
+	names.insert(coll_name_);
+	if(bson_iter_init(&iter,query_)) {
+		read_collections_(&iter,names);
+	}
+}
+
+void MongoCursor::read_preference(const char *mode)
+{
+	mongoc_read_mode_t read_mode;
+	std::string mode_str(mode);
+	if(mode_str == "primary")                 read_mode = MONGOC_READ_PRIMARY;
+	else if(mode_str == "primaryPreferred")   read_mode = MONGOC_READ_PRIMARY_PREFERRED;
+	else if(mode_str == "secondary")          read_mode = MONGOC_READ_SECONDARY;
+	else if(mode_str == "secondaryPreferred") read_mode = MONGOC_READ_SECONDARY_PREFERRED;
+	else if(mode_str == "nearest")            read_mode = MONGOC_READ_NEAREST;
+	else {
+		bson_error_t err;
+		bson_set_error(&err,
+				MONGOC_ERROR_COMMAND,
+				MONGOC_ERROR_COMMAND_INVALID_ARG,
+				"unknown read preference '%s'", mode);
+		throw MongoException("invalid_read_preference",err);
+	}
+	if(read_prefs_!=NULL) {
+		mongoc_read_prefs_destroy(read_prefs_);
+	}
+	read_prefs_ = mongoc_read_prefs_new(read_mode);
+	read_mode_ = mode_str;
+}
+
 bool MongoCursor::next(const bson_t **doc, bool ignore_empty)
 {
+	bool is_first = (cursor_==NULL);
 	if(cursor_==NULL) {
 		if(is_aggregate_query_) {
 			cursor_ = mongoc_collection_aggregate(
-				coll_(), MONGOC_QUERY_NONE, query_, opts_, NULL /* read_prefs */ );
+				coll_(), MONGOC_QUERY_NONE, query_, opts_, read_prefs_);
 		}
 		else {
 			cursor_ = mongoc_collection_find_with_opts(
-			    coll_(), query_, opts_, NULL /* read_prefs */ );
+			    coll_(), query_, opts_, read_prefs_);
 		}
 		// make sure cursor has no error after creation
 		bson_error_t err1;
@@ -101,7 +179,15 @@ bool MongoCursor::next(const bson_t **doc, bool ignore_empty)
 		}
 	}
 	// get next document
-	if(!mongoc_cursor_next(cursor_,doc)) {
+	bool has_next = mongoc_cursor_next(cursor_,doc);
+	bson_error_t err0;
+	if(is_first && !mongoc_cursor_error(cursor_, &err0)) {
+		// count the read, the host is known once the command was sent
+		mongoc_host_list_t host;
+		mongoc_cursor_get_host(cursor_, &host);
+		MongoInterface::get().record_read(read_mode_.c_str(), host.host_and_port);
+	}
+	if(!has_next) {
 		// make sure cursor has no error after next has been called
 		bson_error_t err2;
 		if(mongoc_cursor_error(cursor_, &err2)) {
@@ -8,24 +8,29 @@
 
 #include <mongoc.h>
 #include <sstream>
+#include <vector>
 
 #include <rosprolog/rosprolog_kb/rosprolog_kb.h>
 
 #include "knowrob/db/mongo/MongoInterface.h"
 #include "knowrob/db/mongo/bson_pl.h"
 
-static const mongoc_insert_flags_t INSERT_NO_VALIDATE_FLAG =
-		(mongoc_insert_flags_t)MONGOC_INSERT_NO_VALIDATE;
-static const mongoc_update_flags_t UPDATE_NO_VALIDATE_FLAG =
-		(mongoc_update_flags_t)MONGOC_UPDATE_NO_VALIDATE;
-static const mongoc_update_flags_t UPDATE_FLAGS =
-		(mongoc_update_flags_t)(MONGOC_UPDATE_MULTI_UPDATE | UPDATE_NO_VALIDATE_FLAG);
-
 static const PlAtom ATOM_minus("-");
+static const PlAtom ATOM_text("text");
 static const PlAtom ATOM_insert("insert");
 static const PlAtom ATOM_remove("remove");
 static const PlAtom ATOM_update("update");
 
+static void throw_journal_overflow(const char *db_name, const char *coll_name)
+{
+	bson_error_t err;
+	bson_set_error(&err,
+		MONGOC_ERROR_BSON,
+		MONGOC_ERROR_BSON_INVALID,
+		"operation on %s.%s exceeds the journal size", db_name, coll_name);
+	throw MongoException("journal_append",err);
+}
+
 /*********************************/
 /********** static functions *****/
 /*********************************/
@@ -43,7 +48,17 @@ mongoc_client_pool_t* MongoInterface::pool()
 
 MongoCursor* MongoInterface::cursor_create(const char *db_name, const char *coll_name)
 {
+	// make sure the cursor observes journaled writes of this client
+	MongoInterface::get().journal_read_wait(db_name,coll_name);
 	MongoCursor *c = new MongoCursor(MongoInterface::pool(),db_name,coll_name);
+	// make sure the cursor observes writes of this client
+	MongoInterface::get().advance_session(c->session());
+	{
+		std::lock_guard<std::mutex> scoped_lock(MongoInterface::get().stats_mutex_);
+		if(MongoInterface::get().read_mode_ != "primary") {
+			c->read_preference(MongoInterface::get().read_mode_.c_str());
+		}
+	}
 	{
 		std::lock_guard<std::mutex> scoped_lock(MongoInterface::get().mongo_mutex_);
 		MongoInterface::get().cursors_[c->id()] = c;
@@ -118,21 +133,149 @@ MongoInterface::MongoInterface()
 	pool_ = mongoc_client_pool_new(uri_);
 	mongoc_client_pool_set_error_api(pool_, 2);
 	watch_ = new MongoWatch(pool_);
+	op_timestamp_ = 0;
+	op_increment_ = 0;
+	cluster_time_ = NULL;
+	read_mode_ = "primary";
+	journal_read_wait_ = true;
 }
 
 MongoInterface::~MongoInterface()
 {
+	journal_close();
 	if(watch_ != NULL) {
 		delete watch_;
 		watch_ = NULL;
 	}
+	if(cluster_time_ != NULL) {
+		bson_destroy(cluster_time_);
+		cluster_time_ = NULL;
+	}
 	mongoc_client_pool_destroy(pool_);
 	mongoc_uri_destroy(uri_);
 	mongoc_cleanup();
 }
 
+void MongoInterface::record_write(mongoc_client_session_t *session)
+{
+	if(session == NULL) return;
+	uint32_t timestamp, increment;
+	mongoc_client_session_get_operation_time(session, &timestamp, &increment);
+	const bson_t *cluster_time = mongoc_client_session_get_cluster_time(session);
+	std::lock_guard<std::mutex> scoped_lock(causal_mutex_);
+	if(timestamp > op_timestamp_ ||
+	  (timestamp == op_timestamp_ && increment > op_increment_))
+	{
+		op_timestamp_ = timestamp;
+		op_increment_ = increment;
+	}
+	if(cluster_time != NULL) {
+		// note: the session ignores cluster times that are older
+		//       than the one it has already seen.
+		if(cluster_time_ != NULL) {
+			bson_destroy(cluster_time_);
+		}
+		cluster_time_ = bson_copy(cluster_time);
+	}
+}
+
+void MongoInterface::advance_session(mongoc_client_session_t *session)
+{
+	if(session == NULL) return;
+	std::lock_guard<std::mutex> scoped_lock(causal_mutex_);
+	if(op_timestamp_ > 0) {
+		mongoc_client_session_advance_operation_time(
+			session, op_timestamp_, op_increment_);
+	}
+	if(cluster_time_ != NULL) {
+		mongoc_client_session_advance_cluster_time(session, cluster_time_);
+	}
+}
+
+void MongoInterface::set_read_preference(const char *mode)
+{
+	std::lock_guard<std::mutex> scoped_lock(stats_mutex_);
+	read_mode_ = std::string(mode);
+}
+
+void MongoInterface::record_read(const char *read_mode, const char *host)
+{
+	std::lock_guard<std::mutex> scoped_lock(stats_mutex_);
+	read_stats_[std::make_pair(std::string(read_mode),std::string(host))] += 1;
+}
+
+std::map<std::pair<std::string,std::string>, unsigned long> MongoInterface::read_stats()
+{
+	std::lock_guard<std::mutex> scoped_lock(stats_mutex_);
+	return read_stats_;
+}
+
+void MongoInterface::journal_open(const char *path, size_t capacity,
+		MongoJournal::SyncMode sync_mode, bool read_wait)
+{
+	// operations pending in a journal that was opened before
+	// remain in its file until it is opened again.
+	journal_close();
+	std::lock_guard<std::mutex> scoped_lock(journal_mutex_);
+	try {
+		journal_ = std::make_shared<MongoJournal>(pool_, path, capacity, sync_mode);
+		journal_read_wait_ = read_wait;
+	}
+	catch(const std::runtime_error &exc) {
+		bson_error_t err;
+		bson_set_error(&err,
+			MONGOC_ERROR_CLIENT,
+			MONGOC_ERROR_CLIENT_NOT_READY,
+			"%s", exc.what());
+		throw MongoException("journal_open",err);
+	}
+}
+
+void MongoInterface::journal_close()
+{
+	std::lock_guard<std::mutex> scoped_lock(journal_mutex_);
+	journal_.reset();
+}
+
+std::shared_ptr<MongoJournal> MongoInterface::journal()
+{
+	std::lock_guard<std::mutex> scoped_lock(journal_mutex_);
+	return journal_;
+}
+
+void MongoInterface::journal_wait(const char *db_name, const char *coll_name)
+{
+	std::shared_ptr<MongoJournal> journal = this->journal();
+	if(journal) {
+		journal->wait(db_name,coll_name);
+	}
+}
+
+void MongoInterface::journal_flush()
+{
+	std::shared_ptr<MongoJournal> journal = this->journal();
+	if(journal) {
+		journal->flush();
+	}
+}
+
+void MongoInterface::journal_read_wait(const char *db_name, const char *coll_name)
+{
+	std::shared_ptr<MongoJournal> journal;
+	{
+		std::lock_guard<std::mutex> scoped_lock(journal_mutex_);
+		if(!journal_read_wait_) return;
+		journal = journal_;
+	}
+	if(journal) {
+		if(db_name) journal->wait(db_name,coll_name);
+		else        journal->flush();
+	}
+}
+
 void MongoInterface::drop(const char *db_name, const char *coll_name)
 {
+	journal_wait(db_name,coll_name);
 	MongoCollection coll(pool_,db_name,coll_name);
 	bson_error_t err;
 	if(!mongoc_collection_drop(coll(),&err)) {
@@ -145,7 +288,6 @@ void MongoInterface::store(
 		const char *coll_name,
 		const PlTerm &doc_term)
 {
-	MongoCollection coll(pool_,db_name,coll_name);
 	bson_error_t err;
 	//
 	bson_t *doc = bson_new();
@@ -153,11 +295,25 @@ void MongoInterface::store(
 		bson_destroy(doc);
 		throw MongoException("invalid_term",err);
 	}
-	bool success = mongoc_collection_insert(coll(),INSERT_NO_VALIDATE_FLAG,doc,NULL,&err);
+	std::shared_ptr<MongoJournal> journal = this->journal();
+	if(journal) {
+		bool success = journal->append(db_name,coll_name,MongoJournal::OP_INSERT,doc);
+		bson_destroy(doc);
+		if(!success) {
+			throw_journal_overflow(db_name,coll_name);
+		}
+		return;
+	}
+	MongoCollection coll(pool_,db_name,coll_name);
+	bson_t *opts = BCON_NEW("validate", BCON_BOOL(false));
+	coll.appendSession(opts);
+	bool success = mongoc_collection_insert_one(coll(),doc,opts,NULL,&err);
 	bson_destroy(doc);
+	bson_destroy(opts);
 	if(!success) {
 		throw MongoException("insert_failed",err);
 	}
+	record_write(coll.session());
 }
 
 void MongoInterface::remove(
@@ -165,7 +321,6 @@ void MongoInterface::remove(
 		const char *coll_name,
 		const PlTerm &doc_term)
 {
-	MongoCollection coll(pool_,db_name,coll_name);
 	bson_error_t err;
 	//
 	bson_t *doc = bson_new();
@@ -173,11 +328,25 @@ void MongoInterface::remove(
 		bson_destroy(doc);
 		throw MongoException("invalid_term",err);
 	}
-	bool success = mongoc_collection_remove(coll(),MONGOC_REMOVE_NONE,doc,NULL,&err);
+	std::shared_ptr<MongoJournal> journal = this->journal();
+	if(journal) {
+		bool success = journal->append(db_name,coll_name,MongoJournal::OP_REMOVE,doc);
+		bson_destroy(doc);
+		if(!success) {
+			throw_journal_overflow(db_name,coll_name);
+		}
+		return;
+	}
+	MongoCollection coll(pool_,db_name,coll_name);
+	bson_t *opts = bson_new();
+	coll.appendSession(opts);
+	bool success = mongoc_collection_delete_many(coll(),doc,opts,NULL,&err);
 	bson_destroy(doc);
+	bson_destroy(opts);
 	if(!success) {
 		throw MongoException("collection_remove",err);
 	}
+	record_write(coll.session());
 }
 
 void MongoInterface::bulk_write(
@@ -185,15 +354,21 @@ void MongoInterface::bulk_write(
 		const char *coll_name,
 		const PlTerm &doc_term)
 {
+	std::shared_ptr<MongoJournal> journal = this->journal();
+	if(journal) {
+		journal_bulk_write(*journal,db_name,coll_name,doc_term);
+		return;
+	}
 	MongoCollection coll(pool_,db_name,coll_name);
 	bson_t reply;
-	// bulk options: set ordered to false to allow server performing
-	//               the steps in parallel
+	// the bulk is ordered: it stops at the first error, and
+	// operations are applied in the order they were added.
 	bson_t opts = BSON_INITIALIZER;
-	BSON_APPEND_BOOL(&opts, "ordered", false);
+	coll.appendSession(&opts);
 	// create the bulk operation
 	mongoc_bulk_operation_t *bulk =
-			mongoc_collection_create_bulk_operation_with_opts(coll(), NULL);
+			mongoc_collection_create_bulk_operation_with_opts(coll(), &opts);
+	bson_destroy(&opts);
 	// iterate over input list and insert steps
 	PlTail pl_list(doc_term);
 	PlTerm pl_member;
@@ -252,6 +427,69 @@ void MongoInterface::bulk_write(
 	if(!success) {
 		throw MongoException("bulk_operation",bulk_err);
 	}
+	record_write(coll.session());
+}
+
+void MongoInterface::journal_bulk_write(
+		MongoJournal &journal,
+		const char *db_name,
+		const char *coll_name,
+		const PlTerm &doc_term)
+{
+	// parse all operations and check their size first such that
+	// neither invalid input nor an operation that exceeds the journal
+	// size leaves part of the operations in the journal
+	std::vector<MongoJournal::Operation> ops;
+	std::vector<bson_t*> docs;
+	bson_error_t err;
+	bool is_valid = true;
+	PlTail pl_list(doc_term);
+	PlTerm pl_member;
+	while(is_valid && pl_list.next(pl_member)) {
+		const PlAtom operation_name(pl_member.name());
+		bson_t *doc1 = bson_new();
+		bson_t *doc2 = NULL;
+		docs.push_back(doc1);
+		is_valid = bsonpl_concat(doc1,pl_member[1],&err);
+		if(!is_valid) break;
+		if(operation_name == ATOM_insert) {
+			ops.push_back(MongoJournal::OP_INSERT);
+		}
+		else if(operation_name == ATOM_remove) {
+			ops.push_back(MongoJournal::OP_REMOVE);
+		}
+		else if(operation_name == ATOM_update) {
+			ops.push_back(MongoJournal::OP_UPDATE);
+			doc2 = bson_new();
+			is_valid = bsonpl_concat(doc2,pl_member[2],&err);
+		}
+		else {
+			bson_set_error(&err,
+					MONGOC_ERROR_COMMAND,
+					MONGOC_ERROR_COMMAND_INVALID_ARG,
+					"unknown bulk operation '%s'", pl_member.name());
+			is_valid = false;
+		}
+		docs.push_back(doc2);
+	}
+	bool is_appended = true;
+	for(size_t i=0; is_valid && is_appended && i<ops.size(); ++i) {
+		is_appended = journal.can_append(db_name,coll_name,ops[i],docs[2*i],docs[2*i+1]);
+	}
+	for(size_t i=0; is_valid && is_appended && i<ops.size(); ++i) {
+		// the size was checked before such that append only blocks
+		// until enough space is free
+		journal.append(db_name,coll_name,ops[i],docs[2*i],docs[2*i+1]);
+	}
+	for(std::vector<bson_t*>::iterator it=docs.begin(); it!=docs.end(); ++it) {
+		if(*it) bson_destroy(*it);
+	}
+	if(!is_valid) {
+		throw MongoException("bulk_operation",err);
+	}
+	if(!is_appended) {
+		throw_journal_overflow(db_name,coll_name);
+	}
 }
 
 void MongoInterface::update(
@@ -260,7 +498,6 @@ void MongoInterface::update(
 		const PlTerm &query_term,
 		const PlTerm &update_term)
 {
-	MongoCollection coll(pool_,db_name,coll_name);
 	bson_error_t err;
 	//
 	bson_t *query = bson_new();
@@ -274,17 +511,94 @@ void MongoInterface::update(
 		bson_destroy(update);
 		throw MongoException("invalid_update",err);
 	}
-	bool success = mongoc_collection_update(coll(),
-		UPDATE_FLAGS,
+	std::shared_ptr<MongoJournal> journal = this->journal();
+	if(journal) {
+		bool success = journal->append(db_name,coll_name,MongoJournal::OP_UPDATE,query,update);
+		bson_destroy(query);
+		bson_destroy(update);
+		if(!success) {
+			throw_journal_overflow(db_name,coll_name);
+		}
+		return;
+	}
+	MongoCollection coll(pool_,db_name,coll_name);
+	bson_t *opts = BCON_NEW("validate", BCON_BOOL(false));
+	coll.appendSession(opts);
+	bool success = mongoc_collection_update_many(coll(),
 		query,
 		update,
+		opts,
 		NULL,
 		&err);
 	bson_destroy(query);
 	bson_destroy(update);
+	bson_destroy(opts);
 	if(!success) {
 		throw MongoException("update_failed",err);
 	}
+	record_write(coll.session());
+}
+
+PlTerm MongoInterface::find_and_modify(
+		const char *db_name,
+		const char *coll_name,
+		const PlTerm &query_term,
+		const PlTerm &update_term)
+{
+	bson_error_t err;
+	//
+	bson_t *query = bson_new();
+	if(!bsonpl_concat(query,query_term,&err)) {
+		bson_destroy(query);
+		throw MongoException("invalid_query",err);
+	}
+	bson_t *update = bson_new();
+	if(!bsonpl_concat(update,update_term,&err)) {
+		bson_destroy(query);
+		bson_destroy(update);
+		throw MongoException("invalid_update",err);
+	}
+	// the document must reflect journaled writes of this process
+	journal_wait(db_name,coll_name);
+	MongoCollection coll(pool_,db_name,coll_name);
+	mongoc_find_and_modify_opts_t *opts = mongoc_find_and_modify_opts_new();
+	mongoc_find_and_modify_opts_set_update(opts, update);
+	mongoc_find_and_modify_opts_set_flags(opts, (mongoc_find_and_modify_flags_t)
+		(MONGOC_FIND_AND_MODIFY_UPSERT | MONGOC_FIND_AND_MODIFY_RETURN_NEW));
+	bson_t *extra = bson_new();
+	coll.appendSession(extra);
+	mongoc_find_and_modify_opts_append(opts, extra);
+	bson_t reply;
+	bool success = mongoc_collection_find_and_modify_with_opts(
+		coll(), query, opts, &reply, &err);
+	bson_destroy(query);
+	bson_destroy(update);
+	bson_destroy(extra);
+	mongoc_find_and_modify_opts_destroy(opts);
+	if(!success) {
+		bson_destroy(&reply);
+		throw MongoException("find_and_modify_failed",err);
+	}
+	record_write(coll.session());
+	// read the updated document from the reply
+	bson_iter_t iter;
+	bson_t value;
+	uint32_t len;
+	const uint8_t *data;
+	if(!bson_iter_init_find(&iter, &reply, "value") ||
+	   !BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+		bson_destroy(&reply);
+		bson_set_error(&err,
+			MONGOC_ERROR_BSON,
+			MONGOC_ERROR_BSON_INVALID,
+			"no document returned by find and modify on %s.%s", db_name, coll_name);
+		throw MongoException("find_and_modify_failed",err);
+	}
+	bson_iter_document(&iter, &len, &data);
+	bson_init_static(&value, data, len);
+	PlTerm result = bson_to_term(&value);
+	bson_destroy(&reply);
+	return result;
 }
 
 void MongoInterface::create_index(const char *db_name, const char *coll_name, const PlTerm &keys_pl)
@@ -303,6 +617,9 @@ void MongoInterface::create_index(const char *db_name, const char *coll_name, co
 		if(mode_atom == ATOM_minus) {
 			BSON_APPEND_INT32(&keys, (char*)pl_value, -1);
 		}
+		else if(mode_atom == ATOM_text) {
+			BSON_APPEND_UTF8(&keys, (char*)pl_value, "text");
+		}
 		else {
 			BSON_APPEND_INT32(&keys, (char*)pl_value, 1);
 		}
@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2021, Daniel Beßler
+ * All rights reserved.
+ *
+ * This file is part of KnowRob, please consult
+ * https://github.com/knowrob/knowrob for license details.
+ */
+
+#include "knowrob/db/mongo/MongoJournal.h"
+#include "knowrob/db/mongo/MongoInterface.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include <ros/ros.h>
+
+#define JOURNAL_MAGIC 0x4c4e524a424b4e4bull
+#define JOURNAL_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+// offset of the first record
+#define JOURNAL_START JOURNAL_ALIGN(sizeof(MongoJournal::Header))
+// bounds of the delay between retries while the server is unavailable
+#define JOURNAL_RETRY_MIN_MS 100
+#define JOURNAL_RETRY_MAX_MS 5000
+// mongo error code for duplicate keys
+#define JOURNAL_DUPLICATE_KEY 11000
+
+// the length of a BSON document is stored little-endian in its first bytes
+static inline uint32_t journal_doc_len(const char *buf)
+{
+	uint32_t len;
+	memcpy(&len, buf, sizeof(uint32_t));
+	return BSON_UINT32_FROM_LE(len);
+}
+
+MongoJournal::MongoJournal(
+		mongoc_client_pool_t *pool,
+		const std::string &path,
+		size_t capacity,
+		SyncMode sync_mode)
+: pool_(pool),
+  path_(path),
+  fd_(-1),
+  capacity_(capacity),
+  sync_mode_(sync_mode),
+  data_(NULL),
+  header_(NULL),
+  appended_(0),
+  drained_(0),
+  failed_(0),
+  thread_(NULL),
+  isRunning_(false)
+{
+	open();
+	isRunning_ = true;
+	thread_ = new std::thread(&MongoJournal::loop, this);
+}
+
+MongoJournal::~MongoJournal()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		isRunning_ = false;
+		appended_cond_.notify_all();
+		drained_cond_.notify_all();
+		stop_cond_.notify_all();
+	}
+	if(thread_) {
+		thread_->join();
+		delete thread_;
+		thread_ = NULL;
+	}
+	// pending operations remain in the file and are
+	// drained the next time the journal is opened.
+	close();
+}
+
+void MongoJournal::open()
+{
+	fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+	if(fd_ < 0) {
+		throw std::runtime_error("unable to open journal " + path_);
+	}
+	struct stat st;
+	if(fstat(fd_, &st) == 0 && (size_t)st.st_size > capacity_) {
+		// keep the size of an existing journal
+		capacity_ = st.st_size;
+	}
+	if(capacity_ < JOURNAL_START + sizeof(Record) ||
+	   ftruncate(fd_, capacity_) != 0)
+	{
+		::close(fd_);
+		fd_ = -1;
+		throw std::runtime_error("unable to allocate journal " + path_);
+	}
+	void *addr = mmap(NULL, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if(addr == MAP_FAILED) {
+		::close(fd_);
+		fd_ = -1;
+		throw std::runtime_error("unable to map journal " + path_);
+	}
+	data_ = (char*)addr;
+	header_ = (Header*)data_;
+	if(header_->magic != JOURNAL_MAGIC ||
+	   header_->head < JOURNAL_START || header_->head > capacity_ ||
+	   header_->tail < JOURNAL_START || header_->tail > capacity_)
+	{
+		header_->magic = JOURNAL_MAGIC;
+		header_->head = JOURNAL_START;
+		header_->tail = JOURNAL_START;
+		sync(0, JOURNAL_START);
+	}
+	// count operations left over from a previous run
+	uint64_t pos = header_->head;
+	while(pos != header_->tail) {
+		pos = record_at(pos);
+		Record *record = (Record*)(data_ + pos);
+		last_appended_[record_ns(record)] = ++appended_;
+		pos += record->size;
+	}
+	if(appended_ > 0) {
+		ROS_INFO("[MongoJournal] %lu pending operation(s) in %s.",
+			(unsigned long)appended_, path_.c_str());
+	}
+}
+
+void MongoJournal::close()
+{
+	if(data_ != NULL) {
+		msync(data_, capacity_, MS_SYNC);
+		munmap(data_, capacity_);
+		data_ = NULL;
+		header_ = NULL;
+	}
+	if(fd_ >= 0) {
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+void MongoJournal::sync(uint64_t begin, uint64_t end)
+{
+	static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	uint64_t page_begin = begin - (begin % page_size);
+	msync(data_ + page_begin, end - page_begin, MS_SYNC);
+}
+
+uint64_t MongoJournal::record_at(uint64_t pos) const
+{
+	// a record with size zero, or too little space for a record,
+	// marks that the journal continues at the start
+	if(capacity_ - pos < sizeof(Record) ||
+	   ((Record*)(data_ + pos))->size == 0)
+	{
+		return JOURNAL_START;
+	}
+	return pos;
+}
+
+std::string MongoJournal::record_ns(const Record *record) const
+{
+	const char *db_name = (const char*)(record + 1);
+	const char *coll_name = db_name + strlen(db_name) + 1;
+	return std::string(db_name) + "." + coll_name;
+}
+
+uint64_t MongoJournal::record_size(
+		const char *db_name,
+		const char *coll_name,
+		Operation op,
+		const bson_t *doc1,
+		const bson_t *doc2) const
+{
+	uint64_t docs_len = doc1->len + (doc2 ? doc2->len : 0);
+	if(op == OP_INSERT && !bson_has_field(doc1, "_id")) {
+		// an ObjectId field is added to the document
+		docs_len += 1 + 4 + sizeof(bson_oid_t);
+	}
+	return JOURNAL_ALIGN(sizeof(Record) +
+		strlen(db_name) + 1 + strlen(coll_name) + 1 + docs_len);
+}
+
+bool MongoJournal::can_append(
+		const char *db_name,
+		const char *coll_name,
+		Operation op,
+		const bson_t *doc1,
+		const bson_t *doc2) const
+{
+	return JOURNAL_START + record_size(db_name,coll_name,op,doc1,doc2) < capacity_;
+}
+
+bool MongoJournal::append(
+		const char *db_name,
+		const char *coll_name,
+		Operation op,
+		const bson_t *doc1,
+		const bson_t *doc2)
+{
+	if(!can_append(db_name,coll_name,op,doc1,doc2)) {
+		return false;
+	}
+	bson_t *with_id = NULL;
+	if(op == OP_INSERT && !bson_has_field(doc1, "_id")) {
+		bson_oid_t oid;
+		bson_oid_init(&oid, NULL);
+		with_id = bson_new();
+		BSON_APPEND_OID(with_id, "_id", &oid);
+		bson_concat(with_id, doc1);
+		doc1 = with_id;
+	}
+	size_t db_len = strlen(db_name) + 1;
+	size_t coll_len = strlen(coll_name) + 1;
+	uint64_t size = JOURNAL_ALIGN(sizeof(Record) + db_len + coll_len +
+		doc1->len + (doc2 ? doc2->len : 0));
+	std::unique_lock<std::mutex> lock(lock_);
+	uint64_t pos;
+	while(true) {
+		uint64_t head = header_->head;
+		uint64_t tail = header_->tail;
+		if(tail >= head) {
+			if(tail + size <= capacity_) {
+				pos = tail;
+				break;
+			}
+			if(JOURNAL_START + size < head) {
+				if(capacity_ - tail >= sizeof(Record)) {
+					((Record*)(data_ + tail))->size = 0;
+				}
+				pos = JOURNAL_START;
+				break;
+			}
+		}
+		else if(tail + size < head) {
+			pos = tail;
+			break;
+		}
+		// backpressure: wait until operations were drained
+		drained_cond_.wait(lock);
+	}
+	// write the record into the free space of the journal
+	Record *record = (Record*)(data_ + pos);
+	record->size = size;
+	record->op = op;
+	char *buf = (char*)(record + 1);
+	memcpy(buf, db_name, db_len);   buf += db_len;
+	memcpy(buf, coll_name, coll_len); buf += coll_len;
+	memcpy(buf, bson_get_data(doc1), doc1->len); buf += doc1->len;
+	if(doc2) {
+		memcpy(buf, bson_get_data(doc2), doc2->len);
+	}
+	if(sync_mode_ == SYNC_ALWAYS) {
+		sync(pos, pos + size);
+	}
+	header_->tail = pos + size;
+	if(sync_mode_ == SYNC_ALWAYS) {
+		sync(0, JOURNAL_START);
+	}
+	last_appended_[std::string(db_name) + "." + coll_name] = ++appended_;
+	appended_cond_.notify_all();
+	lock.unlock();
+	if(with_id) bson_destroy(with_id);
+	return true;
+}
+
+void MongoJournal::wait(const char *db_name, const char *coll_name)
+{
+	uint64_t seq;
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		std::map<std::string, uint64_t>::iterator it =
+			last_appended_.find(std::string(db_name) + "." + coll_name);
+		if(it == last_appended_.end()) return;
+		seq = it->second;
+	}
+	wait_for(seq);
+}
+
+void MongoJournal::flush()
+{
+	uint64_t seq;
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		seq = appended_;
+	}
+	wait_for(seq);
+}
+
+void MongoJournal::wait_for(uint64_t seq)
+{
+	std::unique_lock<std::mutex> lock(lock_);
+	while(drained_ < seq && isRunning_) {
+		drained_cond_.wait(lock);
+	}
+}
+
+unsigned long MongoJournal::num_pending()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	return appended_ - drained_;
+}
+
+unsigned long MongoJournal::num_failed()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+	return failed_;
+}
+
+void MongoJournal::loop()
+{
+	std::unique_lock<std::mutex> lock(lock_);
+	while(isRunning_) {
+		if(header_->head == header_->tail) {
+			// start again at the beginning when the journal is empty
+			// such that records are written contiguously
+			header_->head = JOURNAL_START;
+			header_->tail = JOURNAL_START;
+			// wake up writers that wait for space at the start
+			drained_cond_.notify_all();
+			appended_cond_.wait(lock);
+			continue;
+		}
+		uint64_t head = header_->head;
+		uint64_t tail = header_->tail;
+		lock.unlock();
+		drain(head, tail);
+		lock.lock();
+	}
+}
+
+void MongoJournal::drain(uint64_t head, uint64_t tail)
+{
+	while(head != tail) {
+		// consecutive operations on the same collection are written at once
+		uint64_t begin = record_at(head);
+		uint64_t count;
+		uint64_t end = run_end(begin, tail, count);
+		unsigned int retry_ms = JOURNAL_RETRY_MIN_MS;
+		while(!write_run(begin, end, count)) {
+			// the server is unavailable: keep operations in the journal and retry
+			std::unique_lock<std::mutex> lock(lock_);
+			if(!isRunning_) return;
+			stop_cond_.wait_for(lock, std::chrono::milliseconds(retry_ms));
+			if(!isRunning_) return;
+			retry_ms = std::min(retry_ms*2, (unsigned int)JOURNAL_RETRY_MAX_MS);
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			head = end;
+			header_->head = head;
+			drained_ += count;
+			if(sync_mode_ != SYNC_NONE) {
+				sync(0, JOURNAL_START);
+			}
+			drained_cond_.notify_all();
+		}
+	}
+}
+
+uint64_t MongoJournal::run_end(uint64_t begin, uint64_t tail, uint64_t &count) const
+{
+	// consecutive inserts are performed unordered, other operations
+	// are performed in the order in which they were appended.
+	const Record *first = (const Record*)(data_ + begin);
+	const std::string ns = record_ns(first);
+	uint64_t pos = begin;
+	count = 0;
+	while(pos != tail) {
+		pos = record_at(pos);
+		const Record *record = (const Record*)(data_ + pos);
+		if((first->op == OP_INSERT) != (record->op == OP_INSERT)) break;
+		if(record_ns(record) != ns) break;
+		pos += record->size;
+		count += 1;
+	}
+	return pos;
+}
+
+bool MongoJournal::write_run(uint64_t begin, uint64_t end, uint64_t count)
+{
+	const Record *first = (const Record*)(data_ + begin);
+	const char *db_name = (const char*)(first + 1);
+	const char *coll_name = db_name + strlen(db_name) + 1;
+	bool is_insert = (first->op == OP_INSERT);
+
+	MongoCollection coll(pool_, db_name, coll_name);
+	bson_t opts = BSON_INITIALIZER;
+	BSON_APPEND_BOOL(&opts, "ordered", !is_insert);
+	coll.appendSession(&opts);
+	mongoc_bulk_operation_t *bulk =
+		mongoc_collection_create_bulk_operation_with_opts(coll(), &opts);
+	bson_destroy(&opts);
+
+	uint64_t pos = begin;
+	while(pos != end) {
+		pos = record_at(pos);
+		const Record *record = (const Record*)(data_ + pos);
+		// skip namespace and read the documents
+		const char *buf = (const char*)(record + 1);
+		buf += strlen(buf) + 1;
+		buf += strlen(buf) + 1;
+		bson_t doc1, doc2;
+		bson_init_static(&doc1, (const uint8_t*)buf, journal_doc_len(buf));
+		bson_error_t err;
+		bool is_queued = false;
+		switch(record->op) {
+		case OP_INSERT:
+			is_queued = mongoc_bulk_operation_insert_with_opts(
+				bulk, &doc1, NULL, &err);
+			break;
+		case OP_REMOVE:
+			is_queued = mongoc_bulk_operation_remove_many_with_opts(
+				bulk, &doc1, NULL, &err);
+			break;
+		case OP_UPDATE:
+			buf += doc1.len;
+			bson_init_static(&doc2, (const uint8_t*)buf, journal_doc_len(buf));
+			is_queued = mongoc_bulk_operation_update_many_with_opts(
+				bulk, &doc1, &doc2, NULL, &err);
+			break;
+		default:
+			bson_set_error(&err,
+				MONGOC_ERROR_COMMAND,
+				MONGOC_ERROR_COMMAND_INVALID_ARG,
+				"unknown operation '%c'", record->op);
+			break;
+		}
+		if(!is_queued) {
+			ROS_WARN("[MongoJournal] dropping operation on %s.%s: %s.",
+				db_name, coll_name, err.message);
+		}
+		pos += record->size;
+	}
+
+	bson_t reply;
+	bson_error_t err;
+	bool success = mongoc_bulk_operation_execute(bulk, &reply, &err);
+	mongoc_bulk_operation_destroy(bulk);
+	if(success) {
+		bson_destroy(&reply);
+		MongoInterface::get().record_write(coll.session());
+		return true;
+	}
+	if(err.domain == MONGOC_ERROR_STREAM ||
+	   err.domain == MONGOC_ERROR_SERVER_SELECTION)
+	{
+		bson_destroy(&reply);
+		return false;
+	}
+	uint64_t num_failed = count_failed(&reply, is_insert, count);
+	bson_destroy(&reply);
+	if(num_failed > 0) {
+		ROS_WARN("[MongoJournal] %lu operation(s) on %s.%s failed: %s.",
+			(unsigned long)num_failed, db_name, coll_name, err.message);
+		std::lock_guard<std::mutex> guard(lock_);
+		failed_ += num_failed;
+	}
+	return true;
+}
+
+uint64_t MongoJournal::count_failed(const bson_t *reply, bool is_insert, uint64_t count) const
+{
+	bson_iter_t iter, errors;
+	if(!bson_iter_init_find(&iter, reply, "writeErrors") ||
+	   !BSON_ITER_HOLDS_ARRAY(&iter) ||
+	   !bson_iter_recurse(&iter, &errors))
+	{
+		// the run was rejected as a whole
+		return count;
+	}
+	uint64_t num_failed = 0;
+	while(bson_iter_next(&errors)) {
+		bson_iter_t error, field;
+		if(!bson_iter_recurse(&errors, &error)) continue;
+		int32_t code = 0;
+		if(bson_iter_find_case(&error, "code")) {
+			code = bson_iter_int32(&error);
+		}
+		if(is_insert) {
+			// inserts are repeated after the server was unavailable,
+			// documents that were inserted before are reported as duplicates.
+			if(code != JOURNAL_DUPLICATE_KEY) num_failed += 1;
+		}
+		else if(bson_iter_recurse(&errors, &field) &&
+		        bson_iter_find(&field, "index"))
+		{
+			// an ordered run stops at the first error
+			return count - bson_iter_as_int64(&field);
+		}
+		else {
+			return count;
+		}
+	}
+	return num_failed;
+}
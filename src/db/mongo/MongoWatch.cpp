@@ -143,6 +143,12 @@ MongoWatcher::MongoWatcher(
   stream_(NULL),
   callback_goal_(callback_goal)
 {
+	// the callback may be qualified as "Module:Name"
+	size_t sep = callback_goal.find(':');
+	if(sep != std::string::npos) {
+		callback_module_ = callback_goal.substr(0, sep);
+		callback_goal_ = callback_goal.substr(sep+1);
+	}
 	// create pipeline object
 	bson_t *pipeline = bson_new();
 	bson_error_t err;
@@ -160,6 +166,11 @@ MongoWatcher::MongoWatcher(
 		"fullDocument",   BCON_UTF8("updateLookup")
 		//"batchSize", ..
 	);
+	// the stream is resumed after the event with the given token
+	bson_iter_t iter;
+	if(bson_iter_init_find(&iter, pipeline, "resumeAfter")) {
+		bson_append_iter(opts, "resumeAfter", -1, &iter);
+	}
 	// connect and append session ID to options
 	collection_ = new MongoCollection(pool, db_name, coll_name);
 	collection_->appendSession(opts);
@@ -193,7 +204,13 @@ bool MongoWatcher::next(long watcher_id)
 	const bson_t *doc;
 	if(mongoc_change_stream_next(stream_, &doc)) {
 		PlTerm term = bson_to_term(doc);
-		PlCall(callback_goal_.c_str(), PlTermv(PlTerm((long)watcher_id), term));
+		if(callback_module_.empty()) {
+			PlCall(callback_goal_.c_str(), PlTermv(PlTerm((long)watcher_id), term));
+		}
+		else {
+			PlCall(callback_module_.c_str(), callback_goal_.c_str(),
+				PlTermv(PlTerm((long)watcher_id), term));
+		}
 		return true;
 	}
 	else {
@@ -1,2 +1,3 @@
 
 :- use_module('client').
+:- use_module('sync').
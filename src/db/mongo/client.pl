@@ -1,15 +1,19 @@
 :- module(mng_client,
     [ mng_db_name/1,
       mng_get_db/3,
+      mng_with_collection_prefix/2,
       mng_one_db/2,
       mng_collection/2,
       mng_distinct_values/4,
+      mng_count/3,
       mng_drop/2,
       mng_store/3,
       mng_update/4,
+      mng_find_and_modify/5,
       mng_remove/3,
       mng_bulk_write/3,
       mng_find/4,
+      mng_find/5,
       mng_watch/5,
       mng_unwatch/1,
       mng_index_create/2,
@@ -26,6 +30,7 @@
       mng_cursor_descending/2,
       mng_cursor_ascending/2,
       mng_cursor_limit/2,
+      mng_cursor_read_preference/2,
       mng_cursor_next/2,
       mng_cursor_materialize/2,
       mng_get_dict/3,
@@ -37,7 +42,11 @@
       mng_strip_operator/3,
       mng_strip_variable/2,
       mng_operator/2,
-      mng_uri/1
+      mng_uri/1,
+      mng_read_stats/1,
+      mng_journal_flush/0,
+      mng_journal_pending/1,
+      mng_journal_failed/1
     ]).
 /** <module> A mongo DB client for Prolog.
 
@@ -57,6 +66,9 @@ To this end, Prolog datastructures are translated from and into BSON format.
 :- use_foreign_library('libmongo_kb.so').
 
 :- dynamic mng_db_name/1.
+:- thread_local collection_prefix_/1.
+
+:- meta_predicate mng_with_collection_prefix(+,0).
 
 % define some settings
 :- setting(db_name, atom, roslog,
@@ -65,6 +77,29 @@ To this end, Prolog datastructures are translated from and into BSON format.
 	'ID of the current neem. Empty if neemhub is not used').
 :- setting(read_only, atom, false,
 	'Flag if the tripledb is read only').
+:- setting(read_preference, atom, primary,
+	'Replica set members read from by default, one of primary, primaryPreferred, secondary, secondaryPreferred, or nearest.').
+
+:- setting(journal_file, atom, '',
+	'File of the write-behind journal. Writes are performed synchronously if empty.').
+:- setting(journal_size, positive_integer, 67108864,
+	'Size of the write-behind journal in bytes. Writers block while the journal is full, and writes larger than the journal fail.').
+:- setting(journal_sync, atom, batch,
+	'When the journal file is flushed to disk, one of none, batch, or always.').
+:- setting(journal_read_wait, boolean, true,
+	'Toggle whether queries wait for pending writes of this process in the journal.').
+
+:- setting(mng_client:read_preference, Mode),
+   mng_read_preference_default(Mode).
+
+:- setting(mng_client:journal_file, File),
+   (	File == ''
+   ->	true
+   ;	setting(mng_client:journal_size, Size),
+	setting(mng_client:journal_sync, Sync),
+	setting(mng_client:journal_read_wait, ReadWait),
+	mng_journal_open(File, Size, Sync, ReadWait)
+   ).
 
 :- setting(mng_client:db_name, DBName),
    assertz(mng_db_name(DBName)),
@@ -88,11 +123,37 @@ To this end, Prolog datastructures are translated from and into BSON format.
 %
 mng_get_db(DB, Collection, DBType) :-
 	mng_db_name(DB),
-	(	(setting(mng_client:collection_prefix, Id), Id \= '') 
+	(	collection_prefix(Id)
 	->	atomic_list_concat([Id,'_',DBType], Collection)
 	;	Collection = DBType
 	).
 
+%%
+collection_prefix(Id) :-
+	collection_prefix_(Id), !,
+	Id \= ''.
+collection_prefix(Id) :-
+	setting(mng_client:collection_prefix, Id),
+	Id \= ''.
+
+%% mng_with_collection_prefix(+Prefix, :Goal) is nondet.
+%
+% Call Goal with a collection prefix that is used instead
+% of the collection_prefix setting in the calling thread.
+% This can be used to access different NEEMs in parallel.
+% Note that the prefix is not used by other threads,
+% e.g. by threads processing steps of a query.
+%
+% @param Prefix the collection prefix.
+% @param Goal the goal to call.
+%
+mng_with_collection_prefix(Prefix, Goal) :-
+	setup_call_cleanup(
+		asserta(collection_prefix_(Prefix), Ref),
+		Goal,
+		erase(Ref)
+	).
+
 %% mng_one_db(?DB, -Collection) is det.
 %
 % Get a special database collection with just one empty document.
@@ -178,10 +239,32 @@ read_json_(JSON,Dict) :-
 % @see https://docs.mongodb.com/manual/reference/method/db.collection.find/index.html
 %
 mng_find(DB, Collection, Filter, Result) :-
+	mng_find(DB, Collection, Filter, Result, []).
+
+%% mng_find(+DB, +Collection, +Filter, -Result, +Options) is nondet.
+%
+% Same as mng_find/4 but with additional options:
+%
+%     - read_preference(Mode)
+%     The replica set members the query is routed to, one of primary,
+%     primaryPreferred, secondary, secondaryPreferred, or nearest.
+%     Default is the read_preference setting.
+%
+% @param DB The database name
+% @param Collection The collection name
+% @param Filter A mongo DB query
+% @param Result A document matching the query
+% @param Options list of options
+%
+mng_find(DB, Collection, Filter, Result, Options) :-
 	setup_call_cleanup(
 		% setup: create a query cursor
 		(	mng_cursor_create(DB, Collection, Cursor),
-			mng_cursor_filter(Cursor, Filter)
+			mng_cursor_filter(Cursor, Filter),
+			(	option(read_preference(Mode), Options)
+			->	mng_cursor_read_preference(Cursor, Mode)
+			;	true
+			)
 		),
 		% call: find matching document
 		mng_cursor_materialize(Cursor, Result),
@@ -266,11 +349,14 @@ mng_cursor_materialize(_,Next,Next).
 %% mng_index_create(+DB,+Collection,+Keys) is det
 %
 % Creates a compound search index.
+% Keys may be wrapped in text/1 to create a text index
+% on string values of a field.
 %
 % @param DB The database name
 % @param Collection The collection name
 % @param Keys List of keys for which an index shall be created
 % @see https://docs.mongodb.com/manual/core/index-compound/
+% @see https://docs.mongodb.com/manual/core/index-text/
 %
 mng_index_create(DB,Collection,Keys) :-
 	findall(K,
@@ -305,6 +391,7 @@ mng_index_create(DB,Indices) :-
 %%
 format_key_(+(K),+(K)) :- !.
 format_key_(-(K),-(K)) :- !.
+format_key_(text(K),text(K)) :- !.
 format_key_(  K, +(K)) :- !.
 
 
@@ -699,6 +786,25 @@ mng_uri('mongodb://localhost:27017').
 % @see https://docs.mongodb.com/manual/reference/method/db.collection.update/index.html
 %
 
+%% mng_find_and_modify(+DB, +Collection, +Query, +Update, -Result) is det.
+%
+% Atomically updates the first document in a named collection
+% that matches Query, or inserts a new document in case no document
+% matches. Result is the document after the update.
+% This can be used to implement counters that are shared
+% between processes.
+%
+% @param DB The database name
+% @param Collection The collection name
+% @param Query A query document
+% @param Update A update document
+% @param Result The updated document
+% @see https://docs.mongodb.com/manual/reference/method/db.collection.findAndModify/
+%
+mng_find_and_modify(DB, Collection, Query, Update, Result) :-
+	mng_find_and_modify_pairs(DB, Collection, Query, Update, Pairs),
+	dict_pairs(Result, _, Pairs).
+
 %% mng_bulk_write(+DB, +Collection, +Operations)
 %
 % Performs bulk operations.
@@ -718,6 +824,10 @@ mng_uri('mongodb://localhost:27017').
 % is instantiated to an atom representing the operation type,
 % and the second argument is a list of additional change information
 % that depends on the operation type.
+% The callback is called in the user module unless its name
+% is qualified with a module as in 'Module:Name'.
+% The stream starts after the event with a resume token Token
+% if Pipeline has the additional key-value pair `[resumeAfter, Token]`.
 %
 % @param DB database name
 % @param Collection collection name
@@ -766,6 +876,74 @@ mng_uri('mongodb://localhost:27017').
 % @param Limit The maximum number of documents yielded by the cursor
 %
 
+%% mng_cursor_read_preference(+Cursor, +Mode) is det.
+%
+% Route the query of a cursor to members of a replica set.
+% Mode is one of primary, primaryPreferred, secondary,
+% secondaryPreferred, or nearest.
+% Reads observe the writes of this client also when they are
+% routed to a secondary because sessions are advanced to the
+% time of the last write (causal consistency).
+%
+% @param Cursor A mongo DB cursor id
+% @param Mode The read preference mode
+%
+
+%% mng_read_stats(-Stats) is det.
+%
+% Number of reads served by each host for each read preference mode.
+% Stats is a list of terms read(Mode,Host,Count) where Host
+% has the form 'host:port'.
+%
+% @param Stats list of read statistics
+%
+
+%% mng_count(+DB, +Collection, -Count) is det.
+%
+% The number of documents in a collection.
+% The count is estimated from collection metadata without
+% scanning the collection. It may be inaccurate, e.g.
+% after an unclean shutdown of the server.
+%
+% @param DB The database name
+% @param Collection The collection name
+% @param Count The number of documents
+%
+
+%% mng_journal_flush is det.
+%
+% Block until all writes in the write-behind journal
+% have been performed.
+% Writes are only journaled if the journal_file setting is not empty.
+% Note that queries wait for pending writes on the collections
+% they read from such that they observe the writes of this process.
+% This includes kb_project which reads the triples collection before
+% writing into it, i.e. it blocks while writes on triples are pending.
+% Queries hence stall while the server is not available for writing,
+% e.g. when reading from a secondary during an outage of the primary.
+% Queries do not wait if the journal_read_wait setting is false,
+% but they may then not observe writes of this process.
+%
+
+%% mng_journal_pending(-Count) is det.
+%
+% The number of writes in the write-behind journal
+% that have not been performed yet.
+%
+% @param Count number of pending writes
+%
+
+%% mng_journal_failed(-Count) is det.
+%
+% The number of writes in the write-behind journal
+% that were rejected by the server, e.g. because of a
+% duplicate key in an update. An ordered sequence of updates
+% stops at the first rejected write, and the writes after it
+% are counted as failed too.
+%
+% @param Count number of failed writes
+%
+
 %% mng_cursor_descending(+Cursor, +Key) is det.
 %
 % Configure a cursor to yield documents in descending order.
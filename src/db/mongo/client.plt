@@ -0,0 +1,89 @@
+:- use_module(library('rostest')).
+:- use_module('client').
+
+:- begin_tests('mng_journal',
+		[ cleanup(journal_cleanup) ]).
+
+% a small journal such that appending wraps around
+test_journal_size(4096).
+
+journal_cleanup :-
+	mng_get_db(DB, Coll, test_journal),
+	mng_drop(DB, Coll).
+
+test_journal_open(File) :-
+	tmp_file(mng_journal, File),
+	test_journal_reopen(File).
+
+test_journal_reopen(File) :-
+	test_journal_size(Size),
+	mng_client:mng_journal_open(File, Size, always, true).
+
+test_journal_close(File) :-
+	mng_client:mng_journal_close,
+	delete_file(File),
+	journal_cleanup.
+
+test_journal_count(Count) :-
+	mng_get_db(DB, Coll, test_journal),
+	findall(x, mng_find(DB, Coll, [], _), Docs),
+	length(Docs, Count).
+
+test_journal_store(Count) :-
+	mng_get_db(DB, Coll, test_journal),
+	forall(
+		between(1, Count, I),
+		mng_store(DB, Coll, [['i', int(I)]])
+	).
+
+test('journal append and drain',
+		[ setup(test_journal_open(File)),
+		  cleanup(test_journal_close(File)) ]) :-
+	test_journal_store(100),
+	mng_journal_flush,
+	assert_true(mng_journal_pending(0)),
+	assert_true(mng_journal_failed(0)),
+	assert_true(test_journal_count(100)).
+
+test('journal drains pending writes when it is opened again',
+		[ setup(test_journal_open(File)),
+		  cleanup(test_journal_close(File)) ]) :-
+	test_journal_store(20),
+	% pending writes remain in the file
+	mng_client:mng_journal_close,
+	test_journal_reopen(File),
+	mng_journal_flush,
+	assert_true(mng_journal_pending(0)),
+	% inserts that were drained before are not duplicated
+	assert_true(test_journal_count(20)).
+
+test('journal rejects writes exceeding its size',
+		[ setup(test_journal_open(File)),
+		  cleanup(test_journal_close(File)) ]) :-
+	mng_get_db(DB, Coll, test_journal),
+	length(Codes, 8000),
+	maplist(=(0'x), Codes),
+	string_codes(Large, Codes),
+	catch(
+		mng_bulk_write(DB, Coll, [
+			insert([['i', int(1)]]),
+			insert([['s', string(Large)]])
+		]),
+		Error, true),
+	assert_unifies(Error, mng_error(journal_append(_))),
+	mng_journal_flush,
+	% no part of the bulk was appended
+	assert_true(test_journal_count(0)).
+
+test('journal counts writes rejected by the server',
+		[ setup(test_journal_open(File)),
+		  cleanup(test_journal_close(File)) ]) :-
+	mng_get_db(DB, Coll, test_journal),
+	test_journal_store(1),
+	% the _id field cannot be modified
+	mng_update(DB, Coll, [['i', int(1)]], ['$set', ['_id', string(x)]]),
+	mng_journal_flush,
+	assert_true(mng_journal_pending(0)),
+	assert_true(mng_journal_failed(1)).
+
+:- end_tests('mng_journal').
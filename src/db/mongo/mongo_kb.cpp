@@ -9,6 +9,8 @@
 #define PL_SAFE_ARG_MACROS
 #include <SWI-cpp.h>
 #include <iostream>
+#include <set>
+#include <string>
 
 #include "knowrob/db/mongo/MongoInterface.h"
 #include "knowrob/db/mongo/bson_pl.h"
@@ -53,6 +55,20 @@ PREDICATE(mng_distinct_values_json,4) {
 	return success;
 }
 
+PREDICATE(mng_count, 3) {
+	char* db_name   = (char*)PL_A1;
+	char* coll_name = (char*)PL_A2;
+	MongoInterface::get().journal_read_wait(db_name,coll_name);
+	MongoCollection coll(MongoInterface::pool(), db_name, coll_name);
+	bson_error_t err;
+	// uses collection metadata instead of scanning the collection
+	int64_t count = mongoc_collection_estimated_document_count(
+		coll(), NULL, NULL, NULL, &err);
+	if(count < 0) {
+		throw MongoException("count_failed",err);
+	}
+	return PL_A3 = (long)count;
+}
 
 PREDICATE(mng_drop_unsafe, 2) {
 	char* db_name   = (char*)PL_A1;
@@ -82,6 +98,13 @@ PREDICATE(mng_update, 4) {
 	return TRUE;
 }
 
+PREDICATE(mng_find_and_modify_pairs, 5) {
+	char* db_name     = (char*)PL_A1;
+	char* coll_name   = (char*)PL_A2;
+	PL_A5 = MongoInterface::get().find_and_modify(db_name,coll_name,PL_A3,PL_A4);
+	return TRUE;
+}
+
 PREDICATE(mng_watch, 5) {
 	char* db_name   = (char*)PL_A1;
 	char* coll_name = (char*)PL_A2;
@@ -112,6 +135,49 @@ PREDICATE(mng_index_create_core, 3) {
 	return TRUE;
 }
 
+PREDICATE(mng_journal_open, 4) {
+	char* path      = (char*)PL_A1;
+	long capacity   = (long)PL_A2;
+	PlAtom sync_mode(PL_A3);
+	PlAtom read_wait(PL_A4);
+	MongoJournal::SyncMode mode;
+	if(sync_mode == PlAtom("none")) {
+		mode = MongoJournal::SYNC_NONE;
+	}
+	else if(sync_mode == PlAtom("batch")) {
+		mode = MongoJournal::SYNC_BATCH;
+	}
+	else if(sync_mode == PlAtom("always")) {
+		mode = MongoJournal::SYNC_ALWAYS;
+	}
+	else {
+		throw PlDomainError("journal_sync", PL_A3);
+	}
+	MongoInterface::get().journal_open(path,(size_t)capacity,mode,
+		read_wait == PlAtom("true"));
+	return TRUE;
+}
+
+PREDICATE(mng_journal_close, 0) {
+	MongoInterface::get().journal_close();
+	return TRUE;
+}
+
+PREDICATE(mng_journal_flush, 0) {
+	MongoInterface::get().journal_flush();
+	return TRUE;
+}
+
+PREDICATE(mng_journal_pending, 1) {
+	std::shared_ptr<MongoJournal> journal = MongoInterface::get().journal();
+	return PL_A1 = (long)(journal ? journal->num_pending() : 0);
+}
+
+PREDICATE(mng_journal_failed, 1) {
+	std::shared_ptr<MongoJournal> journal = MongoInterface::get().journal();
+	return PL_A1 = (long)(journal ? journal->num_failed() : 0);
+}
+
 PREDICATE(mng_cursor_create, 3) {
 	char* db_name   = (char*)PL_A1;
 	char* coll_name = (char*)PL_A2;
@@ -147,10 +213,45 @@ PREDICATE(mng_cursor_filter, 2) {
 
 PREDICATE(mng_cursor_aggregate, 2) {
 	char* cursor_id = (char*)PL_A1;
-	MongoInterface::cursor(cursor_id)->aggregate(PL_A2);
+	MongoCursor *c = MongoInterface::cursor(cursor_id);
+	c->aggregate(PL_A2);
+	// wait only for pending writes on collections the pipeline reads from
+	std::set<std::string> names;
+	c->read_collections(names);
+	for(const std::string &name : names) {
+		MongoInterface::get().journal_read_wait(c->db_name().c_str(), name.c_str());
+	}
 	return TRUE;
 }
 
+PREDICATE(mng_cursor_read_preference, 2) {
+	char* cursor_id = (char*)PL_A1;
+	char* mode      = (char*)PL_A2;
+	MongoInterface::cursor(cursor_id)->read_preference(mode);
+	return TRUE;
+}
+
+PREDICATE(mng_read_preference_default, 1) {
+	char* mode = (char*)PL_A1;
+	MongoInterface::get().set_read_preference(mode);
+	return TRUE;
+}
+
+PREDICATE(mng_read_stats, 1) {
+	std::map<std::pair<std::string,std::string>, unsigned long>
+		stats = MongoInterface::get().read_stats();
+	PlTail l(PL_A1);
+	for(std::map<std::pair<std::string,std::string>, unsigned long>::iterator
+			it=stats.begin(); it!=stats.end(); ++it)
+	{
+		l.append(PlCompound("read", PlTermv(
+			PlAtom(it->first.first.c_str()),
+			PlAtom(it->first.second.c_str()),
+			PlTerm((long)it->second))));
+	}
+	return l.close();
+}
+
 PREDICATE(mng_cursor_descending, 2) {
 	char* cursor_id = (char*)PL_A1;
 	char* key       = (char*)PL_A2;
@@ -0,0 +1,353 @@
+:- module(mng_sync,
+    [ mng_changelog_start/1,
+      mng_changelog_stop/0,
+      mng_sync/0,
+      mng_sync/1,
+      mng_sync_batch/2
+    ]).
+/** <module> Incremental replication into a central database.
+
+Changes of a list of collections are recorded in an append-only
+change log collection while mng_changelog_start/1 is active.
+Each entry only holds the collection, the operation, the id of
+the document that was changed, and the resume token of the change event.
+Entries are numbered by a counter stored in the change log, and they
+are written one at a time such that no entry is written after an entry
+with a larger number. The number is used as the watermark of a target.
+Note that this only holds if a change log is recorded by one process.
+The change log is continued after the last recorded event when
+recording is started again, such that changes made in between
+are not missed as long as they are still in the oplog.
+mng_sync/1 ships all entries after the watermark of a target database
+in batches, and advances the watermark after each batch was applied.
+The time needed is proportional to the number of changes since
+the last sync, and not to the size of the database.
+
+A batch is applied by exporting the current version of each changed
+document with `mongoexport`, and importing it into the target
+with `mongoimport` in upsert mode. Documents that do not exist anymore
+are deleted in the target.
+Applying a batch is idempotent such that an interrupted sync can be
+resumed by shipping the batch again.
+Documents are owned by the process that created them, i.e. the latest
+local version of a triple, including its scope, replaces the version
+in the target.
+
+@author Daniel Beßler
+@license BSD
+*/
+
+:- use_module(library(settings)).
+:- use_module(library(http/json)).
+:- use_module(library('db/mongo/client')).
+
+% define some settings
+:- setting(target_uri, atom, '',
+	'URI of the database changes are shipped to by mng_sync/0.').
+:- setting(batch_size, positive_integer, 1000,
+	'Maximum number of change log entries applied at once.').
+:- setting(use_changelog, boolean, false,
+	'Toggle whether changes are recorded in the change log on startup.').
+
+% change streams used to record the change log
+:- dynamic changelog_watcher/1.
+% changelog_collection_(Coll, DB, LogColl): the change log of a watched collection
+:- dynamic changelog_collection_/3.
+
+%% mng_changelog_start(+Collections) is det.
+%
+% Start recording changes of collections in the change log.
+% A change stream is used for each of the collections.
+% Each stream is resumed after the last event of its collection
+% that is stored in the change log.
+%
+% @param Collections list of collection names, e.g. [triples,tf].
+%
+mng_changelog_start(_) :-
+	changelog_watcher(_),
+	!.
+
+mng_changelog_start(Collections) :-
+	% the change log is resolved here as the collection prefix
+	% of the calling thread is not used in the thread of a change stream
+	mng_get_db(DB, LogColl, 'changelog'),
+	mng_index_create(DB, LogColl, ['seq']),
+	forall(
+		(	member(Name, Collections),
+			mng_get_db(DB, Coll, Name)
+		),
+		(	assertz(changelog_collection_(Coll, DB, LogColl)),
+			changelog_pipeline(Coll, Pipeline),
+			mng_watch(DB, Coll,
+				'mng_sync:changelog_event',
+				Pipeline,
+				WatcherID),
+			assertz(changelog_watcher(WatcherID))
+		)
+	).
+
+%%
+changelog_pipeline(Coll, [Pipeline|Resume]) :-
+	Pipeline=[pipeline, array([
+		['$match', ['operationType', ['$in', array([
+			string(insert), string(update),
+			string(replace), string(delete)
+		])]]]
+	])],
+	(	changelog_resume_token(Coll, Token)
+	->	Resume=[['resumeAfter', [['_data', Token]]]]
+	;	Resume=[]
+	).
+
+%%
+% The resume token of the last change of a collection
+% that was recorded in the change log.
+%
+changelog_resume_token(Coll, Token) :-
+	mng_get_db(DB, LogColl, 'changelog'),
+	setup_call_cleanup(
+		(	mng_cursor_create(DB, LogColl, Cursor),
+			mng_cursor_filter(Cursor, ['coll', string(Coll)]),
+			mng_cursor_descending(Cursor, 'seq'),
+			mng_cursor_limit(Cursor, 1)
+		),
+		once(mng_cursor_materialize(Cursor, Doc)),
+		mng_cursor_destroy(Cursor)
+	),
+	get_dict(resume_token, Doc, Token).
+
+%% mng_changelog_stop is det.
+%
+% Stop recording changes.
+%
+mng_changelog_stop :-
+	forall(
+		retract(changelog_watcher(WatcherID)),
+		mng_unwatch(WatcherID)
+	),
+	retractall(changelog_collection_(_, _, _)).
+
+%%
+% Called for each change event of a recorded collection.
+% This is called in the thread of the change stream.
+%
+changelog_event(_WatcherID, Event) :-
+	dict_pairs(Dict, _, Event),
+	get_dict(operationType, Dict, string(Op)),
+	get_dict(ns, Dict, NS),
+	memberchk(coll-string(Coll), NS),
+	get_dict(documentKey, Dict, Key),
+	memberchk('_id'-id(DocID), Key),
+	% the _id of an event is its resume token
+	get_dict('_id', Dict, EventID),
+	memberchk('_data'-Token, EventID),
+	changelog_collection_(Coll, DB, LogColl),
+	% change streams of different collections call this in
+	% different threads. An entry is numbered and written
+	% holding a mutex, such that an entry with a smaller number
+	% is never written after the watermark has passed it.
+	with_mutex(mng_sync_changelog,
+		(	changelog_seq(DB, LogColl, Seq),
+			mng_store(DB, LogColl, [
+				['seq',          int(Seq)],
+				['coll',         string(Coll)],
+				['op',           string(Op)],
+				['doc_id',       id(DocID)],
+				['resume_token', Token]
+			])
+		)).
+
+%%
+% The next number of a change log entry.
+%
+changelog_seq(DB, LogColl, Seq) :-
+	mng_find_and_modify(DB, LogColl,
+		[['_id', string(seq)]],
+		[['$inc', [['next', int(1)]]]],
+		Doc),
+	get_dict(next, Doc, int(Seq)).
+
+%% mng_sync is det.
+%
+% Same as mng_sync/1 with the target_uri setting.
+%
+mng_sync :-
+	setting(mng_sync:target_uri, Target),
+	Target \== '',
+	mng_sync(Target).
+
+%% mng_sync(+Target) is semidet.
+%
+% Ship all changes recorded after the watermark of Target
+% in batches. Fails if a batch could not be applied,
+% in which case the watermark points to the last batch
+% that was applied.
+%
+% @param Target URI of the target database.
+%
+mng_sync(Target) :-
+	mng_sync_batch(Target, Count),
+	(	Count > 0
+	->	mng_sync(Target)
+	;	true
+	).
+
+%% mng_sync_batch(+Target, -Count) is semidet.
+%
+% Ship the next batch of changes recorded after the watermark
+% of Target, and advance the watermark.
+%
+% @param Target URI of the target database.
+% @param Count number of change log entries in the batch.
+%
+mng_sync_batch(Target, Count) :-
+	changelog_batch(Target, Entries),
+	length(Entries, Count),
+	(	Entries == []
+	->	true
+	;	findall(Coll, member(_-Coll-_, Entries), Colls0),
+		list_to_set(Colls0, Colls),
+		forall(
+			member(Coll, Colls),
+			(	findall(DocID, member(_-Coll-DocID, Entries), DocIDs0),
+				list_to_set(DocIDs0, DocIDs),
+				sync_collection(Target, Coll, DocIDs)
+			)
+		),
+		last(Entries, LastSeq-_-_),
+		set_watermark(Target, LastSeq),
+		log_info(db(synced(Target, Count)))
+	).
+
+%%
+changelog_batch(Target, Entries) :-
+	setting(mng_sync:batch_size, BatchSize),
+	mng_get_db(DB, LogColl, 'changelog'),
+	(	get_watermark(Target, Watermark) -> true
+	;	Watermark=0
+	),
+	setup_call_cleanup(
+		(	mng_cursor_create(DB, LogColl, Cursor),
+			mng_cursor_filter(Cursor, [['seq', ['$gt', int(Watermark)]]]),
+			mng_cursor_ascending(Cursor, 'seq'),
+			mng_cursor_limit(Cursor, BatchSize)
+		),
+		findall(Seq-Coll-DocID,
+			(	mng_cursor_materialize(Cursor, Doc),
+				get_dict(seq, Doc, int(Seq)),
+				get_dict(coll, Doc, string(Coll)),
+				get_dict(doc_id, Doc, id(DocID))
+			),
+			Entries),
+		mng_cursor_destroy(Cursor)
+	).
+
+%%
+% Copy the current version of documents into the target,
+% and delete documents that do not exist anymore.
+%
+sync_collection(Target, Coll, DocIDs) :-
+	mng_db_name(DB),
+	mng_uri(Source),
+	setup_call_cleanup(
+		(	tmp_file(sync_query, QueryFile),
+			tmp_file(sync_docs, DocsFile)
+		),
+		(	write_ids_query(QueryFile, DocIDs),
+			sync_tool(mongoexport, [
+				'--uri', Source, '--db', DB, '--collection', Coll,
+				'--queryFile', QueryFile, '--jsonFormat', canonical,
+				'--out', DocsFile
+			]),
+			read_ids(DocsFile, Exported),
+			(	Exported == [] -> true
+			;	sync_tool(mongoimport, [
+					'--uri', Target, '--db', DB, '--collection', Coll,
+					'--mode', upsert, '--file', DocsFile
+				])
+			),
+			subtract(DocIDs, Exported, Deleted),
+			(	Deleted == [] -> true
+			;	write_ids(DocsFile, Deleted),
+				sync_tool(mongoimport, [
+					'--uri', Target, '--db', DB, '--collection', Coll,
+					'--mode', delete, '--file', DocsFile
+				])
+			)
+		),
+		(	delete_tmp_file(QueryFile),
+			delete_tmp_file(DocsFile)
+		)
+	).
+
+%%
+sync_tool(Tool, Args) :-
+	process_create(path(Tool), Args,
+		[ process(PID), stderr(pipe(StdErrStream)) ]
+	),
+	mng_client:read_lines(StdErrStream, _),
+	wait(PID, exited(0)).
+
+%%
+delete_tmp_file(File) :-
+	(	exists_file(File) -> delete_file(File) ; true ).
+
+%%
+write_ids_query(File, DocIDs) :-
+	findall(_{'$oid': ID}, member(ID, DocIDs), OIDs),
+	setup_call_cleanup(
+		open(File, write, Stream),
+		json_write_dict(Stream, _{'_id': _{'$in': OIDs}}, [width(0)]),
+		close(Stream)
+	).
+
+%%
+write_ids(File, DocIDs) :-
+	setup_call_cleanup(
+		open(File, write, Stream),
+		forall(
+			member(ID, DocIDs),
+			(	json_write_dict(Stream, _{'_id': _{'$oid': ID}}, [width(0)]),
+				nl(Stream)
+			)
+		),
+		close(Stream)
+	).
+
+%%
+% Read the ids of documents in a file with one document per line.
+%
+read_ids(File, DocIDs) :-
+	setup_call_cleanup(
+		open(File, read, Stream),
+		read_ids1(Stream, DocIDs),
+		close(Stream)
+	).
+
+read_ids1(Stream, DocIDs) :-
+	read_line_to_string(Stream, Line),
+	(	Line == end_of_file
+	->	DocIDs=[]
+	;	Line == ""
+	->	read_ids1(Stream, DocIDs)
+	;	atom_json_dict(Line, Doc, []),
+		atom_string(ID, Doc.'_id'.'$oid'),
+		DocIDs=[ID|Rest],
+		read_ids1(Stream, Rest)
+	).
+
+%%
+get_watermark(Target, Watermark) :-
+	mng_get_db(DB, Coll, 'sync_state'),
+	mng_find(DB, Coll, [['target', string(Target)]], Doc),
+	get_dict(watermark, Doc, int(Watermark)),
+	!.
+
+%%
+set_watermark(Target, Watermark) :-
+	mng_get_db(DB, Coll, 'sync_state'),
+	mng_remove(DB, Coll, [['target', string(Target)]]),
+	mng_store(DB, Coll, [
+		['target',    string(Target)],
+		['watermark', int(Watermark)]
+	]).
@@ -0,0 +1,95 @@
+:- use_module(library('rostest')).
+:- use_module(library(settings)).
+:- use_module('client').
+:- use_module('sync').
+
+:- begin_tests('mng_sync',
+		[ cleanup(sync_cleanup) ]).
+
+sync_cleanup :-
+	mng_changelog_stop,
+	mng_with_collection_prefix(test_sync,
+		forall(
+			member(Name, [sync_docs, changelog, sync_state]),
+			( mng_get_db(DB, Coll, Name), mng_drop(DB, Coll) )
+		)).
+
+% a second server is needed to test shipping of changes
+has_target :-
+	setting(mng_sync:target_uri, Target),
+	Target \== ''.
+
+test_store(Name, DocID) :-
+	mng_get_db(DB, Coll, sync_docs),
+	mng_store(DB, Coll, [['name', string(Name)]]),
+	mng_find(DB, Coll, [['name', string(Name)]], Doc),
+	get_dict('_id', Doc, id(DocID)).
+
+test_changelog_ids(DocIDs) :-
+	mng_get_db(DB, Coll, changelog),
+	findall(DocID,
+		(	mng_find(DB, Coll, [], Doc),
+			get_dict(doc_id, Doc, id(DocID))
+		),
+		DocIDs).
+
+test_changelog_seqs(Seqs) :-
+	mng_get_db(DB, Coll, changelog),
+	findall(Seq,
+		(	mng_find(DB, Coll, [], Doc),
+			get_dict(seq, Doc, int(Seq))
+		),
+		Seqs0),
+	msort(Seqs0, Seqs).
+
+test_wait_for_changelog(DocID, _) :-
+	test_changelog_ids(DocIDs),
+	memberchk(DocID, DocIDs), !.
+test_wait_for_changelog(_, 0) :- !.
+test_wait_for_changelog(DocID, Count) :-
+	sleep(0.1),
+	Count0 is Count - 1,
+	test_wait_for_changelog(DocID, Count0).
+
+test('mng_changelog_start(+Collections) resumes after the last entry') :-
+	mng_with_collection_prefix(test_sync, (
+		mng_changelog_start([sync_docs]),
+		test_store(a, DocA),
+		test_wait_for_changelog(DocA, 20),
+		mng_changelog_stop,
+		% stored while the change log is not recording
+		test_store(b, DocB),
+		mng_changelog_start([sync_docs]),
+		test_wait_for_changelog(DocB, 20),
+		mng_changelog_stop,
+		test_changelog_ids(DocIDs),
+		test_changelog_seqs(Seqs)
+	)),
+	assert_true(memberchk(DocA, DocIDs)),
+	assert_true(memberchk(DocB, DocIDs)),
+	% entries are numbered in the order they were written
+	assert_equals(Seqs, [1,2]).
+
+test('mng_sync(+Target)', [condition(has_target)]) :-
+	setting(mng_sync:target_uri, Target),
+	mng_with_collection_prefix(test_sync, (
+		mng_changelog_start([sync_docs]),
+		test_store(c, DocC),
+		test_wait_for_changelog(DocC, 20),
+		mng_changelog_stop,
+		assert_true(mng_sync(Target)),
+		% nothing left to ship after the watermark
+		assert_true(mng_sync_batch(Target, 0)),
+		mng_get_db(_, Coll, sync_docs)
+	)),
+	mng_db_name(DB),
+	tmp_file(sync_test, File),
+	mng_sync:sync_tool(mongoexport, [
+		'--uri', Target, '--db', DB, '--collection', Coll,
+		'--jsonFormat', canonical, '--out', File
+	]),
+	mng_sync:read_ids(File, Exported),
+	delete_file(File),
+	assert_true(memberchk(DocC, Exported)).
+
+:- end_tests('mng_sync').
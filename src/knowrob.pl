@@ -5,6 +5,20 @@
 
 :- use_module(library(settings)).
 :- use_module(library('lang/subgraph')).
+:- use_module(library('db/mongo/client'),
+	[ mng_get_db/3,
+	  mng_find/4,
+	  mng_store/3,
+	  mng_remove/3,
+	  mng_bulk_write/3,
+	  mng_distinct_values/4,
+	  mng_count/3,
+	  mng_cursor_create/3,
+	  mng_cursor_destroy/1,
+	  mng_cursor_descending/2,
+	  mng_cursor_limit/2,
+	  mng_cursor_next/2
+	]).
 
 % define some settings
 :- setting(plugins, list, [], 'List of auto-loaded plugins').
@@ -16,37 +30,167 @@ initialize_db :-
 	% initialize hierachical organization of triple graphs
 	add_subgraph(user,common),
 	add_subgraph(test,user),
-	load_graph_structure.
-	
+	startup_task(graph_structure, [], load_graph_structure),
+	% add local names to triples written without them
+	startup_task(local_names, [], lang_triple:update_local_names).
+
 
 %% knowrob_load_neem(+NEEM_id) is det.
 %
 % Configure KnowRob to use the DB associated to some NEEM,
 % and initialize position data etc.
+% The state that is initialized for a NEEM is stored in a
+% manifest document when the NEEM is loaded the first time.
+% This includes the graph hierarchy, URDF descriptions,
+% the initial pose of each frame, and the marker of each object.
+% Loading the NEEM again restores this state from the manifest
+% instead of computing it from the triple and tf collections.
+% The manifest is computed again if the number of documents or the
+% latest document of the triple or tf collection have changed since.
 %
 knowrob_load_neem(NEEM_id) :-
 	% assign DB collection prefix
 	set_setting(mng_client:collection_prefix, NEEM_id),
+	% NEEM dumps may not store local names of IRIs
+	lang_triple:update_local_names,
+	(	knowrob_neem_manifest(Manifest)
+	->	knowrob_load_neem_manifest(Manifest)
+	;	knowrob_load_neem1,
+		knowrob_save_neem_manifest
+	).
+
+%%
+knowrob_load_neem1 :-
 	% re-initialize the triple DB
 	% this is important e.g. to establish triple graph hierarchy.
 	% else we may get orphaned graphs.
 	load_graph_structure,
-	% load URDF files referred to in triple store
-	urdf_init,
-	% initialize position of each frame for tf publishing
+	% load URDF files referred to in triple store,
+	% and initialize position of each frame for tf publishing
+	concurrent(2, [ urdf_init, knowrob_load_neem_tf ], []),
+	% publish object marker messages
+	marker:republish.
+
+%%
+knowrob_load_neem_tf :-
 	tf:tf_republish_clear,
 	tf_mongo:tf_mng_lookup_all(InitialTransforms),
-	forall(
-	    (   member([Ref,Frame,Pos,Rot],InitialTransforms),
-	        % FIXME avoid this elsewhere
-	        Ref \= Frame,
-	        \+ atom_concat('/',Ref,Frame),
-	        \+ atom_concat('/',Frame,Ref)
-	    ),
-		tf:tf_republish_set_pose(Frame,[Ref,Pos,Rot])
+	tf:tf_republish_poses(InitialTransforms, Poses),
+	tf:tf_republish_set_poses(Poses).
+
+%%
+% Read the manifest of the NEEM selected by the collection prefix.
+% Fails if there is no manifest, or if it is outdated.
+%
+knowrob_neem_manifest(Manifest) :-
+	mng_get_db(DB, Coll, 'neem_manifest'),
+	mng_find(DB, Coll, [['type', string(head)]], Doc),
+	!,
+	get_dict(fingerprint, Doc, string(FingerprintString)),
+	term_string(Fingerprint, FingerprintString),
+	neem_fingerprint(Fingerprint),
+	get_dict(graphs, Doc, array(GraphValues)),
+	findall(G, member(string(G), GraphValues), Graphs),
+	findall(Key-Values,
+		(	member(Key-Type, [urdf-urdf, frames-frame, markers-marker]),
+			neem_manifest_entries(DB, Coll, Type, Values)
+		),
+		Pairs),
+	dict_pairs(Manifest, manifest, [graphs-Graphs|Pairs]).
+
+%%
+% Each URDF description, frame and marker is stored
+% in a separate document of the manifest such that
+% the size of the manifest is not limited by the maximum
+% size of a document.
+%
+neem_manifest_entries(DB, Coll, Type, Values) :-
+	findall(Index-Value,
+		(	mng_find(DB, Coll, [['type', string(Type)]], Doc),
+			get_dict(index, Doc, int(Index)),
+			get_dict(value, Doc, string(String)),
+			term_string(Value, String)
+		),
+		Pairs),
+	keysort(Pairs, Sorted),
+	pairs_values(Sorted, Values).
+
+%%
+% The number of documents, and the largest id of the collections
+% the manifest is computed from.
+% The count is read from collection metadata, and the largest id
+% from the _id index such that no collection is scanned.
+%
+neem_fingerprint(Fingerprint) :-
+	findall(Name-Count-Last,
+		(	member(Name, [triples, tf]),
+			collection_fingerprint(Name, Count, Last)
+		),
+		Fingerprint).
+
+collection_fingerprint(Name, int(Count), Last) :-
+	mng_get_db(DB, Coll, Name),
+	mng_count(DB, Coll, Count),
+	setup_call_cleanup(
+		mng_cursor_create(DB, Coll, Cursor),
+		(	mng_cursor_descending(Cursor, '_id'),
+			mng_cursor_limit(Cursor, 1),
+			(	mng_cursor_next(Cursor, Doc)
+			->	get_dict('_id', Doc, Last)
+			;	Last=none
+			)
+		),
+		mng_cursor_destroy(Cursor)
+	).
+
+%%
+knowrob_load_neem_manifest(Manifest) :-
+	load_graph_structure(Manifest.graphs),
+	urdf_init(Manifest.urdf),
+	tf:tf_republish_clear,
+	tf:tf_republish_set_poses(Manifest.frames),
+	marker:publish_messages(Manifest.markers).
+
+%%
+% Write the manifest of the NEEM selected by the collection prefix.
+% The state is read after the NEEM was loaded.
+%
+knowrob_save_neem_manifest :-
+	setting(mng_client:read_only, true),
+	!.
+
+knowrob_save_neem_manifest :-
+	neem_fingerprint(Fingerprint),
+	mng_get_db(DB, TriplesColl, 'triples'),
+	mng_distinct_values(DB, TriplesColl, 'graph', GraphNames),
+	findall(string(G), member(G, GraphNames), GraphValues),
+	urdf_manifest(URDF),
+	tf_mongo:tf_mng_lookup_all(InitialTransforms),
+	tf:tf_republish_poses(InitialTransforms, Frames),
+	marker:object_messages(Markers),
+	findall(insert([
+			['type',  string(Type)],
+			['index', int(Index)],
+			['value', string(String)]
+		]),
+		(	member(Type-Values, [urdf-URDF, frame-Frames, marker-Markers]),
+			nth0(Index, Values, Value),
+			format(string(String), '~k', [Value])
+		),
+		Entries),
+	format(string(Fingerprint_str), '~k', [Fingerprint]),
+	mng_get_db(DB, Coll, 'neem_manifest'),
+	mng_remove(DB, Coll, []),
+	(	Entries == [] -> true
+	;	mng_bulk_write(DB, Coll, Entries)
 	),
-	% publish object marker messages
-	marker:republish.
+	% the head is stored last such that an incomplete
+	% manifest is not used
+	mng_store(DB, Coll, [
+		['type',        string(head)],
+		['graphs',      array(GraphValues)],
+		['fingerprint', string(Fingerprint_str)]
+	]).
 
 %% load_plugins is det.
 %
@@ -0,0 +1,35 @@
+:- use_module(library('rostest')).
+:- use_module(library('db/mongo/client')).
+:- use_module('knowrob').
+
+:- begin_tests('knowrob',
+		[ cleanup(knowrob_test_cleanup) ]).
+
+knowrob_test_cleanup :-
+	mng_with_collection_prefix(test_neem_manifest,
+		forall(
+			member(Name, [triples, tf, neem_manifest]),
+			( mng_get_db(DB, Coll, Name), mng_drop(DB, Coll) )
+		)).
+
+test('knowrob_neem_manifest(-Manifest)') :-
+	mng_with_collection_prefix(test_neem_manifest, (
+		assert_false(knowrob:knowrob_neem_manifest(_)),
+		assert_true(knowrob:knowrob_save_neem_manifest),
+		assert_true(knowrob:knowrob_neem_manifest(_))
+	)).
+
+test('knowrob_neem_manifest(-Manifest) is outdated') :-
+	mng_with_collection_prefix(test_neem_manifest, (
+		assert_true(knowrob:knowrob_save_neem_manifest),
+		assert_true(knowrob:knowrob_neem_manifest(Manifest)),
+		assert_true(is_dict(Manifest, manifest)),
+		mng_get_db(DB, Coll, triples),
+		mng_store(DB, Coll, [
+			['s', string(test_manifest_s)],
+			['graph', string(user)]
+		]),
+		assert_false(knowrob:knowrob_neem_manifest(_))
+	)).
+
+:- end_tests('knowrob').
@@ -7,6 +7,8 @@
 :- use_module(subgraph).
 :- use_module(scope).
 :- use_module(db).
+:- use_module(episodes).
+:- use_module(snapshot).
 :- use_module(rdf_tests).
 
 :- use_module(query).
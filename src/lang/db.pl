@@ -9,7 +9,9 @@
       watch_event(+,+),
       unwatch(+),
       drop_graph/1,
+      volatile_graph/1,
       get_unique_name(r,-),
+      get_unique_names(r,+,-),
       is_unique_name(r),
       setup_collection/2
     ]).
@@ -30,6 +32,8 @@
 :- use_module(library('model/XSD'),
 		[ xsd_data_basetype/2 ]).
 :- use_module(library('db/mongo/client')).
+:- use_module(library('db/mongo/sync'),
+		[ mng_changelog_start/1 ]).
 :- use_module('scope',
 		[ universal_scope/1 ]).
 :- use_module('subgraph').
@@ -38,9 +42,20 @@
 % define some settings
 :- setting(drop_graphs, list, [user],
 		'List of named graphs that should initially by erased.').
+:- setting(volatile_graphs, list, [],
+		'List of named graphs stored in a separate collection that is dropped with the graphs.').
+:- setting(unique_name_block, positive_integer, 1000,
+		'Number of unique names that are reserved at once.').
+
+% unique_name_block_(Coll, Next, End): sequence numbers reserved by this process
+% from the counter stored in collection Coll
+:- dynamic unique_name_block_/3.
+% unique_name_checked_(Coll, Prefix, End): names with Prefix of the block
+% ending at End do not collide with existing names
+:- dynamic unique_name_checked_/3.
 
 %%
-:- setting(mng_client:collection_names, list, [triples, tf, annotations, inferred],
+:- setting(mng_client:collection_names, list, [triples, volatile_triples, tf, annotations, inferred],
 		'List of collections that will be imported/exported with remember/memorize.').
 
 %%
@@ -104,39 +119,182 @@ mng_export(Dir) :-
 %
 % @param Name the graph name.
 %
+drop_graph(Name) :-
+	volatile_graph(Name),
+	!,
+	mng_get_db(DB, Coll, 'volatile_triples'),
+	mng_distinct_values(DB, Coll, 'graph', Graphs),
+	(	forall(member(X, Graphs), atom_string(Name, X))
+	->	drop_volatile_triples(DB, Coll)
+	;	mng_remove(DB, Coll, [
+			[graph, string(Name)]
+		])
+	).
+
 drop_graph(Name) :-
 	mng_get_db(DB, Coll, 'triples'),
 	mng_remove(DB, Coll, [
 		[graph, string(Name)]
 	]).
 
+%%
+% Drop the collection with triples of volatile graphs,
+% and create its indices again.
+%
+drop_volatile_triples(DB, Coll) :-
+	mng_drop(DB, Coll),
+	forall(
+		collection_data_(volatile_triples, Indices),
+		create_indices(volatile_triples, Indices)
+	).
+
+%% volatile_graph(+Name) is semidet.
+%
+% True if triples of a named graph are stored in a separate
+% collection "volatile_triples" instead of the "triples" collection.
+% Queries read from both collections, and dropping the graph
+% drops the separate collection in case it has no other graphs.
+% Volatile graphs are configured through the volatile_graphs setting.
+%
+% @param Name the graph name.
+%
+volatile_graph(Name) :-
+	atom(Name),
+	setting(lang_db:volatile_graphs, Graphs),
+	memberchk(Name, Graphs).
+
+%%
+% The name of the collection that holds the triples of a graph.
+%
+graph_collection(Graph, volatile_triples) :-
+	volatile_graph(Graph),
+	!.
+graph_collection(_, triples).
+
+%%
+% The names of collections that hold triples.
+%
+triple_collection(triples).
+triple_collection(volatile_triples) :-
+	setting(lang_db:volatile_graphs, [_|_]).
+
 %% is_unique_name(+Name) is semidet.
 %
 % True if Name is not the subject of any known fact.
 %
 is_unique_name(Name) :-
-	mng_get_db(DB, Coll, 'triples'),
-	\+ mng_find(DB, Coll, [['s',string(Name)]], _).
+	forall(
+		(	triple_collection(CollName),
+			mng_get_db(DB, Coll, CollName)
+		),
+		\+ mng_find(DB, Coll, [['s',string(Name)]], _)
+	).
 
-%% get_unique_name(+Prefix, -Name) is semidet.
+%% get_unique_name(+Prefix, -Name) is det.
 %
 % Generates a unique name with given prefix.
+% Same as get_unique_names/3 with N=1.
 %
 get_unique_name(Prefix, Name) :-
-	% generate 8 random alphabetic characters
-	randseq(8, 25, Seq_random),
-	maplist(plus(65), Seq_random, Alpha_random),
-	atom_codes(Sub, Alpha_random),
+	get_unique_names(Prefix, 1, [Name]).
+
+%% get_unique_names(+Prefix, +N, -Names) is det.
+%
+% Generates N unique names with given prefix.
+% Names are built from sequence numbers that are reserved
+% in blocks through an atomic update of a counter document
+% in the "unique_names" collection.
+% Hence, names are generated locally without a database round trip
+% except for when a block was used up, and they do not collide
+% with names generated by other processes using the same database.
+% The sequence number is written in base 36 with lower case letters
+% such that names do not collide with upper case names
+% generated by earlier versions.
+% Names with a prefix are checked once per block against
+% existing names, e.g. names such as `Prefix_1` that were not
+% generated, and the block is skipped in case of a collision.
+%
+% @param Prefix the name prefix.
+% @param N the number of names.
+% @param Names list of unique names.
+%
+get_unique_names(Prefix, N, Names) :-
 	% TODO: what IRI prefix? Currently we re-use the one of the type.
 	%        but that seems not optimal. Probably best to
 	%        have this in query context, and some meaningful default.
-	atomic_list_concat([Prefix,'_',Sub], IRI),
-	% check if there is no triple with this identifier as subject or object yet
-	(	is_unique_name(IRI)
-	->	Name=IRI
-	;	unique_name(Prefix,Name)
+	% blocks are reserved from the counter of the collection
+	% that is currently used, e.g. the one of an episode
+	mng_get_db(DB, Coll, 'unique_names'),
+	with_mutex(lang_db_unique_names,
+		reserve_unique_ids(DB, Coll, Prefix, N, IDs)),
+	findall(Name,
+		(	member(ID, IDs),
+			unique_name(Prefix, ID, Name)
+		),
+		Names).
+
+%%
+unique_name(Prefix, ID, Name) :-
+	format(atom(Name), '~w_~36r', [Prefix, ID]).
+
+%%
+reserve_unique_ids(_, _, _, 0, []) :- !.
+reserve_unique_ids(DB, Coll, Prefix, N, IDs) :-
+	unique_id_block(DB, Coll, Prefix, Next, End),
+	Count is min(N, End - Next),
+	Next1 is Next + Count,
+	assertz(unique_name_block_(Coll, Next1, End)),
+	Last is Next1 - 1,
+	numlist(Next, Last, IDs0),
+	N1 is N - Count,
+	reserve_unique_ids(DB, Coll, Prefix, N1, IDs1),
+	append(IDs0, IDs1, IDs).
+
+%%
+% The remaining sequence numbers of the current block,
+% or a new block if the current block was used up or
+% has a name that collides with an existing name.
+%
+unique_id_block(_, Coll, Prefix, Next, End) :-
+	retract(unique_name_block_(Coll, Next, End)),
+	Next < End,
+	unique_id_block_check(Coll, Prefix, Next, End),
+	!.
+
+unique_id_block(DB, Coll, Prefix, Next, End) :-
+	setting(lang_db:unique_name_block, BlockSize),
+	mng_find_and_modify(DB, Coll,
+		[['_id', string(counter)]],
+		[['$inc', [['next', int(BlockSize)]]]],
+		Doc),
+	get_dict(next, Doc, int(End0)),
+	Begin is End0 - BlockSize,
+	retractall(unique_name_checked_(Coll, _, _)),
+	(	unique_id_block_check(Coll, Prefix, Begin, End0)
+	->	Next=Begin, End=End0
+	;	unique_id_block(DB, Coll, Prefix, Next, End)
 	).
 
+%%
+unique_id_block_check(Coll, Prefix, _, End) :-
+	unique_name_checked_(Coll, Prefix, End),
+	!.
+
+unique_id_block_check(Coll, Prefix, Begin, End) :-
+	Last is End - 1,
+	findall(string(Name),
+		(	between(Begin, Last, ID),
+			unique_name(Prefix, ID, Name)
+		),
+		Names),
+	forall(
+		(	triple_collection(CollName),
+			mng_get_db(DB, TriplesColl, CollName)
+		),
+		\+ mng_find(DB, TriplesColl, [['s', ['$in', array(Names)]]], _)
+	),
+	assertz(unique_name_checked_(Coll, Prefix, End)).
+
 %%
 % Drop graphs on startup if requested through settings.
 % This is usually done to start with an empty "user" graph
@@ -145,17 +303,38 @@ get_unique_name(Prefix, Name) :-
 auto_drop_graphs :-
 	\+ setting(mng_client:read_only, true),
 	setting(lang_db:drop_graphs, L),
-	forall(member(X,L), drop_graph(X)).
+	(	setting(lang_db:volatile_graphs, [_|_]),
+		forall(member(X,L), volatile_graph(X))
+	->	mng_get_db(DB, Coll, 'volatile_triples'),
+		drop_volatile_triples(DB, Coll)
+	;	forall(member(X,L), drop_graph(X))
+	).
+
+:- startup_task(drop_graphs, [], ignore(auto_drop_graphs)).
 
-:- ignore(auto_drop_graphs).
+%%
+% Record changes of the collections that are stored with memorize/1
+% in the change log if the `use_changelog` setting is enabled.
+%
+auto_changelog :-
+	\+ setting(mng_client:read_only, true),
+	setting(mng_sync:use_changelog, true),
+	findall(Name, collection_name(Name), Names),
+	mng_changelog_start(Names).
+
+:- startup_task(changelog, [], ignore(auto_changelog)).
 
 %% setup_collection(+Name, +Indices) is det.
 %
 % Configure the indices of a named collection.
+% The indices are created in the background,
+% startup_ready/0 waits until they are available.
 %
 setup_collection(Name, Indices) :-
 	assertz(collection_data_(Name, Indices)),
-	create_indices(Name, Indices).
+	startup_task(indices(Name,Indices), [drop_graphs],
+		create_indices(Name, Indices),
+		[background(true)]).
 
 %% load_owl(+URL) is det.
 %
@@ -207,6 +386,8 @@ load_owl(URL, Options) :-
 % @param ParentGraph The parent graph name.
 %
 load_owl(URL, Scope, ParentGraph) :-
+	% graphs are dropped and organized by startup tasks
+	startup_wait([drop_graphs, graph_structure]),
 	(	url_resolve(URL,Resolved)
 	->	log_info(db(url_resolved(URL,Resolved)))
 	;	Resolved=URL 
@@ -248,9 +429,6 @@ load_owl0(Resolved, Scope, OntoGraph, ParentGraph) :-
 	rdf_equal(owl:'imports',OWL_Imports),
 	rdf_equal(owl:'Ontology',OWL_Ontology),
 	rdf_equal(rdf:'type',RDF_Type),
-	% erase old triples
-	drop_graph(OntoGraph),
-	%
 	load_rdf_(Resolved, Triples),
 	% get ontology IRI
 	(	member(rdf(Unresolved,RDF_Type,OWL_Ontology), Triples) -> true
@@ -264,11 +442,15 @@ load_owl0(Resolved, Scope, OntoGraph, ParentGraph) :-
 			load_owl(I, Scope, ParentGraph)
 		)
 	),
-	% assert a version string
 	file_version(Resolved, Version),
+	(	get_ontology_version(OntoGraph, _)
+	% only apply changes if another version was loaded before
+	->	reload_owl1(Unresolved,Triples,Scope,OntoGraph)
+	% else load data into triple DB
+	;	load_owl1(Unresolved,Triples,Scope,OntoGraph)
+	),
+	% assert a version string
 	set_ontology_version(Unresolved, Version, OntoGraph),
-	% load data into triple DB
-	load_owl1(Unresolved,Triples,Scope,OntoGraph),
 	!,
 	log_info(db(ontology_loaded(OntoGraph,Version))).
 
@@ -296,6 +478,136 @@ load_owl1(IRI, Triples, Scope, Graph) :-
 		kb_project(Term, Scope, [graph(Graph)])
 	).
 
+%%
+% Apply the difference between the triples stored for a graph
+% and the triples of a new version of the ontology.
+% Triples that were removed are deleted in one bulk operation,
+% and added triples are asserted.
+% The parents of triples that refer to classes or properties
+% that lost a taxonomical relation are updated afterwards.
+% Annotations are not stored per graph, only new annotations are
+% asserted, and annotations that were removed are kept.
+%
+reload_owl1(IRI, Triples, Scope, Graph) :-
+	maplist(convert_rdf_(IRI), Triples, Terms),
+	partition(is_annotation_triple(Terms), Terms,
+		AnnotationTriples, TripleTerms),
+	% compare with the triples stored for the graph
+	findall(Key-Term,
+		(	member(Term, TripleTerms),
+			triple_term_key(Term, Key)
+		),
+		NewPairs),
+	graph_triple_keys(Graph, StoredPairs),
+	pairs_keys(NewPairs, NewKeys0),
+	pairs_keys(StoredPairs, StoredKeys0),
+	sort(NewKeys0, NewKeys),
+	sort(StoredKeys0, StoredKeys),
+	ord_subtract(StoredKeys, NewKeys, RemovedKeys),
+	ord_subtract(NewKeys, StoredKeys, AddedKeys),
+	% delete removed triples
+	findall(remove([['_id', id(ID)]]),
+		(	member(Key-ID, StoredPairs),
+			ord_memberchk(Key, RemovedKeys)
+		),
+		Removals),
+	graph_collection(Graph, CollName),
+	mng_get_db(DB, Coll, CollName),
+	(	Removals == [] -> true
+	;	mng_bulk_write(DB, Coll, Removals)
+	),
+	% assert added triples and annotations
+	forall(
+		(	member(Key-Term, NewPairs),
+			ord_memberchk(Key, AddedKeys)
+		),
+		kb_project(Term, Scope, [graph(Graph)])
+	),
+	annotation_keys(AnnotationTriples, AnnotationKeys),
+	forall(
+		(	member(triple(S,P,O), AnnotationTriples),
+			annotation_key(triple(S,P,O), Key),
+			\+ ord_memberchk(Key, AnnotationKeys)
+		),
+		kb_project(annotation(S,P,O), Scope, [graph(Graph)])
+	),
+	% update parents of classes and properties
+	% that lost a taxonomical relation
+	rdf_equal(rdfs:subClassOf, SubClassOf),
+	rdf_equal(rdfs:subPropertyOf, SubPropertyOf),
+	findall(C, member(t(C,SubClassOf,_), RemovedKeys), Classes0),
+	findall(X, member(t(X,SubPropertyOf,_), RemovedKeys), Properties0),
+	sort(Classes0, Classes),
+	sort(Properties0, Properties),
+	lang_triple:update_parents(Classes, Properties),
+	length(AddedKeys, NumAdded),
+	length(RemovedKeys, NumRemoved),
+	log_info(db(ontology_diff(Graph, NumAdded, NumRemoved))).
+
+%%
+% Keys of the triples stored for a graph paired with the document id.
+% The ontology version is not included.
+%
+graph_triple_keys(Graph, Pairs) :-
+	graph_collection(Graph, CollName),
+	mng_get_db(DB, Coll, CollName),
+	findall(t(S,P,V)-ID,
+		(	mng_find(DB, Coll, [['graph', string(Graph)]], Doc),
+			get_dict('_id', Doc, id(ID)),
+			mng_get_dict(s, Doc, string(S)),
+			mng_get_dict(p, Doc, string(P)),
+			P \== tripledbVersionString,
+			get_dict(o, Doc, O),
+			triple_value_key(O, V)
+		),
+		Pairs).
+
+%%
+triple_term_key(triple(S,P,O), t(S,P,V)) :-
+	triple_value_key(O, V).
+
+%%
+% Typed values are compared by their untyped value.
+% Numbers are compared as floats in case of the double type
+% because they are stored as decimals.
+%
+triple_value_key(double(X), V) :- !, number(X), V is float(X).
+triple_value_key(Typed, V) :-
+	mng_strip_type(Typed, _, X),
+	(	string(X) -> atom_string(V, X)
+	;	V=X
+	).
+
+%%
+% Keys of annotations stored for the subjects of annotation triples.
+%
+annotation_keys([], []) :- !.
+annotation_keys(AnnotationTriples, Keys) :-
+	findall(string(S), member(triple(S,_,_), AnnotationTriples), Subjects0),
+	sort(Subjects0, Subjects),
+	mng_get_db(DB, Coll, 'annotations'),
+	findall(t(S,P,V),
+		(	mng_find(DB, Coll, [['s', ['$in', array(Subjects)]]], Doc),
+			mng_get_dict(s, Doc, string(S)),
+			mng_get_dict(p, Doc, string(P)),
+			mng_get_dict(v, Doc, string(V0)),
+			atom_string(V, V0)
+		),
+		Keys0),
+	sort(Keys0, Keys).
+
+%%
+% Annotations are stored with the language tag removed,
+% and UTF8 encoded (see lang_annotation).
+%
+annotation_key(triple(S,P,O), t(S,P,V)) :-
+	mng_strip_type(O, _, O0),
+	(	O0=lang(_,Text) -> true
+	;	Text=O0
+	),
+	lang_annotation:utf8_value(Text, string(V0)),
+	atom_string(V, V0).
+
 %%
 is_annotation_triple(_, triple(_,P,_)) :-
 	annotation_property(P),!.
@@ -454,6 +766,10 @@ get_ontology_version(OntoGraph, Version) :-
 %% Write version string into DB
 set_ontology_version(URL, Version, OntoGraph) :-
 	mng_get_db(DB, Coll, 'triples'),
+	mng_remove(DB, Coll, [
+		['p',     string(tripledbVersionString)],
+		['graph', string(OntoGraph)]
+	]),
 	mng_store(DB, Coll, [
 		['s',     string(URL)],
 		['p',     string(tripledbVersionString)],
@@ -657,3 +973,136 @@ initialize_one_db :-
 % make sure collection "one" has a document
 :- once((setting(mng_client:read_only, true) ; initialize_one_db)).
 
+		 /*******************************
+		 *	    UNIT TESTS	     		*
+		 *******************************/
+
+test_cleanup :-
+	mng_get_db(DB, Coll, 'triples'),
+	mng_remove(DB, Coll, [['graph', string(test_lang_db)]]).
+
+%%
+% Write a version of the test ontology where class C
+% is a direct subclass of Parent.
+%
+test_reload_write(File, Parent) :-
+	Lines=[
+		'<?xml version="1.0"?>',
+		'<rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#"',
+		'    xmlns:rdfs="http://www.w3.org/2000/01/rdf-schema#"',
+		'    xmlns:owl="http://www.w3.org/2002/07/owl#"',
+		'    xml:base="http://knowrob.org/kb/test_reload_owl.owl">',
+		'<owl:Ontology rdf:about="http://knowrob.org/kb/test_reload_owl.owl"/>',
+		'<owl:Class rdf:about="#A"/>',
+		'<owl:Class rdf:about="#B"><rdfs:subClassOf rdf:resource="#A"/></owl:Class>',
+		'<owl:Class rdf:about="#D"><rdfs:subClassOf rdf:resource="#A"/></owl:Class>',
+		'<owl:Class rdf:about="#C"><rdfs:subClassOf rdf:resource="#~w"/></owl:Class>',
+		'<owl:Class rdf:about="#E"><rdfs:subClassOf rdf:resource="#C"/></owl:Class>',
+		'<owl:NamedIndividual rdf:about="#I"><rdf:type rdf:resource="#C"/></owl:NamedIndividual>',
+		'</rdf:RDF>'
+	],
+	atomic_list_concat(Lines, '\n', Format),
+	setup_call_cleanup(
+		open(File, write, Stream),
+		format(Stream, Format, [Parent]),
+		close(Stream)
+	).
+
+test_reload_setup(Dir, File) :-
+	tmp_file(test_reload, Dir),
+	make_directory(Dir),
+	directory_file_path(Dir, 'test_reload_owl.owl', File).
+
+test_reload_cleanup(Dir, File) :-
+	drop_graph(test_reload_owl),
+	delete_file(File),
+	delete_directory(Dir).
+
+test_reload_iri(Name, IRI) :-
+	atom_concat('http://knowrob.org/kb/test_reload_owl.owl#', Name, IRI).
+
+test_reload_doc(S, P, O, Doc) :-
+	test_reload_iri(S, S_IRI),
+	test_reload_iri(O, O_IRI),
+	mng_get_db(DB, Coll, 'triples'),
+	mng_find(DB, Coll, [
+		['s',     string(S_IRI)],
+		['p',     string(P)],
+		['o',     string(O_IRI)],
+		['graph', string(test_reload_owl)]
+	], Doc).
+
+% the names of classes in the "o*" field of a triple
+test_reload_parents(S, P, O, Parents) :-
+	once(test_reload_doc(S, P, O, Doc)),
+	get_dict('o*', Doc, array(Values)),
+	findall(Name,
+		(	member(string(IRI), Values),
+			test_reload_iri(Name, IRI)
+		),
+		Parents0),
+	sort(Parents0, Parents).
+
+test_reload_id(S, P, O, ID) :-
+	once(test_reload_doc(S, P, O, Doc)),
+	get_dict('_id', Doc, ID).
+
+:- begin_tests('lang_db',
+		[ cleanup(lang_db:test_cleanup) ]).
+
+test('get_unique_names(+Prefix,+N,-Names)') :-
+	get_unique_names(test_a, 5, Names),
+	assert_true(length(Names, 5)),
+	assert_true(is_set(Names)),
+	forall(member(Name, Names), assert_true(is_unique_name(Name))).
+
+test('get_unique_names(+Prefix,+N,-Names) across blocks') :-
+	setting(lang_db:unique_name_block, BlockSize),
+	setup_call_cleanup(
+		set_setting(lang_db:unique_name_block, 2),
+		get_unique_names(test_b, 5, Names),
+		set_setting(lang_db:unique_name_block, BlockSize)
+	),
+	assert_true(length(Names, 5)),
+	assert_true(is_set(Names)).
+
+test('get_unique_name(+Prefix,-Name) skips existing names') :-
+	% the next name with another prefix is in the same block
+	get_unique_name(test_c, Name0),
+	atom_concat('test_c_', Suffix0, Name0),
+	atom_concat('36\'', Suffix0, Number0),
+	atom_number(Number0, ID0),
+	ID1 is ID0 + 1,
+	unique_name(test_d, ID1, Existing),
+	mng_get_db(DB, Coll, 'triples'),
+	mng_store(DB, Coll, [
+		['s', string(Existing)],
+		['graph', string(test_lang_db)]
+	]),
+	get_unique_name(test_d, Name1),
+	assert_true(Name1 \== Existing).
+
+test('load_owl(+File) applies the difference to a previous version',
+		[ setup(test_reload_setup(Dir, File)),
+		  cleanup(test_reload_cleanup(Dir, File)) ]) :-
+	rdf_equal(rdfs:subClassOf, SubClassOf),
+	rdf_equal(rdf:type, Type),
+	test_reload_write(File, 'B'),
+	load_owl(File),
+	assert_true(test_reload_parents('E', SubClassOf, 'C', ['A','B','C'])),
+	test_reload_id('B', SubClassOf, 'A', ID_BA),
+	test_reload_id('I', Type, 'C', ID_IC),
+	% C is moved from B to D in the new version
+	test_reload_write(File, 'D'),
+	load_owl(File),
+	assert_false(test_reload_doc('C', SubClassOf, 'B', _)),
+	assert_true(test_reload_doc('C', SubClassOf, 'D', _)),
+	assert_true(test_reload_parents('C', SubClassOf, 'D', ['A','D'])),
+	assert_true(test_reload_parents('E', SubClassOf, 'C', ['A','C','D'])),
+	assert_true(test_reload_parents('I', Type, 'C', ['A','C','D'])),
+	% unchanged triples are not written again
+	assert_true(test_reload_id('B', SubClassOf, 'A', ID_BA)),
+	assert_true(test_reload_id('I', Type, 'C', ID_IC)).
+
+:- end_tests('lang_db').
+
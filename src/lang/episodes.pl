@@ -0,0 +1,266 @@
+:- module(lang_episodes,
+    [ episode_mount/1,
+      episode_unmount/1,
+      episode_mounted/1,
+      episode_call/2
+    ]).
+/** <module> Lazy mounting of episodic memories.
+
+Each episode is stored in a separate set of collections
+that are distinguished by a collection prefix.
+Episodes are mounted on first use, and only a bounded
+number of episodes is kept warm at a time.
+When this bound is exceeded, the least recently used episode
+that is currently not used by any query is unmounted.
+
+The TBox is taken from the collections of the process
+(i.e. the ones selected by the `collection_prefix` setting).
+All episodes share this TBox: queries of an episode read the
+triple collection of the process in addition to the one of the episode,
+such that ontologies are neither parsed nor copied for an episode.
+Note that recursive lookups are not followed across the two
+collections, e.g. a subclass relation between a class of the
+episode and a class of the TBox.
+
+Mounting an episode only blocks queries of the same episode.
+
+@author Daniel Beßler
+@license BSD
+*/
+
+:- use_module(library(settings)).
+:- use_module(library('db/mongo/client'),
+	[ mng_get_db/3,
+	  mng_with_collection_prefix/2,
+	  mng_distinct_values/4,
+	  mng_drop/2
+	]).
+:- use_module(library('utility/filesystem'),
+	[ path_concat/3 ]).
+:- use_module('subgraph',
+	[ load_graph_structure/0 ]).
+
+:- meta_predicate episode_call(+,0).
+:- meta_predicate episode_use(+,0).
+
+% episode_(Name, LastUse, NumUsers, Restored)
+:- dynamic episode_/4.
+% episodes that were unmounted, but whose collections were not dropped yet
+:- dynamic episode_unmounting_/2.
+
+% define some settings
+:- setting(max_episodes, nonneg, 16,
+	'Maximum number of episodes that are mounted at the same time.').
+:- setting(episode_directory, atom, '',
+	'Directory with episode dumps, one sub-directory per episode. Empty if episodes are stored in the DB already.').
+
+%% episode_mounted(?Name) is nondet.
+%
+% True if Name is the name of an episode that is currently mounted.
+%
+% @param Name the episode name.
+%
+episode_mounted(Name) :-
+	episode_(Name, _, _, _).
+
+%% episode_mount(+Name) is det.
+%
+% Mount an episode if it is not mounted yet.
+% If the `episode_directory` setting is configured,
+% the episode is restored from a sub-directory with the name
+% of the episode in case its triples are not stored in the DB yet.
+% Mounting an episode may cause the least recently used episode
+% to be unmounted.
+%
+% @param Name the episode name.
+%
+episode_mount(Name) :-
+	episode_load(Name),
+	with_mutex(lang_episodes,
+		(	retract(episode_(Name, _, NumUsers, Restored))
+		->	get_time(Now),
+			assertz(episode_(Name, Now, NumUsers, Restored)),
+			episode_evict(Name)
+		;	true
+		)),
+	episode_drop_unmounted.
+
+%%
+% Restoring an episode may take long.
+% This is done holding a mutex of the episode only, such
+% that queries of other episodes are not blocked.
+%
+episode_load(Name) :-
+	episode_mutex(Name, Mutex),
+	with_mutex(Mutex,
+		(	episode_drop(Name),
+			(	episode_(Name, _, _, _)
+			->	true
+			;	episode_load1(Name)
+			)
+		)).
+
+%%
+episode_load1(Name) :-
+	mng_with_collection_prefix(Name,
+		(	episode_restore(Name, Restored),
+			load_graph_structure
+		)),
+	get_time(Now),
+	with_mutex(lang_episodes,
+		assertz(episode_(Name, Now, 0, Restored))),
+	log_info(db(episode_mounted(Name))).
+
+%%
+episode_mutex(Name, Mutex) :-
+	atomic_list_concat([lang_episodes, Name], ':', Mutex).
+
+%%
+episode_restore(Name, true) :-
+	setting(lang_episodes:episode_directory, Root),
+	Root \== '',
+	path_concat(Root, Name, Dir),
+	exists_directory(Dir),
+	\+ has_triples,
+	!,
+	lang_db:remember(Dir).
+
+episode_restore(_, false).
+
+%%
+has_triples :-
+	mng_get_db(DB, Coll, 'triples'),
+	mng_distinct_values(DB, Coll, 'graph', [_|_]).
+
+%%
+% The triple collection that holds the shared TBox.
+%
+tbox_collection(DB, Coll) :-
+	setting(mng_client:collection_prefix, Prefix),
+	mng_with_collection_prefix(Prefix,
+		mng_get_db(DB, Coll, 'triples')).
+
+%%
+% Unmount the least recently used episodes that are not
+% in use until there are not more than `max_episodes`.
+% Must be called with the lang_episodes mutex, collections
+% are dropped later by episode_drop_unmounted/0.
+%
+episode_evict(Keep) :-
+	setting(lang_episodes:max_episodes, Max),
+	aggregate_all(count, episode_(_, _, _, _), Count),
+	Count > Max,
+	aggregate_all(min(LastUse, Name),
+		(	episode_(Name, LastUse, 0, _),
+			Name \== Keep
+		),
+		min(_, Evicted)),
+	!,
+	episode_unmount1(Evicted),
+	episode_evict(Keep).
+
+episode_evict(_).
+
+%% episode_unmount(+Name) is det.
+%
+% Unmount an episode. Collections of episodes that were
+% restored from the `episode_directory` are dropped.
+% Episodes that are currently in use by a query are not unmounted.
+%
+% @param Name the episode name.
+%
+episode_unmount(Name) :-
+	with_mutex(lang_episodes,
+		(	episode_(Name, _, 0, _)
+		->	episode_unmount1(Name)
+		;	true
+		)),
+	episode_drop_unmounted.
+
+%%
+episode_unmount1(Name) :-
+	retract(episode_(Name, _, _, Restored)),
+	assertz(episode_unmounting_(Name, Restored)),
+	log_info(db(episode_unmounted(Name))).
+
+%%
+% Drop collections of unmounted episodes.
+% This is done holding the mutex of the episode such that
+% it does not interfere with mounting the episode again.
+%
+episode_drop_unmounted :-
+	forall(
+		episode_unmounting_(Name, _),
+		(	episode_mutex(Name, Mutex),
+			with_mutex(Mutex, episode_drop(Name))
+		)).
+
+%%
+episode_drop(Name) :-
+	retract(episode_unmounting_(Name, Restored)),
+	!,
+	(	Restored == true
+	->	mng_with_collection_prefix(Name,
+			forall(
+				lang_db:collection_name(CollName),
+				(	mng_get_db(DB, Coll, CollName),
+					mng_drop(DB, Coll)
+				)
+			))
+	;	true
+	).
+episode_drop(_).
+
+%% episode_call(+Name, :Goal) is nondet.
+%
+% Call Goal with the collections of an episode.
+% The episode is mounted if needed, and it is not unmounted
+% before Goal has completed.
+% Note that the collections of the episode are only used
+% in the calling thread. Use the `episode(Name)` option of
+% kb_call/4 to run a query on an episode.
+%
+% @param Name the episode name.
+% @param Goal the goal to call.
+%
+episode_call(Name, Goal) :-
+	episode_use(Name,
+		mng_with_collection_prefix(Name, Goal)).
+
+%%
+% Call Goal while the episode is mounted and marked as used.
+%
+episode_use(Name, Goal) :-
+	setup_call_cleanup(
+		episode_acquire(Name),
+		Goal,
+		episode_release(Name)
+	).
+
+%%
+episode_acquire(Name) :-
+	episode_load(Name),
+	with_mutex(lang_episodes,
+		(	retract(episode_(Name, _, NumUsers, Restored))
+		->	get_time(Now),
+			NumUsers1 is NumUsers + 1,
+			assertz(episode_(Name, Now, NumUsers1, Restored)),
+			episode_evict(Name),
+			Acquired=true
+		;	Acquired=false
+		)),
+	episode_drop_unmounted,
+	% the episode was unmounted by another thread after it was loaded
+	(	Acquired == true -> true
+	;	episode_acquire(Name)
+	).
+
+%%
+episode_release(Name) :-
+	with_mutex(lang_episodes,
+		(	retract(episode_(Name, _, NumUsers, Restored))
+		->	NumUsers1 is max(0, NumUsers - 1),
+			get_time(Now),
+			assertz(episode_(Name, Now, NumUsers1, Restored))
+		;	true
+		)).
@@ -11,6 +11,10 @@ prolog:message(lang(_Failed, compilation_failed(Term, _Context))) -->
 prolog:message(lang(Failed, assertion_failed(Body))) -->
 	[ 'Query assertion of rule `~w` failed for clause `~w`.'-[Failed,Body] ].
 
+% a pipeline has been optimized
+prolog:message(mongolog(optimized(Before,After))) -->
+	[ 'optimized pipeline from ~w to ~w stages.'-[Before,After] ].
+
 % OWL file has been loaded before
 prolog:message(db(ontology_detected(Ontology,Version))) -->
 	[ 'detected "~w" ontology version ~w.'-[Ontology,Version] ].
@@ -19,5 +23,24 @@ prolog:message(db(ontology_detected(Ontology,Version))) -->
 prolog:message(db(ontology_loaded(Ontology,Version))) -->
 	[ 'loaded "~w" ontology version ~w.'-[Ontology,Version] ].
 
+prolog:message(db(ontology_diff(Ontology,NumAdded,NumRemoved))) -->
+	[ 'applied changes of "~w" ontology: ~w triples added, ~w removed.'-[Ontology,NumAdded,NumRemoved] ].
+
 prolog:message(db(read_only(Predicate))) -->
 	[ 'Predicate `~w` tried to write despite read only access.'-[Predicate] ].
+
+% an episode has been mounted
+prolog:message(db(episode_mounted(Episode))) -->
+	[ 'mounted episode "~w".'-[Episode] ].
+
+% an episode has been unmounted
+prolog:message(db(episode_unmounted(Episode))) -->
+	[ 'unmounted episode "~w".'-[Episode] ].
+
+% a snapshot has been created
+prolog:message(db(snapshot_created(Snapshot,Time))) -->
+	[ 'created snapshot "~w" at time ~w.'-[Snapshot,Time] ].
+
+% changes have been shipped to another database
+prolog:message(db(synced(Target,Count))) -->
+	[ 'shipped ~w change(s) to "~w".'-[Count,Target] ].
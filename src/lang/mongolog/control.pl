@@ -18,8 +18,13 @@ The following predicates are supported:
 @license BSD
 */
 
+:- use_module(library(settings)).
 :- use_module('mongolog').
 
+% define some settings
+:- setting(prefilter_size, positive_integer, 1000,
+	'Maximum number of groundings used as $in pre-filter of an anti-join.').
+
 %% query commands
 :- mongolog:add_command(fail).
 :- mongolog:add_command(false).
@@ -48,15 +53,10 @@ lang_query:step_expand(not(Goal), Expanded) :-
 %
 % True if‘Goal' cannot be proven (mnemonic: + refers to provable and
 % the backslash (\) is normally used to indicate negation in Prolog).
+% The goal is compiled into an anti-join, see below.
 %
-lang_query:step_expand(\+(Goal), Expanded) :-
-	lang_query:kb_expand(Goal, GoalExpanded),
-	% another way to write it:
-	%Expanded=((call(GoalExpanded),!,fail) ; true),
-	Expanded = (
-		findall([], once(GoalExpanded), L),
-		length(L,0)
-	).
+lang_query:step_expand(\+(Goal), \+(Expanded)) :-
+	lang_query:kb_expand(Goal, Expanded).
 
 %% :Condition -> :Action
 % If-then and If-Then-Else.
@@ -127,6 +127,187 @@ mongolog:step_compile(fail,  _, [['$match', ['$expr', bool(false)]]], []).
 %
 %mongolog:step_compile('!', _, [['$limit',int(1)]]).
 
+%% \+ :Goal
+% Negation compiles into an anti-join, and double negation `\+ \+ Goal`
+% into a semi-join (an exists-check).
+% In both cases, the inner pipeline of the $lookup is cut after the
+% first solution, and projected to the document id only, such that
+% only an empty or a singleton array is joined into the input document.
+% If Goal does not refer to any variable bound before, the lookup is
+% uncorrelated and its result does not depend on the input document.
+% If Goal refers to exactly one such variable, the goal is
+% evaluated uncorrelated with this variable unbound, and the
+% distinct groundings are used as an $in pre-filter on the input document.
+% The pre-filter is limited to the `prefilter_size` setting, input documents
+% are checked with a correlated lookup in case Goal has more groundings.
+%
+mongolog:step_compile(\+(Terminals), Ctx, Pipeline, []) :-
+	(	double_negation(Terminals, Positive)
+	->	semi_join(Positive, Ctx, Pipeline)
+	;	anti_join(Terminals, Ctx, Pipeline)
+	).
+
+%%
+double_negation(Terminals, _) :-
+	var(Terminals), !, fail.
+double_negation(\+(Goal), Goal) :- !.
+double_negation([Terminal], Goal) :-
+	double_negation(Terminal, Goal).
+
+%%
+% anti-join with an uncorrelated $in pre-filter in case Goal is only
+% correlated via a single variable with the input document.
+% This is only done for goals that enumerate all groundings of the
+% variable in case it is unbound, i.e. for triple patterns.
+%
+anti_join(Terminals, Ctx, Pipeline) :-
+	is_generative(Terminals),
+	join_vars(Terminals, Ctx, [[Key,Var]]),
+	\+ mongolog:context_var(Ctx, [Key,_]),
+	% compile a copy of the goal where the join variable is unbound.
+	% the copy of the join variable is referred to with the same key.
+	copy_term(Var-Terminals, VarCopy-TerminalsCopy),
+	option(outer_vars(OuterVars), Ctx),
+	option(disj_vars(DisjVars), Ctx, []),
+	exclude([[K,_]]>>(K==Key), OuterVars, OuterVars0),
+	merge_options([
+		outer_vars(OuterVars0),
+		disj_vars([[Key,VarCopy]|DisjVars])
+	], Ctx, InnerCtx),
+	atom_concat('$', Key, Val),
+	% at most one grounding more than the size of the pre-filter
+	% is joined, such that the joined array remains small.
+	setting(mongolog_control:prefilter_size, MaxSize),
+	Limit is MaxSize + 1,
+	catch(
+		join_lookup(TerminalsCopy, InnerCtx,
+			[	['$group', [['_id', string(Val)]]],
+				['$limit', int(Limit)]
+			],
+			uncorrelated, Lookup),
+		error(instantiation_error),
+		fail
+	),
+	% fallback to correlated lookup in case the variable was
+	% grounded compile-time
+	var(VarCopy),
+	!,
+	% the correlated lookup is only evaluated for input documents
+	% where the pre-filter is incomplete.
+	option(additional_vars(AddVars), Ctx, []),
+	merge_options(
+		[ additional_vars([['t_prefilter',_]|AddVars]) ],
+		Ctx, CorrelatedCtx),
+	mongolog:lookup_array('t_join', Terminals,
+		[['$match', ['$expr', string('$$t_prefilter')]]],
+		[['$limit', int(1)], ['$project', [['_id', int(1)]]]],
+		CorrelatedCtx, _, CorrelatedLookup),
+	atom_concat(Val, '.type', TypeVal),
+	findall(Step,
+		(	Step=Lookup
+		;	Step=['$set', ['t_prefilter',
+				['$gt', array([['$size', string('$t_join')], int(MaxSize)])]
+			]]
+		;	Step=['$match', ['$expr', ['$or', array([
+				string('$t_prefilter'),
+				['$cond', array([
+					% if the variable is unbound in the input document,
+					% then the goal must not have any solution.
+					['$eq', array([string(TypeVal), string(var)])],
+					['$eq', array([['$size', string('$t_join')], int(0)])],
+					% else its value must not be a grounding in any solution,
+					% and no solution must leave the variable unbound.
+					['$not', array([['$or', array([
+						['$in', array([string(Val), string('$t_join._id')])],
+						['$in', array([string(var), string('$t_join._id.type')])]
+					])]])]
+				])]
+			])]]]
+		;	Step=CorrelatedLookup
+		;	Step=['$match', [['t_join', ['$size', int(0)]]]]
+		;	Step=['$unset', array([string('t_join'), string('t_prefilter')])]
+		),
+		Pipeline).
+
+anti_join(Terminals, Ctx, Pipeline) :-
+	(	exists_lookup(Terminals, Ctx, Lookup)
+	->	Pipeline=[
+			Lookup,
+			['$match', [['t_join', ['$size', int(0)]]]],
+			['$unset', string('t_join')]
+		]
+	% the goal cannot be satisfied, so negation is trivially true
+	;	Pipeline=[]
+	).
+
+%%
+semi_join(Terminals, Ctx, Pipeline) :-
+	(	exists_lookup(Terminals, Ctx, Lookup)
+	->	Pipeline=[
+			Lookup,
+			['$match', [['t_join', ['$size', int(1)]]]],
+			['$unset', string('t_join')]
+		]
+	;	Pipeline=[['$match', ['$expr', bool(false)]]]
+	).
+
+%%
+% lookup at most one solution of Goal, and project it to the id.
+%
+exists_lookup(Terminals, Ctx, Lookup) :-
+	lookup_mode(Terminals, Ctx, Mode),
+	join_lookup(Terminals, Ctx,
+		[['$limit', int(1)], ['$project', [['_id', int(1)]]]],
+		Mode, Lookup).
+
+%%
+join_lookup(Terminals, Ctx, Suffix, Mode, Lookup) :-
+	(	Mode==uncorrelated
+	->	merge_options([uncorrelated(true)], Ctx, Ctx0)
+	;	Ctx0=Ctx
+	),
+	mongolog:lookup_array('t_join', Terminals, [], Suffix, Ctx0, _, Lookup).
+
+%%
+% a lookup of Goal is uncorrelated in case Goal does not refer
+% to any variable bound in the input document.
+%
+lookup_mode(Terminals, Ctx, Mode) :-
+	join_vars(Terminals, Ctx, JoinVars),
+	(	JoinVars=[] -> Mode=uncorrelated
+	;	Mode=correlated
+	).
+
+%%
+% the variables in Goal that are bound in the input document.
+%
+join_vars(Terminals, Ctx, JoinVars) :-
+	option(outer_vars(OuterVars), Ctx),
+	term_variables(Terminals, GoalVars),
+	findall([Key,Var],
+		(	member([Key,Var], OuterVars),
+			var(Var),
+			once((member(X, GoalVars), X == Var))
+		;	mongolog:context_var(Ctx, [Key,Var])
+		),
+		JoinVars0),
+	list_to_set(JoinVars0, JoinVars).
+
+%%
+% goals that yield all groundings of a variable in case it is unbound.
+%
+is_generative(Terminals) :-
+	var(Terminals), !, fail.
+is_generative(Terminals) :-
+	is_list(Terminals), !,
+	forall(member(X, Terminals), is_generative(X)).
+is_generative(','(A,B)) :- is_generative([A,B]).
+is_generative(';'(A,B)) :- is_generative([A,B]).
+is_generative(ask(Goal)) :- is_generative(Goal).
+is_generative(triple(_,_,_)).
+is_generative(stepvars(_)).
+is_generative(pragma(_)).
+
 %% :Goal1 ; :Goal2
 % The ‘or' predicate.
 % Unfortunately mongo does not support disjunction of aggregate pipelines.
@@ -441,4 +622,77 @@ test('\\+(+Goal)'):-
 	assert_false(mongolog:test_call(
 		\+(Number > 4), Number, 4.5)).
 
+test('\\+(+Uncorrelated)'):-
+	assert_true(mongolog:test_call(
+		\+((X is 2, X > 3)), Number, 4.5)),
+	assert_false(mongolog:test_call(
+		\+((X is 4, X > 3)), Number, 4.5)).
+
+test('\\+ \\+(+Goal)'):-
+	assert_true(mongolog:test_call(
+		\+(\+(Number > 4)), Number, 4.5)),
+	assert_false(mongolog:test_call(
+		\+(\+(Number > 5)), Number, 4.5)).
+
+test('\\+(+Triple) compiles into $in pre-filter'):-
+	lang_scope:current_scope(QScope),
+	mongolog:mongolog_compile(
+		(	triple(Act, test_neg_type, test_neg_Action),
+			\+ triple(Act, test_neg_interval, _)
+		),
+		pipeline(Doc,_), [scope(QScope)]),
+	assert_true((sub_term(Stage, Doc), Stage=['$group',_])),
+	assert_true((sub_term(Lookup, Doc), Lookup=['$lookup',Opts],
+		memberchk(['let',[]], Opts))).
+
+test_neg_setup :-
+	lang_query:kb_project((
+		triple(test_neg_a1, test_neg_type, test_neg_Action),
+		triple(test_neg_a2, test_neg_type, test_neg_Action),
+		triple(test_neg_a3, test_neg_type, test_neg_Action),
+		triple(test_neg_a1, test_neg_interval, test_neg_i1),
+		triple(test_neg_a3, test_neg_interval, test_neg_i3)
+	)).
+
+test_neg_cleanup :-
+	lang_query:kb_unproject(triple(_, test_neg_type, test_neg_Action)),
+	lang_query:kb_unproject(triple(_, test_neg_interval, _)).
+
+test_neg_actions(Actions, WithInterval) :-
+	findall(Act,
+		lang_query:kb_call((
+			triple(Act, test_neg_type, test_neg_Action),
+			\+ triple(Act, test_neg_interval, _)
+		)),
+		Actions),
+	findall(Act,
+		lang_query:kb_call((
+			triple(Act, test_neg_type, test_neg_Action),
+			\+ \+ triple(Act, test_neg_interval, _)
+		)),
+		WithInterval0),
+	msort(WithInterval0, WithInterval).
+
+test('\\+(+Triple) actions without time interval',
+		[ setup(test_neg_setup),
+		  cleanup(test_neg_cleanup) ]):-
+	test_neg_actions(Actions, WithInterval),
+	assert_equals(Actions, [test_neg_a2]),
+	assert_equals(WithInterval, [test_neg_a1, test_neg_a3]).
+
+test('\\+(+Triple) exceeding the pre-filter size',
+		[ setup((
+			test_neg_setup,
+			setting(mongolog_control:prefilter_size, Size),
+			set_setting(mongolog_control:prefilter_size, 1)
+		  )),
+		  cleanup((
+			set_setting(mongolog_control:prefilter_size, Size),
+			test_neg_cleanup
+		  )) ]):-
+	% two actions have an interval, so the correlated lookup is used
+	test_neg_actions(Actions, WithInterval),
+	assert_equals(Actions, [test_neg_a2]),
+	assert_equals(WithInterval, [test_neg_a1, test_neg_a3]).
+
 :- end_tests('mongolog_control').
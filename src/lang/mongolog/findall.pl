@@ -6,6 +6,7 @@ The following predicates are supported:
 | Predicate    | Arguments |
 | ---          | ---       |
 | findall/3    | +Template, :Goal, -Bag |
+| aggregate_all/3 | +Spec, :Goal, -Result |
 
 @author Daniel Beßler
 @see https://www.swi-prolog.org/pldoc/man?section=allsolutions
@@ -18,6 +19,7 @@ The following predicates are supported:
 
 %% register query commands
 :- mongolog:add_command(findall).
+:- mongolog:add_command(aggregate_all).
 % TODO: support bagof (then, setof := bagof o sort)
 %:- mongolog:add_command(bagof).
 %:- mongolog:add_command(setof).
@@ -28,6 +30,12 @@ lang_query:step_expand(
 		findall(Template, Expanded, List)) :-
 	lang_query:kb_expand(Goal, Expanded).
 
+%%
+lang_query:step_expand(
+		aggregate_all(Spec, Goal, Result),
+		aggregate_all(Spec, Expanded, Result)) :-
+	lang_query:kb_expand(Goal, Expanded).
+
 %% setof(+Template, +Goal, -Set)
 % Equivalent to bagof/3, but sorts the result using sort/2 to
 % get a sorted list of alternatives without duplicates.
@@ -79,6 +87,86 @@ mongolog:step_compile(
 		),
 		Pipeline).
 
+%% aggregate_all(+Spec, :Goal, -Result)
+% Aggregate the solutions of Goal similar to aggregate_all/3.
+% Spec is one of count, sum(Expr), min(Expr) or max(Expr),
+% or a compound term whose arguments are such specifications,
+% e.g. r(count,sum(X)), in which case Result is a term with
+% the same functor.
+% Unlike findall/3, the solutions are not collected into an array,
+% but aggregated by a $group stage.
+% count and sum are 0 if Goal has no solution, while min and max fail.
+%
+mongolog:step_compile(
+		aggregate_all(Spec, Terminals, Result),
+		Ctx, Pipeline, StepVars) :-
+	aggregate_specs(Spec, Result, Specs, Results),
+	mongolog:step_vars(Results, Ctx, StepVars),
+	% vars in Spec are referred to with a common key within Goal
+	mongolog:step_vars(Specs, Ctx, SpecVars),
+	once((select(disj_vars(DisjVars), Ctx, Ctx0);(DisjVars=[],Ctx0=Ctx))),
+	append(DisjVars, SpecVars, DisjVars0),
+	list_to_set(DisjVars0,DisjVars1),
+	Ctx1=[disj_vars(DisjVars1)|Ctx0],
+	findall(Accumulator,
+		(	nth1(Index, Specs, X),
+			aggregate_accumulator(X, Index, Ctx1, Accumulator)
+		),
+		Accumulators),
+	findall(Step,
+		% perform lookup, the inner pipeline yields at most one document
+		(	mongolog:lookup_array('t_next', Terminals, [],
+				[['$group', [['_id', int(0)] | Accumulators]]],
+				Ctx1, _, Step)
+		% min and max are not defined in case Goal has no solution
+		;	(	once(( member(X, Specs), X=..[F,_], memberchk(F, [min,max]) )),
+				Step=['$match', [['t_next', ['$size', int(1)]]]]
+			)
+		;	Step=['$set', ['t_agg', ['$arrayElemAt', array([string('$t_next'), int(0)])]]]
+		;	(	nth1(Index, Results, Y),
+				aggregate_result(Y, Index, Ctx1, Step)
+			)
+		;	Step=['$unset', array([string('t_next'), string('t_agg')])]
+		),
+		Pipeline).
+
+%%
+aggregate_specs(Spec, Result, [Spec], [Result]) :-
+	is_aggregate_spec(Spec), !.
+aggregate_specs(Spec, Result, Specs, Results) :-
+	compound(Spec),
+	Spec =.. [Functor|Specs],
+	forall(member(X, Specs), is_aggregate_spec(X)),
+	length(Specs, Arity),
+	length(Results, Arity),
+	Result =.. [Functor|Results].
+
+%%
+is_aggregate_spec(count).
+is_aggregate_spec(sum(_)).
+is_aggregate_spec(min(_)).
+is_aggregate_spec(max(_)).
+
+%%
+aggregate_accumulator(count, Index, _Ctx, [Key, ['$sum', int(1)]]) :-
+	!,
+	atom_concat(a, Index, Key).
+aggregate_accumulator(Spec, Index, Ctx, [Key, [Operator, Value]]) :-
+	Spec =.. [F, Expr],
+	atom_concat('$', F, Operator),
+	mongolog:var_key_or_val(Expr, Ctx, Value),
+	atom_concat(a, Index, Key).
+
+%%
+aggregate_result(Result, Index, Ctx, Step) :-
+	atomic_list_concat(['$t_agg.a', Index], Field),
+	% count and sum are 0 for empty input
+	Expr=['$ifNull', array([string(Field), int(0)])],
+	mongolog:var_key_or_val(Result, Ctx, Result0),
+	(	mongolog:set_if_var(Result, Expr, Ctx, Step)
+	;	mongolog:match_equals(Result0, Expr, Step)
+	).
+
 %%
 % findall template must be given compile-time to construct the mongo expression
 % to map lookup results to be a proper instantiation of the template.
@@ -192,6 +280,32 @@ test('findall with ungrounded'):-
 	assert_unifies(Results,[_,9.0]),
 	( Results=[Var|_] -> assert_true(var(Var)) ; true ).
 
+test('aggregate_all(+Spec,+Succeeds,-Result)'):-
+	mongolog:test_call(
+		aggregate_all(r(count,sum(X),min(X),max(X)),
+			(	(X is (Num + 5))
+			;	(X is (Num * 2))
+			),
+			Result),
+		Num, double(4.5)
+	),
+	assert_equals(Result, r(2, 18.5, 9.0, 9.5)).
+
+test('aggregate_all(+Spec,+Fails,-Result)'):-
+	mongolog:test_call(
+		aggregate_all(r(count,sum(X)),
+			(Num > 5, X is (Num * 2)),
+			Result),
+		Num, double(4.5)
+	),
+	assert_equals(Result, r(0, 0)),
+	assert_false(mongolog:test_call(
+		aggregate_all(max(X), (Num > 5, X is (Num * 2)), _),
+		Num, double(4.5))),
+	assert_false(mongolog:test_call(
+		aggregate_all(min(X), (Num > 5, X is (Num * 2)), _),
+		Num, double(4.5))).
+
 test('findall 1-element list'):-
 	mongolog:test_call(
 		(	findall([X],
@@ -398,6 +398,21 @@ test('mongolog_call(test_fluent(?))') :-
 	;	true
 	).
 
+test('kb_call(test_fluent(?)) in snapshot') :-
+	get_time(Now),
+	setup_call_cleanup(
+		lang_snapshot:kb_snapshot_create(Now, Snapshot),
+		(	% a later value is not in the snapshot
+			assert_true(mongolog_call(assert(test_fluent(5.0)))),
+			assert_true(lang_query:kb_call(test_fluent(4.0),
+				_, _, [snapshot(Snapshot)])),
+			assert_false(lang_query:kb_call(test_fluent(5.0),
+				_, _, [snapshot(Snapshot)])),
+			assert_true(mongolog_call(retractall(test_fluent(5.0))))
+		),
+		lang_snapshot:kb_snapshot_destroy(Snapshot)
+	).
+
 test('mongolog_update(test_fluent(6.0))') :-
 	assert_true(mongolog_call(test_fluent(4.0))),
 	assert_true(mongolog_call(assert(test_fluent(6.0)))),
@@ -77,6 +77,10 @@ ensure_list(X,[X]).
 %% limit(+Count, :Goal)
 % Limit the number of solutions.
 % True if Goal is true, returning at most Count solutions.
+% once/1 and cut are compiled into limit(1,Goal).
+% In case Goal does not refer to any variable bound before,
+% the lookup is uncorrelated such that its result does not depend
+% on the input document, and can be shared among them.
 %
 mongolog:step_compile(
 		limit(_, Terminals), _Ctx, [], []) :-
@@ -89,9 +93,14 @@ mongolog:step_compile(
 	mongolog:var_key_or_val(Count,Ctx,Count0),
 	% appended to inner pipeline of lookup
 	Suffix=[['$limit',Count0]],
+	(	number(Count),
+		mongolog_control:lookup_mode(Terminals, Ctx, uncorrelated)
+	->	merge_options([uncorrelated(true)], Ctx, Ctx0)
+	;	Ctx0=Ctx
+	),
 	% create a lookup and append $limit to inner pipeline,
 	% then unwind next and assign variables to the toplevel document.
-	lookup_next_unwind(Terminals, Suffix, Ctx, Pipeline, StepVars0),
+	lookup_next_unwind(Terminals, Suffix, Ctx0, Pipeline, StepVars0),
 	%
 	(	mongolog:goal_var(Count,Ctx,Count_var)
 	->	StepVars=[Count_var|StepVars0]
@@ -174,6 +183,19 @@ test('limit(2, +Goal)'):-
 	assert_true(memberchk(9.5, Results)),
 	assert_true(memberchk(9.0, Results)).
 
+test('limit(1, +Uncorrelated)'):-
+	findall(X,
+		mongolog:test_call(
+			limit(1, (
+				(X is 2)
+			;	(X is 3)
+			)),
+			Num, 4.5),
+		Results
+	),
+	assert_unifies(Results,[_]),
+	assert_true((Results=[Y], Y =:= 2)).
+
 test('once(+Goal)'):-
 	mongolog:test_call(
 		once((
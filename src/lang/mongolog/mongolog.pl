@@ -9,9 +9,18 @@
 @license BSD
 */
 
+:- use_module(library(settings)).
 :- use_module(library('semweb/rdf_db'),
 	    [ rdf_meta/1, rdf_global_term/2 ]).
 :- use_module(library('db/mongo/client')).
+:- use_module('optimize',
+	    [ pipeline_optimize/2, pipeline_length/2, pipeline_unset_dead/3 ]).
+
+% define some settings
+:- setting(optimize, boolean, true,
+	'Flag if compiled pipelines are optimized before they are called.').
+:- setting(optimize_report, boolean, false,
+	'Flag if the pipeline length before and after optimization is reported.').
 
 %% set of registered query commands.
 :- dynamic step_command/1.
@@ -66,6 +75,8 @@ mongolog_call(Goal) :-
 %% mongolog_call(+Goal, +Options) is nondet.
 %
 % Call Goal by translating it into an aggregation pipeline.
+% The option read_preference(Mode) routes the pipeline to members
+% of a replica set (see mng_cursor_read_preference/2).
 %
 % @param Goal A compound term expanding into an aggregation pipeline
 % @param Options Additional options
@@ -80,16 +91,21 @@ mongolog_call(Goal, Context) :-
 	append(Vars1, GlobalVars, Vars2),
 	list_to_set(Vars2,Vars3),
 	% run the pipeline
-	query_1(Doc, Vars3).
+	query_1(Doc, Vars3, Context).
 
-query_1(Pipeline, Vars) :-
+query_1(Pipeline, Vars, Context) :-
 	% get DB for cursor creation. use collection with just a
 	% single document as starting point.
 	mng_one_db(DB, Coll),
 	% run the query
 	setup_call_cleanup(
 		% setup: create a query cursor
-		mng_cursor_create(DB, Coll, Cursor),
+		(	mng_cursor_create(DB, Coll, Cursor),
+			(	option(read_preference(Mode), Context)
+			->	mng_cursor_read_preference(Cursor, Mode)
+			;	true
+			)
+		),
 		% call: find matching document
 		(	mng_cursor_aggregate(Cursor, ['pipeline',array(Pipeline)]),
 			query_2(Cursor, Vars)
@@ -298,8 +314,108 @@ mongolog_compile(Terminals, pipeline(Doc, Vars), Context) :-
 %%
 query_compile1(Terminals, Doc, Vars, Context) :-
 	DocVars=[['g_assertions',_]],
-	compile_terms(Terminals, Doc0, DocVars->Vars, _StepVars, Context),
-	Doc=[['$set',['g_assertions',array([])]] | Doc0].
+	compile_steps(Terminals, Steps, DocVars->Vars, Context),
+	query_unset_dead(Terminals, Steps, Vars, Context, Doc0),
+	Doc1=[['$set',['g_assertions',array([])]] | Doc0],
+	query_optimize(Doc1, Doc).
+
+%%
+% Compile each expanded top-level term of a query into a term
+% step(Term, Pipeline, Vars) where Vars are the variables
+% defined after the step.
+%
+compile_steps(Goal, Steps, Vars, Context) :-
+	\+ is_list(Goal), !,
+	compile_steps([Goal], Steps, Vars, Context).
+
+compile_steps([], [], V0->V0, _) :- !.
+compile_steps([X|Xs], Steps, V0->Vn, Context) :-
+	% TODO: do not depend on lang_query
+	lang_query:kb_expand(X, Expanded),
+	(	is_list(Expanded)
+	->	flatten(Expanded, Expanded0)
+	;	Expanded0=[Expanded]
+	),
+	compile_expanded_steps(Expanded0, Steps0, V0->V1, Context),
+	compile_steps(Xs, Steps1, V1->Vn, Context),
+	append(Steps0, Steps1, Steps).
+
+compile_expanded_steps([], [], V0->V0, _) :- !.
+compile_expanded_steps([X|Xs], [step(X,Doc,V1)|Steps], V0->Vn, Context) :-
+	compile_expanded_term(X, Doc, V0->V1, _, Context),
+	compile_expanded_steps(Xs, Steps, V1->Vn, Context).
+
+%%
+% Concatenate the pipelines of the steps, and remove variables
+% from the document that are not referred to in remaining steps.
+% Only variables that are needed to unify the query are kept
+% in the document after the last step.
+%
+query_unset_dead(_, Steps, _, _, Doc) :-
+	setting(mongolog:optimize, false),
+	!,
+	foldl([step(_,X,_),D0,D1]>>append(D0,X,D1), Steps, [], Doc).
+
+query_unset_dead(Terminals, Steps, Vars, Context, Doc) :-
+	findall(step(Reads,Stages,Defined),
+		(	member(step(Term,Stages,StepVars), Steps),
+			referred_keys(Term, Vars, Reads),
+			findall(Key, (member([Key,Var],StepVars), var(Var)), Defined)
+		),
+		LiveSteps),
+	output_keys(Terminals, Vars, Context, LiveOut),
+	pipeline_unset_dead(LiveSteps, LiveOut, Doc).
+
+%%
+% Keys of variables that appear in a term.
+%
+referred_keys(Term, Vars, Keys) :-
+	term_variables(Term, TermVars),
+	findall(Key,
+		(	member([Key,Var], Vars),
+			var(Var),
+			once((member(X,TermVars), X==Var))
+		),
+		Keys).
+
+%%
+% Keys of fields that are needed after the last step.
+% The option output_vars(OutVars) can be used to restrict the
+% variables of the query that need to be unified, else all variables
+% in the query are unified.
+% Fields referred to by the scope and user variables are kept too.
+%
+output_keys(Terminals, Vars, Context, Keys) :-
+	(	option(output_vars(OutVars), Context)
+	->	true
+	;	term_variables(Terminals, OutVars)
+	),
+	findall(Key,
+		(	Key='g_assertions'
+		;	option(user_vars(UserVars), Context),
+			member([Key,_], UserVars)
+		;	referred_keys(OutVars, Vars, OutKeys),
+			member(Key, OutKeys)
+		;	option(scope(Scope), Context),
+			sub_term(string(Val), Scope),
+			atom(Val),
+			atom_concat('$', Key, Val)
+		),
+		Keys0),
+	list_to_set(Keys0, Keys).
+
+%%
+query_optimize(Doc, Doc) :-
+	setting(mongolog:optimize, false),
+	!.
+query_optimize(Doc, Optimized) :-
+	pipeline_optimize(Doc, Optimized),
+	(	setting(mongolog:optimize_report, true)
+	->	pipeline_length(Doc, Before),
+		pipeline_length(Optimized, After),
+		log_info(mongolog(optimized(Before, After)))
+	;	true
+	).
 
 %%
 compile_terms(Goal, Pipeline, Vars, StepVars, Context) :-
@@ -435,16 +551,21 @@ lookup_set_vars(InnerVars, SetVars) :-
 %%
 % find all records matching a query and store them
 % in an array.
+% The option uncorrelated(true) can be used in Context to create
+% a lookup that does not pass any variables from the input document
+% to the inner pipeline.
 %
 lookup_array(ArrayKey, Terminals,
 		Prefix, Suffix,
-		Context, StepVars,
+		Context0, StepVars,
 		['$lookup', [
 			['from', string(Coll)],
 			['as', string(ArrayKey)],
 			['let', LetDoc],
 			['pipeline', array(Pipeline1)]
 		]]) :-
+	% nested lookups are correlated with the inner document again
+	select_option(uncorrelated(Uncorrelated), Context0, Context, false),
 	% get variables referred to in query
 	option(outer_vars(OuterVars), Context),
 	% within a disjunction VV provides mapping between
@@ -474,10 +595,14 @@ lookup_array(ArrayKey, Terminals,
 	),
 	% pass variables from outer goal to inner if they are referred to
 	% in the inner goal.
-	lookup_let_doc(StepVars2, LetDoc),
-	% set all let variables so that they can be accessed
-	% without aggregate operators in Pipeline
-	lookup_set_vars(StepVars2, SetVars),
+	(	Uncorrelated==true
+	->	( LetDoc=[], SetVars=[] )
+	;	(	lookup_let_doc(StepVars2, LetDoc),
+			% set all let variables so that they can be accessed
+			% without aggregate operators in Pipeline
+			lookup_set_vars(StepVars2, SetVars)
+		)
+	),
 	% compose inner pipeline
 	(	SetVars=[] -> Prefix0=Prefix
 	;	Prefix0=[['$set', SetVars] | Prefix]
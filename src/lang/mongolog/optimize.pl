@@ -0,0 +1,613 @@
+:- module(mongolog_optimize,
+	[ pipeline_optimize(+,-),
+	  pipeline_length(+,-),
+	  pipeline_unset_dead(+,+,-)
+	]).
+/** <module> Optimization of aggregation pipelines generated by mongolog.
+
+The mongolog compiler generates the stages of a pipeline
+for each command independently of the other commands in a query.
+This yields stages that are redundant for a particular query.
+The optimization pass implemented here rewrites a pipeline into
+an equivalent pipeline with less stages:
+
+  - constant expressions in $match stages are folded, and stages
+    following a $match that always fails are dropped
+  - $set of fields that are removed by a later $unset without being
+    read in between are dropped
+  - adjacent $match, $set, $unset, $project and $limit stages are merged
+  - $match stages are moved before $set, $unset, $lookup and $unwind stages
+    they do not depend on. This reduces the number of documents processed
+    by these stages, and allows a $match at the start of a
+    $lookup pipeline to use indexes.
+
+The pass is applied recursively to the pipelines of $lookup stages.
+
+In addition, pipeline_unset_dead/3 removes the fields of variables
+from the intermediate documents once no later step refers to them,
+and they are not needed to unify the variables of the query.
+
+@author Daniel Beßler
+@license BSD
+*/
+
+%% pipeline_optimize(+Pipeline, -Optimized) is det.
+%
+% Rewrite a pipeline into an equivalent pipeline with less stages.
+% The rewriting is repeated until a fixpoint is reached.
+%
+% @param Pipeline list of aggregation stages.
+% @param Optimized the optimized list of stages.
+%
+pipeline_optimize(Pipeline, Optimized) :-
+	optimize_stages(Pipeline, Pipeline0),
+	(	Pipeline0 == Pipeline
+	->	Optimized = Pipeline
+	;	pipeline_optimize(Pipeline0, Optimized)
+	).
+
+%% pipeline_length(+Pipeline, -Length) is det.
+%
+% The number of stages in a pipeline including stages
+% of nested $lookup pipelines.
+%
+% @param Pipeline list of aggregation stages.
+% @param Length the number of stages.
+%
+pipeline_length(Pipeline, Length) :-
+	foldl([Stage,N0,N1]>>(
+		(	lookup_pipeline(Stage, Inner)
+		->	pipeline_length(Inner, M)
+		;	M=0
+		),
+		N1 is N0 + M + 1
+	), Pipeline, 0, Length).
+
+%%
+optimize_stages(Stages, Optimized) :-
+	maplist(optimize_nested, Stages, Stages0),
+	fold_stages(Stages0, Stages1),
+	drop_dead_sets(Stages1, Stages2),
+	merge_stages(Stages2, Stages3),
+	hoist_matches(Stages3, Optimized).
+
+%%
+optimize_nested(['$lookup', Opts0], ['$lookup', Opts1]) :-
+	select(['pipeline', array(Inner0)], Opts0,
+	       ['pipeline', array(Inner1)], Opts1),
+	!,
+	pipeline_optimize(Inner0, Inner1).
+optimize_nested(Stage, Stage).
+
+%%
+lookup_pipeline(['$lookup', Opts], Inner) :-
+	memberchk(['pipeline', array(Inner)], Opts).
+
+		 /*******************************
+		 *	    CONSTANT FOLDING   		*
+		 *******************************/
+
+%%
+fold_stages([], []) :- !.
+fold_stages([Stage|Rest], Folded) :-
+	fold_stage(Stage, Stage0),
+	(	Stage0 == []
+	->	fold_stages(Rest, Folded)
+	;	Stage0 == ['$match', ['$expr', bool(false)]],
+		\+ ( member(X, Rest), is_generating_stage(X) )
+	% no document can pass a failing $match,
+	% so the remaining stages can be dropped.
+	->	Folded = [Stage0]
+	;	(	Folded = [Stage0|Folded0],
+			fold_stages(Rest, Folded0)
+		)
+	).
+
+%%
+% stages that may produce documents for empty input
+%
+is_generating_stage(['$facet', _]).
+is_generating_stage(['$unionWith', _]).
+
+%%
+fold_stage(['$match', Query], Folded) :-
+	!,
+	doc_pairs(Query, Pairs),
+	fold_query(Pairs, Pairs0),
+	(	Pairs0 == failing -> Folded=['$match', ['$expr', bool(false)]]
+	;	Pairs0 == []      -> Folded=[]
+	;	Pairs0 == Pairs   -> Folded=['$match', Query]
+	;	Folded=['$match', Pairs0]
+	).
+fold_stage([Op, Doc], []) :-
+	memberchk(Op, ['$set', '$addFields', '$unset']),
+	(	Doc == [] ; Doc == array([]) ),
+	!.
+fold_stage(Stage, Stage).
+
+%%
+fold_query([], []) :- !.
+fold_query([Pair|Pairs], Folded) :-
+	fold_query_pair(Pair, Pair0),
+	(	Pair0 == failing -> Folded=failing
+	;	(	fold_query(Pairs, Pairs0),
+			(	Pairs0 == failing -> Folded=failing
+			;	Pair0 == []       -> Folded=Pairs0
+			;	Folded=[Pair0|Pairs0]
+			)
+		)
+	).
+
+fold_query_pair(['$expr', Expr], Folded) :-
+	!,
+	fold_expr(Expr, Expr0),
+	(	Expr0 == bool(true)  -> Folded=[]
+	;	Expr0 == bool(false) -> Folded=failing
+	;	Folded=['$expr', Expr0]
+	).
+fold_query_pair(['$and', array(Queries)], Folded) :-
+	!,
+	findall(Q,
+		(	member(Query, Queries),
+			doc_pairs(Query, Pairs),
+			fold_query(Pairs, Q),
+			Q \== []
+		),
+		Queries0),
+	(	memberchk(failing, Queries0) -> Folded=failing
+	;	Queries0 == []               -> Folded=[]
+	;	Folded=['$and', array(Queries0)]
+	).
+fold_query_pair(Pair, Pair).
+
+%%
+fold_expr(['$and', array(Args)], Folded) :-
+	!,
+	maplist(fold_expr, Args, Args0),
+	exclude(==(bool(true)), Args0, Args1),
+	(	memberchk(bool(false), Args1) -> Folded=bool(false)
+	;	Args1 == []                   -> Folded=bool(true)
+	;	Args1 = [Single]              -> Folded=Single
+	;	Folded=['$and', array(Args1)]
+	).
+fold_expr(['$or', array(Args)], Folded) :-
+	!,
+	maplist(fold_expr, Args, Args0),
+	exclude(==(bool(false)), Args0, Args1),
+	(	memberchk(bool(true), Args1) -> Folded=bool(true)
+	;	Args1 == []                  -> Folded=bool(false)
+	;	Args1 = [Single]             -> Folded=Single
+	;	Folded=['$or', array(Args1)]
+	).
+fold_expr(['$not', array([Arg])], Folded) :-
+	!,
+	fold_expr(Arg, Arg0),
+	(	Arg0 == bool(true)  -> Folded=bool(false)
+	;	Arg0 == bool(false) -> Folded=bool(true)
+	;	Folded=['$not', array([Arg0])]
+	).
+fold_expr([Op, array([X,Y])], Folded) :-
+	memberchk(Op, ['$eq','$ne']),
+	is_constant(X),
+	is_constant(Y),
+	!,
+	constant_equal(X, Y, Equal),
+	(	Equal == unknown -> Folded=[Op, array([X,Y])]
+	;	Op == '$eq'      -> Folded=bool(Equal)
+	;	Equal == true    -> Folded=bool(false)
+	;	Folded=bool(true)
+	).
+fold_expr(Expr, Expr).
+
+%%
+% numbers are compared by value, e.g. int(1) and double(1.0)
+% are equal in mongo.
+%
+constant_equal(X, Y, Equal) :-
+	is_numeric(X, NX),
+	is_numeric(Y, NY),
+	!,
+	(	NX =:= NY -> Equal=true
+	;	Equal=false
+	).
+constant_equal(X, Y, true) :-
+	X == Y, !.
+constant_equal(X, Y, false) :-
+	functor(X,F,1), functor(Y,F,1), !.
+constant_equal(_, _, unknown).
+
+%%
+is_numeric(double(X),  X).
+is_numeric(int(X),     X).
+is_numeric(integer(X), X).
+
+%%
+is_constant(string(X)) :-
+	atom(X), \+ atom_concat('$',_,X).
+is_constant(double(X))  :- number(X).
+is_constant(int(X))     :- integer(X).
+is_constant(integer(X)) :- integer(X).
+is_constant(bool(X))    :- atom(X).
+
+		 /*******************************
+		 *	    DEAD STAGES     		*
+		 *******************************/
+
+%%
+% drop $set of fields that are removed later without
+% being read before.
+%
+drop_dead_sets([], []) :- !.
+drop_dead_sets([[Op,Doc]|Rest], Out) :-
+	memberchk(Op, ['$set', '$addFields']),
+	!,
+	doc_pairs(Doc, Pairs),
+	exclude([[Key,_]]>>is_dead_field(Key, Rest), Pairs, Live),
+	(	Live == []    -> Out=Out0
+	;	Live == Pairs -> Out=[[Op,Doc]|Out0]
+	;	Out=[[Op,Live]|Out0]
+	),
+	drop_dead_sets(Rest, Out0).
+drop_dead_sets([Stage|Rest], [Stage|Out]) :-
+	drop_dead_sets(Rest, Out).
+
+%%
+is_dead_field(Key, [Stage|Rest]) :-
+	(	stage_unsets(Stage, Unset),
+		member(Field, Unset),
+		( Field == Key ; is_path_prefix(Field, Key) )
+	->	true
+	;	stage_reads(Stage, Reads),
+		member(Read, Reads),
+		is_related_path(Read, Key)
+	->	fail
+	;	stage_writes(Stage, all)
+	->	fail
+	;	is_dead_field(Key, Rest)
+	).
+
+		 /*******************************
+		 *	    MERGING STAGES     		*
+		 *******************************/
+
+%%
+merge_stages([], []) :- !.
+merge_stages([X,Y|Rest], Merged) :-
+	merge_stage(X, Y, XY),
+	!,
+	merge_stages([XY|Rest], Merged).
+merge_stages([X|Rest], [X|Merged]) :-
+	merge_stages(Rest, Merged).
+
+%%
+merge_stage(['$match', Q1], ['$match', Q2], ['$match', Q]) :-
+	doc_pairs(Q1, P1),
+	doc_pairs(Q2, P2),
+	(	P1 = [['$and', array(Queries)]]
+	->	append(Queries, [P2], Queries0),
+		Q = [['$and', array(Queries0)]]
+	;	\+ ( member([K1,_], P1), member([K2,_], P2), is_related_path(K1, K2) ),
+		\+ ( member([K,_], P1), atom_concat('$',_,K) ),
+		\+ ( member([K,_], P2), atom_concat('$',_,K) )
+	->	append(P1, P2, Q)
+	;	Q = [['$and', array([P1,P2])]]
+	).
+
+merge_stage([Op, D1], [Op, D2], [Op, D]) :-
+	memberchk(Op, ['$set', '$addFields']),
+	doc_pairs(D1, P1),
+	doc_pairs(D2, P2),
+	% all expressions in one $set are evaluated on the input document,
+	% so the second stage must not refer to fields written in the first.
+	\+ (	member([K1,_], P1),
+			member([K2,V2], P2),
+			(	is_related_path(K1, K2)
+			;	term_reads(V2, Reads),
+				member(Read, Reads),
+				is_related_path(K1, Read)
+			)
+	),
+	append(P1, P2, D).
+
+merge_stage(['$unset', U1], ['$unset', U2], ['$unset', array(Unset)]) :-
+	stage_unsets(['$unset', U1], F1),
+	stage_unsets(['$unset', U2], F2),
+	append(F1, F2, F),
+	list_to_set(F, F0),
+	findall(string(X), member(X, F0), Unset).
+
+merge_stage(['$project', D1], ['$project', D2], ['$project', D2]) :-
+	doc_pairs(D1, P1),
+	doc_pairs(D2, P2),
+	is_inclusion(P1),
+	is_inclusion(P2),
+	forall(member([K,_], P2), memberchk([K,_], P1)).
+
+merge_stage(['$limit', X], ['$limit', Y], ['$limit', Z]) :-
+	X =.. [Type,N1],
+	Y =.. [Type,N2],
+	number(N1), number(N2),
+	N is min(N1,N2),
+	Z =.. [Type,N].
+
+%%
+is_inclusion(Pairs) :-
+	forall(
+		member([_,V], Pairs),
+		memberchk(V, [int(1), integer(1), bool(true)])
+	).
+
+		 /*******************************
+		 *	    HOISTING $match     	*
+		 *******************************/
+
+%%
+% move $match stages before stages they do not depend on.
+%
+hoist_matches(Stages, Hoisted) :-
+	hoist_matches(Stages, [], Hoisted).
+
+hoist_matches([], Reversed, Hoisted) :-
+	!,
+	reverse(Reversed, Hoisted).
+hoist_matches([Stage|Rest], Reversed, Hoisted) :-
+	(	Stage = ['$match', _]
+	->	hoist_match(Stage, Reversed, Reversed0)
+	;	Reversed0 = [Stage|Reversed]
+	),
+	hoist_matches(Rest, Reversed0, Hoisted).
+
+%%
+hoist_match(Match, [Stage|Reversed], [Stage|Reversed0]) :-
+	can_swap(Stage, Match),
+	!,
+	hoist_match(Match, Reversed, Reversed0).
+hoist_match(Match, Reversed, [Match|Reversed]).
+
+%%
+can_swap([Op|Args], Match) :-
+	memberchk(Op, ['$set', '$addFields', '$unset', '$lookup', '$unwind']),
+	stage_writes([Op|Args], Writes),
+	Writes \== all,
+	stage_reads(Match, Reads),
+	\+ (	member(Write, Writes),
+			member(Read, Reads),
+			is_related_path(Write, Read)
+	).
+
+		 /*******************************
+		 *	    FIELD REFERENCES     	*
+		 *******************************/
+
+%%
+% fields written by a stage, or `all` if unknown.
+%
+stage_writes([Op, Doc], Fields) :-
+	memberchk(Op, ['$set', '$addFields']),
+	!,
+	doc_pairs(Doc, Pairs),
+	findall(Key, member([Key,_], Pairs), Fields).
+stage_writes(['$unset', Arg], Fields) :-
+	!,
+	stage_unsets(['$unset', Arg], Fields).
+stage_writes(['$lookup', Opts], [Field]) :-
+	memberchk(['as', string(Field)], Opts),
+	!.
+stage_writes(['$unwind', string(Path)], [Field]) :-
+	atom_concat('$', Field, Path),
+	!.
+stage_writes(['$match', _], []) :- !.
+stage_writes(_, all).
+
+%%
+stage_unsets(['$unset', string(Field)], [Field]) :- !.
+stage_unsets(['$unset', array(Fields)], Unset) :-
+	findall(F, member(string(F), Fields), Unset).
+
+%%
+% fields read by a stage. this is an over-approximation,
+% e.g. keys of options are also considered as fields.
+%
+stage_reads(Stage, Reads) :-
+	term_reads(Stage, Reads).
+
+term_reads(Term, Reads) :-
+	findall(Read, term_read(Term, Read), Reads0),
+	list_to_set(Reads0, Reads).
+
+term_read(Term, _) :-
+	var(Term), !, fail.
+term_read(string(X), Read) :-
+	!,
+	atom(X),
+	field_reference(X, Read).
+term_read([Key,Value], Read) :-
+	atom(Key),
+	!,
+	(	\+ atom_concat('$',_,Key),
+		Read=Key
+	;	term_read(Value, Read)
+	).
+term_read(List, Read) :-
+	is_list(List),
+	!,
+	member(X, List),
+	term_read(X, Read).
+term_read(array(List), Read) :-
+	!,
+	term_read(List, Read).
+term_read(Term, Read) :-
+	compound(Term),
+	Term =.. [_|Args],
+	member(Arg, Args),
+	term_read(Arg, Read).
+
+%%
+field_reference(Value, Read) :-
+	atom_concat('$$', Var, Value),
+	!,
+	% other variables are bound in lookup let documents,
+	% or in expressions such as $map.
+	(	atom_concat('ROOT', _, Var) -> Read='*'
+	;	atom_concat('CURRENT', _, Var) -> Read='*'
+	;	fail
+	).
+field_reference(Value, Read) :-
+	atom_concat('$', Read, Value).
+
+%%
+is_related_path(X, Y) :-
+	(	X == Y
+	;	X == '*'
+	;	Y == '*'
+	;	is_path_prefix(X, Y)
+	;	is_path_prefix(Y, X)
+	),
+	!.
+
+is_path_prefix(Prefix, Path) :-
+	atom_concat(Prefix, '.', Prefix0),
+	atom_concat(Prefix0, _, Path).
+
+%%
+doc_pairs([Key,Value], [[Key,Value]]) :-
+	atom(Key), !.
+doc_pairs(Pairs, Pairs) :-
+	is_list(Pairs).
+
+%% pipeline_unset_dead(+Steps, +LiveOut, -Pipeline) is det.
+%
+% Concatenate the stages of a sequence of steps, and add an $unset
+% stage after each step for the variables that are not referred to
+% anymore by any of the remaining steps.
+% Each step is represented as a term step(Reads, Stages, Defined)
+% where Reads are the variable keys referred to in the step,
+% Stages the stages of the step, and Defined the variable keys
+% that are defined in the document after the step was processed.
+%
+% @param Steps list of step/3 terms.
+% @param LiveOut variable keys that are needed after the last step.
+% @param Pipeline the concatenated list of stages.
+%
+pipeline_unset_dead(Steps, LiveOut, Pipeline) :-
+	unset_dead(Steps, LiveOut, [], Pipeline).
+
+unset_dead([], _, _, []) :- !.
+unset_dead([step(_,Stages,Defined)|Rest], LiveOut, Dropped0, Pipeline) :-
+	findall(Key,
+		(	member(step(Reads,_,_), Rest),
+			member(Key, Reads)
+		),
+		Later),
+	findall(Key,
+		(	member(Key, Defined),
+			\+ memberchk(Key, LiveOut),
+			\+ memberchk(Key, Later),
+			\+ memberchk(Key, Dropped0)
+		),
+		Dead0),
+	list_to_set(Dead0, Dead),
+	append(Dropped0, Dead, Dropped1),
+	unset_dead(Rest, LiveOut, Dropped1, Pipeline0),
+	(	Dead==[]
+	->	append(Stages, Pipeline0, Pipeline)
+	;	maplist([Key,string(Key)]>>true, Dead, DeadFields),
+		append(Stages, [['$unset', array(DeadFields)]|Pipeline0], Pipeline)
+	).
+
+		 /*******************************
+		 *    	  UNIT TESTING     		*
+		 *******************************/
+
+:- begin_tests('mongolog_optimize').
+
+test('fold constant $match') :-
+	pipeline_optimize([
+		['$match', ['$expr', ['$and', array([
+			bool(true),
+			['$eq', array([string(a), string(a)])]
+		])]]],
+		['$set', ['x', int(1)]]
+	], Optimized),
+	assert_equals(Optimized, [['$set', ['x', int(1)]]]).
+
+test('drop stages after failing $match') :-
+	pipeline_optimize([
+		['$match', ['$expr', ['$eq', array([string(a), string(b)])]]],
+		['$set', ['x', int(1)]]
+	], Optimized),
+	assert_equals(Optimized, [['$match', ['$expr', bool(false)]]]).
+
+test('fold numeric $eq by value') :-
+	pipeline_optimize([
+		['$match', ['$expr', ['$eq', array([double(1), double(1.0)])]]],
+		['$match', ['$expr', ['$eq', array([int(1), double(1.0)])]]],
+		['$set', ['x', int(1)]]
+	], Optimized),
+	assert_equals(Optimized, [['$set', ['x', int(1)]]]),
+	pipeline_optimize([
+		['$match', ['$expr', ['$ne', array([int(2), double(1.0)])]]],
+		['$set', ['x', int(1)]]
+	], Optimized0),
+	assert_equals(Optimized0, [['$set', ['x', int(1)]]]).
+
+test('drop dead $set') :-
+	pipeline_optimize([
+		['$set', ['x', int(1)]],
+		['$set', ['y', int(2)]],
+		['$unset', string(x)]
+	], Optimized),
+	assert_equals(Optimized, [
+		['$set', ['y', int(2)]],
+		['$unset', string(x)]
+	]).
+
+test('merge adjacent $set and $unset') :-
+	pipeline_optimize([
+		['$set', ['x', int(1)]],
+		['$set', ['y', string('$x')]],
+		['$set', ['z', int(3)]],
+		['$unset', string(a)],
+		['$unset', array([string(a), string(b)])]
+	], Optimized),
+	assert_equals(Optimized, [
+		['$set', ['x', int(1)]],
+		['$set', [['y', string('$x')], ['z', int(3)]]],
+		['$unset', array([string(a), string(b)])]
+	]).
+
+test('hoist $match') :-
+	pipeline_optimize([
+		['$set', ['x', int(1)]],
+		['$unwind', string('$next')],
+		['$match', ['y', string(a)]]
+	], Optimized),
+	assert_equals(Optimized, [
+		['$match', ['y', string(a)]],
+		['$set', ['x', int(1)]],
+		['$unwind', string('$next')]
+	]).
+
+test('do not hoist dependent $match') :-
+	Pipeline=[
+		['$unwind', string('$next')],
+		['$match', ['next.s', string(a)]]
+	],
+	pipeline_optimize(Pipeline, Optimized),
+	assert_equals(Optimized, Pipeline).
+
+test('unset dead variables') :-
+	pipeline_unset_dead([
+		step([], [['$set', ['vA', int(1)]]], [vA]),
+		step([vA], [['$set', ['vB', string('$vA')]]], [vA,vB]),
+		step([vB], [['$set', ['vC', string('$vB')]]], [vA,vB,vC])
+	], [vC], Pipeline),
+	assert_equals(Pipeline, [
+		['$set', ['vA', int(1)]],
+		['$set', ['vB', string('$vA')]],
+		['$unset', array([string(vA)])],
+		['$set', ['vC', string('$vB')]],
+		['$unset', array([string(vB)])]
+	]).
+
+:- end_tests('mongolog_optimize').
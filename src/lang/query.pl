@@ -2,6 +2,10 @@
     [ kb_call(t),             % +Goal
       kb_call(t,t,t),         % +Goal, +QScope, -FScope
       kb_call(t,t,t,t),       % +Goal, +QScope, -FScope, +Options
+      kb_cursor_open(t,+,-),  % +Goal, +Options, -Cursor
+      kb_cursor_next_batch(+,+,-), % +Cursor, +Count, -Rows
+      kb_cursor_close(+),     % +Cursor
+      kb_aggregate_all(+,t,-,+), % +Spec, +Goal, -Result, +Options
       kb_project(t),          % +Goal
       kb_project(t,t),        % +Goal, +Scope
       kb_project(t,t,t),      % +Goal, +Scope, +Options
@@ -40,9 +44,16 @@ one step into the input queue of the next step.
 :- use_module('scope',
     [ current_scope/1, universal_scope/1 ]).
 :- use_module('mongolog/mongolog').
+:- use_module('episodes').
+:- use_module(library('db/mongo/client'),
+	[ mng_with_collection_prefix/2 ]).
 
 % Stores list of terminal terms for each clause. 
 :- dynamic kb_rule/3.
+% Caches the expansion of rule heads, keyed by the variant hash of the head.
+:- dynamic kb_expansion/3.
+% Stores the output queue of cursors that are open.
+:- dynamic kb_cursor/1.
 :- dynamic kb_predicate/1.
 % optionally implemented by query commands.
 :- multifile step_expand/2.
@@ -52,6 +63,9 @@ one step into the input queue of the next step.
 :- dynamic is_callable_with/2.
 :- dynamic call_with/3.
 
+:- setting(expansion_cache_size, nonneg, 4096,
+		'Maximum number of rule expansions that are cached.').
+
 % create a thread pool for query processing
 :- worker_pool_create('lang_query:queries').
 :- current_prolog_flag(cpu_count, NumCPUs),
@@ -92,6 +106,16 @@ kb_call(Statement, QScope, FScope) :-
 %     Determines the maximum number of messages queued in each stage.  Default is 50.
 %     - graph(GraphName)
 %     Determines the named graph this query is restricted to. Note that graphs are organized hierarchically. Default is user.
+%     - episode(Name)
+%     Run the query on the collections of an episode. The episode is mounted if needed.
+%     - read_preference(Mode)
+%     Route reads to members of a replica set, e.g. secondaryPreferred. Default is the read_preference setting of the mongo client.
+%     - episodes(Names)
+%     Run the query on each of the episodes in parallel. Name in the episode(Name) option
+%     is unified with the episode of each solution.
+%     - snapshot(Snapshot)
+%     Run the query on a snapshot created with kb_snapshot_create/2. QScope is replaced
+%     by the timepoint of the snapshot, and the scope of triples is not matched.
 %
 % Any remaining options are passed to the querying backends that are invoked.
 %
@@ -106,6 +130,12 @@ kb_call(Statements, QScope, FScope, Options) :-
 	comma_list(Goal, Statements),
 	kb_call(Goal, QScope, FScope, Options).
 
+kb_call(Statement, QScope, FScope, Options) :-
+	select_option(episodes(Episodes), Options, Options0),
+	!,
+	select_option(episode(Episode), Options0, Options1, _),
+	kb_call_federated(Statement, QScope, FScope, Episodes, Episode, Options1).
+
 kb_call(Statement, QScope, FScope, Options) :-
 	% grounded statements have no variables
 	% in this case we can limit to one solution here
@@ -118,8 +148,13 @@ kb_call(Statement, QScope, FScope, Options) :-
 	kb_call1(Statement, QScope, FScope, Options).
 
 %%
-kb_call1(Goal, QScope, FScope, Options) :-
+kb_call1(Goal, QScope0, FScope, Options) :-
 	option(fields(Fields), Options, []),
+	% queries on a snapshot are evaluated at the time of the snapshot
+	(	option(snapshot(Snapshot), Options)
+	->	lang_snapshot:snapshot_scope(Snapshot, QScope)
+	;	QScope=QScope0
+	),
 	% add all toplevel variables to context
 	term_keys_variables_(Goal, GlobalVars),
 	%
@@ -133,7 +168,11 @@ kb_call1(Goal, QScope, FScope, Options) :-
 	kb_expand(Goal, Expanded),
 	% FIXME: not so nice that flattening is needed here
 	flatten(Expanded, Flattened),
-	kb_call1(Flattened, Options1).
+	(	option(episode(Episode), Options1)
+	% make sure the episode is not unmounted while the query is running
+	->	lang_episodes:episode_use(Episode, kb_call1(Flattened, Options1))
+	;	kb_call1(Flattened, Options1)
+	).
 
 %%
 kb_call1(SubGoals, Options) :-
@@ -147,18 +186,48 @@ kb_call1(SubGoals, Options) :-
 	combine_steps(Steps, Combined),
 	% need to remember pattern of variables for later unification
 	% TODO: improve the way how instantiations are communicated between steps.
-	%       currently the same pattern of _all_ variables in the expanded goal
-	%       is used in each step. But this is not needed e.g. the input for the
+	%       currently the same pattern of variables is used in each step.
+	%       But this is not needed e.g. the input for the
 	%       first step could be empty list instead.
-	%       An easy optimization would be that each step has a pattern with
-	%       variables so far to reduce overall number of elements in comm pattern.
-	term_variables(SubGoals, Pattern),
+	step_pattern(SubGoals, Combined, Options, Pattern),
+	% backends only need to instantiate variables in the pattern
+	merge_options([output_vars(Pattern)], Options, Options1),
 	setup_call_cleanup(
-		start_pipeline(Combined, Pattern, Options, FinalStep),
-		materialize_pipeline(FinalStep, Pattern, Options),
+		start_pipeline(Combined, Pattern, Options1, FinalStep),
+		materialize_pipeline(FinalStep, Pattern, Options1),
 		stop_pipeline(Combined)
 	).
 
+%%
+% The pattern of variables communicated between steps.
+% These are the toplevel variables of the query, and variables
+% shared between different steps.
+% Variables that only appear in one step, e.g. the ones introduced
+% by rule expansion, are not part of the pattern.
+%
+step_pattern(SubGoals, _Steps, Options, Pattern) :-
+	\+ option(global_vars(_), Options),
+	!,
+	term_variables(SubGoals, Pattern).
+
+step_pattern(_SubGoals, Steps, Options, Pattern) :-
+	option(global_vars(GlobalVars), Options),
+	maplist([step(Goal,_,_),Vars]>>term_variables(Goal,Vars), Steps, VarLists),
+	% variables that appear in more than one step
+	append(VarLists, AllVars),
+	msort(AllVars, Sorted),
+	shared_vars(Sorted, SharedVars),
+	term_variables([GlobalVars,SharedVars], Pattern).
+
+%
+shared_vars([X,Y|Rest], [X|Shared]) :-
+	X==Y, !,
+	shared_vars([Y|Rest], Shared).
+shared_vars([_|Rest], Shared) :-
+	!,
+	shared_vars(Rest, Shared).
+shared_vars([], []).
+
 %
 term_keys_variables_(Goal, GoalVars) :-
 	term_variables(Goal, Vars),
@@ -192,6 +261,244 @@ ask(Statement) :-
 ask(Statement,QScope) :-
 	kb_call(Statement, QScope, _, []).
 
+		 /*******************************
+		 *	    	CURSORS		  	 	*
+		 *******************************/
+
+%% kb_cursor_open(+Statement, +Options, -Cursor) is det.
+%
+% Create a cursor over the instantiations of Statement.
+% The query is processed in a worker thread that stays alive
+% until the cursor is closed, and that writes instantiations
+% into a bounded message queue.
+% kb_cursor_close/1 must be called once the cursor is not needed anymore.
+% Options include:
+%
+%     - scope(QScope)
+%     The requested scope. Default is the current scope.
+%     - max_queue_size(MaxSize)
+%     Determines the maximum number of results buffered by the cursor.  Default is 50.
+%
+% Any remaining options are passed to kb_call/4.
+%
+% @param Statement a statement term.
+% @param Options list of options.
+% @param Cursor the cursor id.
+%
+kb_cursor_open(Statement, Options, Cursor) :-
+	(	option(scope(QScope), Options) -> true
+	;	current_scope(QScope)
+	),
+	option(max_queue_size(MaxSize), Options, 50),
+	message_queue_create(Cursor, [max_size(MaxSize)]),
+	assertz(kb_cursor(Cursor)),
+	query_thread_pool(Pool),
+	worker_pool_start_work(Pool, Cursor,
+		lang_query:cursor_produce(Statement, QScope, Options, Cursor)).
+
+%% kb_cursor_next_batch(+Cursor, +Count, -Rows) is det.
+%
+% Retrieve the next Count instantiations of the statement
+% for which the cursor was opened.
+% This blocks until Count results are available, or until
+% all results were retrieved in which case Rows may have
+% less than Count elements.
+% Rows is the empty list if the cursor is exhausted.
+%
+% @param Cursor the cursor id.
+% @param Count maximum number of rows.
+% @param Rows list of statement instantiations.
+%
+kb_cursor_next_batch(Cursor, Count, Rows) :-
+	(	kb_cursor(Cursor) -> true
+	;	throw(error(existence_error(kb_cursor, Cursor), _))
+	),
+	cursor_next_batch(Cursor, Count, Rows).
+
+%% kb_cursor_close(+Cursor) is det.
+%
+% Close a cursor. This stops the query in case it has
+% not been completed yet, and releases any resources associated
+% with the cursor.
+%
+% @param Cursor the cursor id.
+%
+kb_cursor_close(Cursor) :-
+	retract(kb_cursor(Cursor)),
+	!,
+	query_thread_pool(Pool),
+	worker_pool_stop_work(Pool, Cursor),
+	% destroying the queue will cause an error in the producer
+	% which is blocked while the queue is full.
+	catch(message_queue_destroy(Cursor),
+		error(existence_error(message_queue,Cursor),_),
+		true).
+
+kb_cursor_close(_).
+
+%
+cursor_produce(Statement, QScope, Options, Queue) :-
+	catch(
+		(	forall(
+				kb_call(Statement, QScope, _, Options),
+				thread_send_message(Queue, row(Statement))
+			),
+			thread_send_message(Queue, end_of_stream)
+		),
+		Error,
+		(	Error=error(existence_error(message_queue,Queue),_) -> true
+		;	thread_send_message(Queue, error(Error))
+		)
+	).
+
+%
+cursor_next_batch(_, Count, []) :-
+	Count =< 0, !.
+cursor_next_batch(Queue, Count, Rows) :-
+	thread_get_message(Queue, Msg),
+	cursor_next_batch(Msg, Queue, Count, Rows).
+
+cursor_next_batch(end_of_stream, Queue, _, []) :-
+	!,
+	% keep the end of stream marker for subsequent calls
+	thread_send_message(Queue, end_of_stream).
+cursor_next_batch(error(Error), _, _, _) :-
+	!,
+	throw(Error).
+cursor_next_batch(row(Row), Queue, Count, [Row|Rows]) :-
+	Count0 is Count - 1,
+	cursor_next_batch(Queue, Count0, Rows).
+
+		 /*******************************
+		 *	    	FEDERATION	  	 	*
+		 *******************************/
+
+%
+kb_call_federated(Statement, QScope, FScope, Episodes, Episode, Options) :-
+	length(Episodes, NumEpisodes),
+	option(max_queue_size(MaxSize), Options, 50),
+	query_thread_pool(Pool),
+	setup_call_cleanup(
+		message_queue_create(Queue, [max_size(MaxSize)]),
+		(	forall(
+				member(X, Episodes),
+				worker_pool_start_work(Pool, Queue,
+					lang_query:federated_produce(
+						Statement, QScope, X, Options, Queue))
+			),
+			federated_materialize(Queue, NumEpisodes, [Statement,FScope,Episode])
+		),
+		(	worker_pool_stop_work(Pool, Queue),
+			catch(message_queue_destroy(Queue),
+				error(existence_error(message_queue,Queue),_),
+				true)
+		)
+	).
+
+% run the query on one episode and send each solution tagged
+% with the episode name, followed by an end_of_stream message.
+federated_produce(Statement, QScope, Episode, Options, Queue) :-
+	merge_options([episode(Episode)], Options, Options0),
+	catch(
+		(	forall(
+				kb_call(Statement, QScope, FScope, Options0),
+				thread_send_message(Queue, row([Statement,FScope,Episode]))
+			),
+			thread_send_message(Queue, end_of_stream)
+		),
+		Error,
+		(	Error=error(existence_error(message_queue,Queue),_) -> true
+		;	thread_send_message(Queue, error(Error))
+		)
+	).
+
+% yield rows until each episode has sent end_of_stream
+federated_materialize(_, 0, _) :- !, fail.
+federated_materialize(Queue, Count, Row) :-
+	thread_get_message(Queue, Msg),
+	federated_materialize(Msg, Queue, Count, Row).
+
+federated_materialize(end_of_stream, Queue, Count, Row) :-
+	!,
+	Count0 is Count - 1,
+	federated_materialize(Queue, Count0, Row).
+federated_materialize(error(Error), _, _, _) :-
+	!,
+	throw(Error).
+federated_materialize(row(Row0), Queue, Count, Row) :-
+	(	Row=Row0
+	;	federated_materialize(Queue, Count, Row)
+	).
+
+%% kb_aggregate_all(+Spec, +Goal, -Result, +Options) is semidet.
+%
+% Aggregate solutions of Goal similar to aggregate_all/3.
+% Spec is one of count, sum(Expr), min(Expr), max(Expr) or avg(Expr).
+% The aggregate is computed by the database for each episode in the
+% episodes(Names) option, and the partial aggregates are merged.
+% Without this option, the aggregate is computed on the current database.
+% Each partial aggregate is computed by a $group stage, and only
+% the scalar result is returned to the client.
+% Goal must be callable in mongolog.
+% Episodes without solutions do not contribute to min, max and avg,
+% which fail if Goal has no solution in any episode.
+% Options include:
+%
+%     - scope(QScope)
+%     The requested scope. Default is the current scope.
+%
+% Any remaining options are passed to kb_call/4.
+%
+% @param Spec the aggregation specification.
+% @param Goal a goal term.
+% @param Result the aggregated value.
+% @param Options list of options.
+%
+kb_aggregate_all(Spec, Goal, Result, Options) :-
+	(	option(scope(QScope), Options) -> true
+	;	current_scope(QScope)
+	),
+	(	partial_aggregate(Spec, Goal, PartialGoal, Partial)
+	->	true
+	;	throw(error(domain_error(aggregate_spec, Spec), _))
+	),
+	findall(Partial,
+		kb_call(PartialGoal, QScope, _, Options),
+		Partials),
+	merge_partials(Spec, Partials, Result).
+
+%
+partial_aggregate(count, Goal,
+		aggregate_all(count, Goal, N),
+		count(N)).
+partial_aggregate(sum(X), Goal,
+		aggregate_all(sum(X), Goal, Sum),
+		sum(Sum)).
+partial_aggregate(min(X), Goal,
+		aggregate_all(min(X), Goal, Min),
+		min(Min)).
+partial_aggregate(max(X), Goal,
+		aggregate_all(max(X), Goal, Max),
+		max(Max)).
+partial_aggregate(avg(X), Goal,
+		aggregate_all(r(sum(X),count), Goal, r(Sum,N)),
+		avg(Sum,N)).
+
+%
+merge_partials(count, Partials, Count) :-
+	aggregate_all(sum(N), member(count(N), Partials), Count).
+merge_partials(sum(_), Partials, Sum) :-
+	aggregate_all(sum(X), member(sum(X), Partials), Sum).
+merge_partials(min(_), Partials, Min) :-
+	aggregate_all(min(X), member(min(X), Partials), Min).
+merge_partials(max(_), Partials, Max) :-
+	aggregate_all(max(X), member(max(X), Partials), Max).
+merge_partials(avg(_), Partials, Avg) :-
+	aggregate_all(sum(X), member(avg(X,_), Partials), Sum),
+	aggregate_all(sum(N), member(avg(_,N), Partials), Count),
+	Count > 0,
+	Avg is Sum / Count.
+
 %% kb_project(+Statement) is nondet.
 %
 % Same as kb_project/2 with universal scope.
@@ -301,7 +608,11 @@ kb_unproject(triple(S,P,O), Scope, Options) :-
 	% get the query document
 	mng_triple_doc(triple(S,P,O), Doc, Options1),
 	% run a remove query
-	mng_get_db(DB, Coll, 'triples'),
+	option(graph(Graph), Options0),
+	(	lang_db:volatile_graph(Graph)
+	->	mng_get_db(DB, Coll, 'volatile_triples')
+	;	mng_get_db(DB, Coll, 'triples')
+	),
 	mng_remove(DB, Coll, Doc).
 
 
@@ -356,6 +667,9 @@ start_pipeline_step(
 materialize_pipeline(
 		step(Goal,_,[[Backend,InQueue]]),
 		Pattern, Options) :-
+	% episode collections are only used in worker threads
+	\+ option(episode(_), Options),
+	\+ option(snapshot(_), Options),
 	!,
 	% call the last step in this thread in case it has a single backend
 	message_queue_materialize(InQueue, Pattern),
@@ -535,8 +849,8 @@ call_with(Backend, Goal, Pattern, OutQueue, InQueue, Options) :-
 call_with(Backend, Goal, Pattern, OutQueue, Options) :-
 	% pass any error to output queue consumer
 	catch(
-		(	call_with(Backend, Goal, Options),      % call goal in backend
-			thread_send_message(OutQueue, Pattern)  % publish result via OutQueue
+		(	call_with_episode(Backend, Goal, Options), % call goal in backend
+			thread_send_message(OutQueue, Pattern)     % publish result via OutQueue
 		),
 		Error,
 		(	Error=error(existence_error(message_queue,OutQueue),_) -> true
@@ -544,6 +858,21 @@ call_with(Backend, Goal, Pattern, OutQueue, Options) :-
 		)
 	).
 
+%
+call_with_episode(Backend, Goal, Options) :-
+	option(episode(Episode), Options),
+	!,
+	mng_with_collection_prefix(Episode,
+		call_with(Backend, Goal, Options)).
+
+call_with_episode(Backend, Goal, Options) :-
+	option(snapshot(Snapshot), Options),
+	!,
+	mng_with_collection_prefix(Snapshot,
+		call_with(Backend, Goal, Options)).
+
+call_with_episode(Backend, Goal, Options) :-
+	call_with(Backend, Goal, Options).
 
 %% call_with(+Backend, :Goal, +Options) is nondet.
 %
@@ -586,7 +915,9 @@ kb_add_rule(Head, Body) :-
 	(	kb_expand(Body, Expanded) -> true
 	;	log_error_and_fail(lang(assertion_failed(Body), Functor))
 	),
-	assertz(kb_rule(Functor, Args, Expanded)).
+	assertz(kb_rule(Functor, Args, Expanded)),
+	% expansions of existing rules may refer to the new clause
+	expansion_cache_clear.
 
 
 %% kb_drop_rule(+Head) is semidet.
@@ -600,7 +931,8 @@ kb_add_rule(Head, Body) :-
 kb_drop_rule(Head) :-
 	compound(Head),
 	Head =.. [Functor|_],
-	retractall(kb_rule(Functor, _, _)).
+	retractall(kb_rule(Functor, _, _)),
+	expansion_cache_clear.
 
 		 /*******************************
 		 *	    TERM EXPANSION     		*
@@ -677,6 +1009,50 @@ expand_term_1(Goal, Expanded) :-
 	).
 
 expand_term_1(Goal, Expanded) :-
+	% rule expansion only depends on the rule head modulo variable
+	% renaming. Expansions are thus cached with the variant hash of
+	% the head as key.
+	% Ground heads are not cached as each distinct ground goal would
+	% add another entry.
+	\+ ground(Goal),
+	catch(variant_sha1(Goal, Key), _, fail),
+	!,
+	(	kb_expansion(Key, Goal, Expanded) -> true
+	;	expand_term_2(Goal, Expanded),
+		% do not cache in case the goal was instantiated during expansion
+		(	variant_sha1(Goal, Key)
+		->	expansion_cache_add(Key, Goal, Expanded)
+		;	true
+		)
+	).
+
+expand_term_1(Goal, Expanded) :-
+	expand_term_2(Goal, Expanded).
+
+%%
+% the cache holds at most expansion_cache_size entries,
+% the oldest entry is evicted first.
+%
+expansion_cache_add(Key, Goal, Expanded) :-
+	setting(expansion_cache_size, MaxSize),
+	MaxSize > 0,
+	!,
+	assertz(kb_expansion(Key, Goal, Expanded)),
+	flag(kb_expansion_count, Count, Count+1),
+	(	Count < MaxSize -> true
+	;	retract(kb_expansion(_,_,_)),
+		flag(kb_expansion_count, Count0, Count0-1)
+	->	true
+	;	true
+	).
+expansion_cache_add(_, _, _).
+
+%%
+expansion_cache_clear :-
+	retractall(kb_expansion(_,_,_)),
+	flag(kb_expansion_count, _, 0).
+
+expand_term_2(Goal, Expanded) :-
 	% expand the rule head (Goal) into terminal symbols (the rule body)
 	(	expand_rule(Goal, Clauses) -> true
 	% handle the case that a predicate is referred to that wasn't asserted before
@@ -870,12 +1246,14 @@ test_setup :-
 	assertz(is_callable_with(test_a, test_gen_inf(_))),
 	assertz(is_callable_with(test_b, test_single(_,_))),
 	assertz(is_callable_with(test_a, test_dual(_,_))),
+	assertz(is_callable_with(test_a, test_collection(_))),
 	assertz(is_callable_with(test_b, test_dual(_,_))),
 	assertz(call_with(test_a, test_gen(X), _)       :- between(1,9,X)),
 	assertz(call_with(test_a, test_gen_inf(X), _)   :- between(1,inf,X)),
 	assertz(call_with(test_b, test_single(X,Y), _)  :- Y is X*X),
 	assertz(call_with(test_a, test_dual(X,Y), _)    :- Y is X*X),
-	assertz(call_with(test_b, test_dual(X,Y), _)    :- Y is X+X).
+	assertz(call_with(test_b, test_dual(X,Y), _)    :- Y is X+X),
+	assertz(call_with(test_a, test_collection(X), _) :- mng_get_db(_,X,triples)).
 
 test_cleanup :-
 	retractall(is_callable_with(test_a,_)),
@@ -883,6 +1261,15 @@ test_cleanup :-
 	retractall(':-'(call_with(test_a, _, _), _)),
 	retractall(':-'(call_with(test_b, _, _), _)).
 
+test_drop_episode(Episode) :-
+	mng_with_collection_prefix(Episode,
+		forall(
+			lang_db:collection_name(Name),
+			(	mng_get_db(DB,Coll,Name),
+				mng_drop(DB,Coll)
+			)
+		)).
+
 :- begin_tests('lang_query',
 		[ setup(lang_query:test_setup),
 		  cleanup(lang_query:test_cleanup) ]).
@@ -915,6 +1302,88 @@ test('limit(+,test_gen_inf(-))') :-
 	findall(X, limit(4,kb_call(test_gen_inf(X))), Xs),
 	assert_true(length(Xs,4)).
 
+test('kb_cursor_next_batch(test_gen(-))') :-
+	kb_cursor_open(test_gen(_), [], Cursor),
+	kb_cursor_next_batch(Cursor, 4, Rows0),
+	kb_cursor_next_batch(Cursor, 10, Rows1),
+	kb_cursor_next_batch(Cursor, 10, Rows2),
+	kb_cursor_close(Cursor),
+	assert_equals(Rows0, [test_gen(1),test_gen(2),test_gen(3),test_gen(4)]),
+	assert_true(length(Rows1,5)),
+	assert_equals(Rows2, []).
+
+test('kb_cursor_close(test_gen_inf(-))') :-
+	kb_cursor_open(test_gen_inf(_), [max_queue_size(4)], Cursor),
+	kb_cursor_next_batch(Cursor, 2, Rows),
+	kb_cursor_close(Cursor),
+	assert_equals(Rows, [test_gen_inf(1),test_gen_inf(2)]),
+	catch(
+		(	kb_cursor_next_batch(Cursor, 2, _),
+			fail
+		),
+		error(existence_error(kb_cursor,_),_),
+		true
+	).
+
+test('kb_expand(+Rule)') :-
+	kb_add_rule(test_rule(X), test_gen(X)),
+	kb_expand(test_rule(A), Expanded0),
+	kb_expand(test_rule(B), Expanded1),
+	% cached expansion is renamed to the variables of the goal
+	assert_true(Expanded0 =@= Expanded1),
+	assert_true((term_variables(Expanded1,Vs), member(V,Vs), V==B)),
+	% adding a clause invalidates the cached expansion
+	kb_add_rule(test_rule(Y), test_single(1,Y)),
+	kb_expand(test_rule(A), Expanded2),
+	assert_false(Expanded0 =@= Expanded2),
+	kb_drop_rule(test_rule(_)),
+	assert_false(kb_expansion(_,_,_)).
+
+test('kb_aggregate_all(+Spec,+Goal,-Result)') :-
+	Goal=((X is 2) ; (X is 4)),
+	kb_aggregate_all(count, Goal, Count, []),
+	assert_equals(Count, 2),
+	kb_aggregate_all(max(X), Goal, Max, []),
+	assert_true(Max =:= 4),
+	kb_aggregate_all(avg(X), Goal, Avg, []),
+	assert_true(Avg =:= 3),
+	assert_false(kb_aggregate_all(min(X), (X is 2, X > 3), _, [])),
+	kb_aggregate_all(sum(X), (X is 2, X > 3), Sum, []),
+	assert_true(Sum =:= 0).
+
+test('kb_aggregate_all merges partial aggregates') :-
+	% episodes without solutions contribute no partial min and max
+	merge_partials(min(_), [min(3), min(2)], Min),
+	assert_equals(Min, 2),
+	merge_partials(count, [count(0), count(3)], Count),
+	assert_equals(Count, 3),
+	assert_false(merge_partials(max(_), [], _)),
+	assert_false(merge_partials(avg(_), [avg(0,0)], _)).
+
+test('kb_expand(+GroundRule)') :-
+	kb_add_rule(test_rule(X), test_gen(X)),
+	kb_expand(test_rule(1), _),
+	kb_expand(test_rule(2), _),
+	% ground heads are not cached
+	assert_false(kb_expansion(_,test_rule(_),_)),
+	kb_drop_rule(test_rule(_)).
+
+test('kb_expand(+Rule) evicts old expansions') :-
+	setting(expansion_cache_size, Size),
+	setup_call_cleanup(
+		set_setting(expansion_cache_size, 2),
+		(	kb_add_rule(test_rule(X,_), test_gen(X)),
+			kb_expand(test_rule(_,a), _),
+			kb_expand(test_rule(_,b), _),
+			kb_expand(test_rule(_,c), _),
+			findall(Y, kb_expansion(_,test_rule(_,Y),_), Ys),
+			assert_equals(Ys, [b,c])
+		),
+		(	set_setting(expansion_cache_size, Size),
+			kb_drop_rule(test_rule(_,_))
+		)
+	).
+
 test('limit(+,(test_gen_inf(-),test_single(+,-)))') :-
 	findall(Y, limit(4,kb_call((
 		test_gen_inf(X),
@@ -923,5 +1392,30 @@ test('limit(+,(test_gen_inf(-),test_single(+,-)))') :-
 	% TODO: also test that threads have exited
 	assert_true(length(Ys,4)).
 
+test('kb_call(test_collection(-),episode(+))') :-
+	once(kb_call(test_collection(X), _, _, [episode(test_episode)])),
+	assert_equals(X, test_episode_triples),
+	assert_true(episode_mounted(test_episode)),
+	episode_unmount(test_episode),
+	assert_false(episode_mounted(test_episode)),
+	test_drop_episode(test_episode).
+
+test('kb_call(test_collection(-),episodes(+))') :-
+	findall(E-X,
+		kb_call(test_collection(X), _, _,
+			[episodes([test_episode_a,test_episode_b]), episode(E)]),
+		Pairs),
+	msort(Pairs, Sorted),
+	assert_equals(Sorted, [
+		test_episode_a-test_episode_a_triples,
+		test_episode_b-test_episode_b_triples
+	]),
+	forall(
+		member(E-_, Pairs),
+		(	episode_unmount(E),
+			test_drop_episode(E)
+		)
+	).
+
 :- end_tests('lang_query').
 
@@ -0,0 +1,294 @@
+:- module(lang_snapshot,
+    [ kb_snapshot_create/2,
+      kb_snapshot_destroy/1,
+      kb_snapshot_time/2
+    ]).
+/** <module> Point-in-time snapshots of the knowledge base.
+
+A snapshot materializes all facts that are valid at some timepoint
+into a separate set of collections that are distinguished by
+a collection prefix, similar to episodes.
+Triples are copied if their time scope includes the timepoint,
+and only the latest transform of each frame before the timepoint
+is copied from the tf collection.
+The same is done for the collections of fluents, other registered
+collections (see setup_collection/2) are copied as a whole.
+Search indices are created for the snapshot collections.
+
+Snapshots are recorded in the "snapshots" collection such that
+they can be used and destroyed after a restart.
+Snapshot collections are not dropped automatically,
+kb_snapshot_destroy/1 must be called for each snapshot
+that is not needed anymore.
+
+Queries may be run on a snapshot with the `snapshot(Snapshot)` option
+of kb_call/4. Triple lookups in a snapshot do not match the
+time scope of documents, and fluents are evaluated at the timepoint
+of the snapshot.
+This is useful in case many queries are evaluated at the same timepoint.
+
+@author Daniel Beßler
+@license BSD
+*/
+
+:- use_module(library('db/mongo/client'),
+	[ mng_get_db/3,
+	  mng_with_collection_prefix/2,
+	  mng_find/4,
+	  mng_store/3,
+	  mng_remove/3,
+	  mng_drop/2,
+	  mng_index_create/3,
+	  mng_cursor_create/3,
+	  mng_cursor_destroy/1,
+	  mng_cursor_next/2
+	]).
+:- use_module('scope',
+	[ time_scope/3 ]).
+
+% snapshot_(Snapshot, Time): snapshots that were read from the DB before
+:- dynamic snapshot_/2.
+
+%% kb_snapshot_create(+Time, -Snapshot) is det.
+%
+% Materialize all facts valid at Time into a snapshot.
+% The snapshot is created from the collections of the calling thread,
+% i.e. the collection prefix of the thread is used.
+%
+% @param Time the timepoint of the snapshot.
+% @param Snapshot the snapshot name.
+%
+kb_snapshot_create(Time, Snapshot) :-
+	Stamp is float(Time),
+	lang_db:get_unique_name(snapshot, Snapshot),
+	mng_get_db(DB, TriplesColl, 'triples'),
+	mng_get_db(DB, VolatileColl, 'volatile_triples'),
+	mng_get_db(DB, TFColl, 'tf'),
+	mng_get_db(DB, AnnotationsColl, 'annotations'),
+	mng_with_collection_prefix(Snapshot,
+		(	mng_get_db(DB, SnapshotTriples, 'triples'),
+			mng_get_db(DB, SnapshotTF, 'tf'),
+			mng_get_db(DB, SnapshotAnnotations, 'annotations')
+		)),
+	% triples that are valid at Time
+	snapshot_triples_pipeline(Stamp, SnapshotTriples, TriplesPipeline),
+	snapshot_aggregate(DB, TriplesColl, TriplesPipeline),
+	(	setting(lang_db:volatile_graphs, [_|_])
+	->	snapshot_aggregate(DB, VolatileColl, TriplesPipeline)
+	;	true
+	),
+	% the latest transform of each frame
+	snapshot_tf_pipeline(Stamp, SnapshotTF, TFPipeline),
+	snapshot_aggregate(DB, TFColl, TFPipeline),
+	% annotations do not have a time scope
+	snapshot_aggregate(DB, AnnotationsColl, [
+		['$merge', [
+			['into', string(SnapshotAnnotations)],
+			['whenMatched', string(keepExisting)]
+		]]
+	]),
+	% fluents and other registered collections
+	forall(
+		snapshot_collection(Stamp, Name, Pipeline0),
+		(	mng_get_db(DB, Coll, Name),
+			mng_with_collection_prefix(Snapshot,
+				mng_get_db(DB, SnapshotColl, Name)),
+			append(Pipeline0, [
+				['$merge', [
+					['into', string(SnapshotColl)],
+					['whenMatched', string(keepExisting)]
+				]]
+			], Pipeline),
+			snapshot_aggregate(DB, Coll, Pipeline)
+		)
+	),
+	mng_with_collection_prefix(Snapshot,
+		(	lang_db:create_indices,
+			tf_indices
+		)),
+	% remember the snapshot and its collections
+	findall(string(Name), snapshot_collection_name(Name), CollNames),
+	mng_get_db(DB, SnapshotsColl, 'snapshots'),
+	mng_store(DB, SnapshotsColl, [
+		['name',        string(Snapshot)],
+		['time',        double(Stamp)],
+		['collections', array(CollNames)]
+	]),
+	assertz(snapshot_(Snapshot, Stamp)),
+	log_info(db(snapshot_created(Snapshot, Stamp))).
+
+%%
+% Registered collections that are copied into a snapshot
+% in addition to triples, tf and annotations.
+% Fluents are copied with their latest value for each key
+% before the time of the snapshot, and other collections
+% are copied as a whole.
+% Fluents stored in a collection given by an option are
+% not copied, they are read from the same collection
+% at the time of the snapshot.
+%
+snapshot_collection(Stamp, Name, Pipeline) :-
+	mongolog_fluents:mongolog_fluent(Name, ArgFields, TimeField, Options),
+	\+ option(collection(_), Options),
+	snapshot_fluent_pipeline(Stamp, ArgFields, TimeField, Pipeline).
+
+snapshot_collection(_, Name, []) :-
+	findall(X, lang_db:collection_data_(X, _), Names0),
+	list_to_set(Names0, Names),
+	member(Name, Names),
+	\+ memberchk(Name, [triples, volatile_triples, annotations, tf]),
+	\+ mongolog_fluents:mongolog_fluent(Name, _, _, _).
+
+%%
+% The latest document of each combination of fluent keys.
+%
+snapshot_fluent_pipeline(Stamp, ArgFields, TimeField, [
+		['$match', [[TimeField, ['$lte', time(Stamp)]]]],
+		['$sort', SortKeys],
+		['$group', [
+			['_id', GroupKey],
+			['doc', ['$first', string('$$ROOT')]]
+		]],
+		['$replaceRoot', ['newRoot', string('$doc')]]
+	]) :-
+	findall(Key, member(+(Key), ArgFields), Keys),
+	findall([Key, int(1)], member(Key, Keys), KeySortKeys),
+	append(KeySortKeys, [[TimeField, int(-1)]], SortKeys),
+	(	Keys == []
+	->	GroupKey=int(0)
+	;	findall([GroupField, string(KeyPath)],
+			(	nth0(I, Keys, Key),
+				atom_concat(k, I, GroupField),
+				atom_concat('$', Key, KeyPath)
+			),
+			GroupKey)
+	).
+
+%%
+% The names of all collections of a snapshot.
+%
+snapshot_collection_name(Name) :-
+	findall(X,
+		(	member(X, [triples, tf, annotations])
+		;	lang_db:collection_data_(X, _)
+		;	snapshot_collection(0, X, _)
+		),
+		Names),
+	list_to_set(Names, Set),
+	member(Name, Set).
+
+%%
+snapshot_triples_pipeline(Stamp, Into, [
+		['$match', [
+			['scope.time.since', ['$lte', double(Stamp)]],
+			['scope.time.until', ['$gte', double(Stamp)]]
+		]],
+		['$merge', [
+			['into', string(Into)],
+			['whenMatched', string(keepExisting)]
+		]]
+	]).
+
+%%
+snapshot_tf_pipeline(Stamp, Into, [
+		['$match', ['header.stamp', ['$lte', time(Stamp)]]],
+		['$sort', [
+			['child_frame_id', int(1)],
+			['header.stamp', int(-1)]
+		]],
+		['$group', [
+			['_id', string('$child_frame_id')],
+			['doc', ['$first', string('$$ROOT')]]
+		]],
+		['$replaceRoot', ['newRoot', string('$doc')]],
+		['$merge', [
+			['into', string(Into)],
+			['whenMatched', string(keepExisting)]
+		]]
+	]).
+
+%%
+snapshot_aggregate(DB, Coll, Pipeline) :-
+	setup_call_cleanup(
+		mng_cursor_create(DB, Coll, Cursor),
+		(	mng_cursor_aggregate(Cursor, ['pipeline', array(Pipeline)]),
+			ignore(mng_cursor_next(Cursor, _))
+		),
+		mng_cursor_destroy(Cursor)
+	).
+
+%%
+tf_indices :-
+	mng_get_db(DB, Coll, 'tf'),
+	forall(
+		member(Index, [
+			['child_frame_id'],
+			['header.stamp'],
+			['child_frame_id', 'header.stamp']
+		]),
+		mng_index_create(DB, Coll, Index)
+	).
+
+%% kb_snapshot_time(?Snapshot, ?Time) is nondet.
+%
+% The timepoint of a snapshot.
+%
+% @param Snapshot the snapshot name.
+% @param Time the timepoint of the snapshot.
+%
+kb_snapshot_time(Snapshot, Time) :-
+	ground(Snapshot),
+	snapshot_(Snapshot, Time),
+	!.
+
+kb_snapshot_time(Snapshot, Time) :-
+	(	ground(Snapshot)
+	->	Filter=[['name', string(Snapshot)]]
+	;	Filter=[]
+	),
+	mng_get_db(DB, Coll, 'snapshots'),
+	mng_find(DB, Coll, Filter, Doc),
+	get_dict(name, Doc, string(SnapshotString)),
+	get_dict(time, Doc, double(Time)),
+	atom_string(Snapshot, SnapshotString),
+	(	snapshot_(Snapshot, _) -> true
+	;	assertz(snapshot_(Snapshot, Time))
+	).
+
+%% kb_snapshot_destroy(+Snapshot) is det.
+%
+% Drop the collections of a snapshot, and remove its record.
+%
+% @param Snapshot the snapshot name.
+%
+kb_snapshot_destroy(Snapshot) :-
+	retractall(snapshot_(Snapshot, _)),
+	mng_get_db(DB, SnapshotsColl, 'snapshots'),
+	findall(Name,
+		(	mng_find(DB, SnapshotsColl, [['name', string(Snapshot)]], Doc),
+			get_dict(collections, Doc, array(Names)),
+			member(string(NameString), Names),
+			atom_string(Name, NameString)
+		;	member(Name, [triples, tf, annotations])
+		),
+		Names0),
+	list_to_set(Names0, CollNames),
+	mng_with_collection_prefix(Snapshot,
+		forall(
+			member(Name, CollNames),
+			(	mng_get_db(DB, Coll, Name),
+				mng_drop(DB, Coll)
+			)
+		)),
+	mng_remove(DB, SnapshotsColl, [['name', string(Snapshot)]]).
+
+%%
+% The query scope used for queries on a snapshot.
+%
+snapshot_scope(Snapshot, Scope) :-
+	kb_snapshot_time(Snapshot, Stamp),
+	!,
+	time_scope(=<(double(Stamp)), >=(double(Stamp)), Scope).
+
+snapshot_scope(Snapshot, _) :-
+	throw(error(existence_error(snapshot, Snapshot), _)).
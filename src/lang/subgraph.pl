@@ -2,7 +2,8 @@
 	[ add_subgraph/2,
 	  get_supgraphs/2,
 	  get_subgraphs/2,
-	  load_graph_structure/0
+	  load_graph_structure/0,
+	  load_graph_structure/1
 	]).
 /** <module> subgraph-of relationship between RDF graphs.
 
@@ -20,10 +21,28 @@
 %% load_graph_structure is det.
 %
 % Avoid that there are any orphan graphs.
+% This includes volatile graphs that are stored in
+% the "volatile_triples" collection.
 %
 load_graph_structure :-
-	mng_get_db(DB, Coll, 'triples'),
-	mng_distinct_values(DB, Coll, 'graph', Names),
+	findall(Names,
+		(	member(CollName, [triples, volatile_triples]),
+			mng_get_db(DB, Coll, CollName),
+			mng_distinct_values(DB, Coll, 'graph', Names)
+		),
+		NamesList),
+	append(NamesList, Names0),
+	list_to_set(Names0, Names),
+	load_graph_structure(Names).
+
+%% load_graph_structure(+Names) is det.
+%
+% Same as load_graph_structure/0 but with the names
+% of graphs given instead of reading them from the database.
+%
+% @param Names list of graph names.
+%
+load_graph_structure(Names) :-
 	forall(
 		member(NameString,Names),
 		load_graph_structure1(NameString)
@@ -1,4 +1,6 @@
-:- module(lang_annotation, []).
+:- module(lang_annotation,
+	[ annotation_search(+,t,-,-)
+	]).
 /** <module> Handling of annotations in query expressions.
 
 The following predicates are supported:
@@ -7,6 +9,9 @@ The following predicates are supported:
 | ---                  | ---       |
 | annotation/3         | ?Subject, ?Property, ?Value |
 
+In addition, annotation_search/4 can be used to find entities
+by the content of their annotations, e.g. by their label.
+
 @author Daniel Beßler
 @license BSD
 */
@@ -14,18 +19,21 @@ The following predicates are supported:
 :- use_module(library('semweb/rdf_db'),
 	    [ rdf_meta/1 ]).
 :- use_module(library('db/mongo/client'),
-		[ mng_get_db/3, mng_strip_type/3 ]).
+		[ mng_get_db/3, mng_get_dict/3, mng_strip_type/3,
+		  mng_regex_prefix/2, mng_cursor_create/3, mng_cursor_destroy/1,
+		  mng_cursor_materialize/2 ]).
 :- use_module(library('lang/db')).
 :- use_module(library('lang/mongolog/mongolog')).
 
 :- rdf_meta(query_annotation(+,r,+,+,-)).
+:- rdf_meta(annotation_search(+,t,-,-)).
 
 %%
 % register the "annotations" collection.
 % This is needed for import/export and search indices.
 %
 :- setup_collection(annotations,
-		[['s'], ['p'], ['s','p']]).
+		[['s'], ['p'], ['s','p'], [text('v')]]).
 
 %% query commands
 :- mongolog:add_command(annotation).
@@ -122,6 +130,103 @@ strip_lang(Var, en, Var) :- var(Var), !.
 strip_lang(lang(Lang0,Val), Lang1, Val) :- !, Lang0 = Lang1.
 strip_lang(Val, en, Val).
 
+		 /*******************************
+		 *    	  SEARCH     		*
+		 *******************************/
+
+%% annotation_search(+Text, +Options, -Entity, -Score) is nondet.
+%
+% Find entities with annotations matching a text.
+% Solutions are ranked by Score, the best match comes first.
+% Each entity is yielded at most once with the score of
+% its best matching annotation.
+% Options are:
+%
+%   - mode(Mode): `text` (default) searches the text index of annotations
+%     for words in Text, `prefix` matches annotations starting with Text,
+%     and `infix` annotations containing Text (case insensitive).
+%   - property(Property): only search annotations of Property.
+%   - language(Lang): language of Text (default `en`).
+%     NOTE: only English annotations are stored, no results
+%     are found for other languages.
+%   - skip(N), limit(N): the batch of ranked results to return
+%     (defaults: 0 and 25).
+%
+% @param Text the search text.
+% @param Options list of search options.
+% @param Entity an annotated entity.
+% @param Score the rank of Entity.
+%
+annotation_search(Text, Options, Entity, Score) :-
+	option(language(Lang), Options, en),
+	Lang == en,
+	search_pipeline(Text, Options, Pipeline),
+	mng_get_db(DB, Coll, 'annotations'),
+	setup_call_cleanup(
+		mng_cursor_create(DB, Coll, Cursor),
+		(	mng_cursor_aggregate(Cursor, ['pipeline',array(Pipeline)]),
+			mng_cursor_materialize(Cursor, Result)
+		),
+		mng_cursor_destroy(Cursor)
+	),
+	mng_get_dict('_id', Result, string(Entity)),
+	mng_get_dict(score, Result, TypedScore),
+	mng_strip_type(TypedScore, _, Score).
+
+%%
+search_pipeline(Text, Options, Pipeline) :-
+	option(mode(Mode), Options, text),
+	option(skip(Skip), Options, 0),
+	option(limit(Limit), Options, 25),
+	(	option(property(Property), Options)
+	->	PropertyQuery=[['p', string(Property)]]
+	;	PropertyQuery=[]
+	),
+	search_match(Mode, Text, PropertyQuery, Match, ScoreExpr),
+	Pipeline=[
+		Match,
+		['$set', ['score', ScoreExpr]],
+		% yield each entity once with its best score
+		['$group', [
+			['_id', string('$s')],
+			['score', ['$max', string('$score')]]
+		]],
+		['$sort', [['score', int(-1)], ['_id', int(1)]]],
+		['$skip', int(Skip)],
+		['$limit', int(Limit)]
+	].
+
+%%
+search_match(text, Text, PropertyQuery,
+		['$match', [['$text', [
+			['$search', string(Text)],
+			['$language', string(en)]
+		]] | PropertyQuery]],
+		['$meta', string(textScore)]) :- !.
+
+search_match(Mode, Text, PropertyQuery,
+		['$match', [['v', regex(Pattern)] | PropertyQuery]],
+		% prefer short annotations that are mostly covered by Text
+		['$divide', array([
+			int(Length),
+			['$max', array([int(1), ['$strLenCP', string('$v')]])]
+		])]) :-
+	search_pattern(Mode, Text, Pattern),
+	atom_length(Text, Length).
+
+%%
+search_pattern(prefix, Text, Pattern) :-
+	!,
+	mng_regex_prefix(Text, Pattern).
+
+search_pattern(infix, Text, Pattern) :-
+	!,
+	mng_regex_prefix(Text, Prefix),
+	atom_concat('^', Pattern, Prefix).
+
+search_pattern(Mode, _, _) :-
+	throw(error(domain_error(annotation_search_mode, Mode), _)).
+
 		 /*******************************
 		 *    	  UNIT TESTING     		*
 		 *******************************/
@@ -129,7 +234,8 @@ strip_lang(Val, en, Val).
 test_cleanup :-
 	mng_get_db(DB, Coll, 'annotations'),
 	mng_remove(DB, Coll, [[s,string(e)]]),
-	mng_remove(DB, Coll, [[s,string(a)]]).
+	mng_remove(DB, Coll, [[s,string(a)]]),
+	mng_remove(DB, Coll, [[s,string(h)]]).
 
 :- begin_tests('lang_annotation',
 		[ cleanup(lang_annotation:test_cleanup) ]).
@@ -157,6 +263,14 @@ test('annotation(+,+,+)') :-
 	assert_true(kb_call(annotation(a,b,c))),
 	assert_false(kb_call(annotation(a,b,d))).
 
+test('annotation_search(+,+,-,-)') :-
+	assert_true(kb_project(annotation(h, rdfs:comment, 'A searchable comment'))),
+	assert_true(annotation_search(comment, [], h, _)),
+	assert_true(annotation_search('a sea', [mode(prefix)], h, _)),
+	assert_true(annotation_search(able, [mode(infix)], h, _)),
+	assert_false(annotation_search(able, [mode(prefix)], h, _)),
+	assert_false(annotation_search(comment, [property(rdfs:label)], h, _)).
+
 test('annotation(-,+,+)', [throws(error(instantiation_error,_))]) :-
 	kb_call(annotation(_,b,c)).
 
@@ -15,14 +15,18 @@ The following predicates are supported:
 @license BSD
 */
 
+:- use_module(library(settings)).
 :- use_module(library('semweb/rdf_db'),
-		[ rdf_meta/1 ]).
+		[ rdf_meta/1, rdf_equal/2 ]).
 :- use_module(library('lang/subgraph'),
 		[ get_supgraphs/2 ]).
 :- use_module(library('lang/scope'),
 		[ time_scope/3, time_scope_data/2 ]).
 :- use_module(library('db/mongo/client'),
 		[ mng_get_db/3,
+		  mng_cursor_create/3,
+		  mng_cursor_destroy/1,
+		  mng_cursor_next/2,
 		  mng_strip_variable/2,
 		  mng_strip_operator/3,
 		  mng_operator/2,
@@ -30,20 +34,31 @@ The following predicates are supported:
 		  mng_typed_value/2 ]).
 :- use_module(library('lang/mongolog/mongolog')).
 
+:- setting(local_names, boolean, true,
+	'Flag if the local names of IRIs stored in triple documents are used to answer regex queries. Triples written without local names are updated by update_local_names/0.').
+
 :- rdf_meta(taxonomical_property(r)).
 :- rdf_meta(must_propagate_assert(r)).
 :- rdf_meta(lookup_parents_property(t,t)).
 
+%%
+triple_indices([
+		['s'], ['p'], ['o'], ['p*'], ['o*'],
+		['s','p'], ['s','o'], ['o','p'],
+		['s','p*'], ['s','o*'], ['o','p*'], ['p','o*'],
+		['s','o','p'], ['s','o','p*'], ['s','o*','p'],
+		['s#'], ['p*#'], ['o*#'] ]).
+
 %%
 % register the "triples" collection.
 % This is needed for import/export.
 % It also creates search indices.
+% The "volatile_triples" collection holds triples of
+% graphs listed in the volatile_graphs setting.
 %
-:- setup_collection(triples, [
-		['s'], ['p'], ['o'], ['p*'], ['o*'],
-		['s','p'], ['s','o'], ['o','p'],
-		['s','p*'], ['s','o*'], ['o','p*'], ['p','o*'],
-		['s','o','p'], ['s','o','p*'], ['s','o*','p'] ]).
+:- triple_indices(Indices),
+   setup_collection(triples, Indices),
+   setup_collection(volatile_triples, Indices).
 
 %% register query commands
 :- mongolog:add_command(triple).
@@ -144,8 +159,8 @@ compile_ask(triple(S,P,O), Ctx, Pipeline) :-
 compile_assert(triple(S,P,O), Ctx, Pipeline) :-
 	% add additional options to the compile context
 	extend_context(triple(S,P,O), P1, Ctx, Ctx0),
-	option(collection(Collection), Ctx0),
 	option(graph(Graph), Ctx0, user),
+	assert_collection(Graph, Ctx0, Collection),
 	option(scope(Scope), Ctx0),
 	time_scope_values(Scope, SinceTyped, UntilTyped),
 	% throw instantiation_error if one of the arguments was not referred to before
@@ -159,10 +174,19 @@ compile_assert(triple(S,P,O), Ctx, Pipeline) :-
 	->	( Pstar=array([string(P1)]), Ostar=string('$parents') )
 	;	( Pstar=string('$parents'),  Ostar=array([V_query]) )
 	),
+	% local names of IRIs are stored for fast lookup by name.
+	% note that objects of non taxonomical properties may be literals.
+	local_name_expr(S_query, S_name),
+	local_names_expr(Pstar, Pstar_names),
+	(	taxonomical_property(P1)
+	->	local_names_expr(Ostar, Ostar_names)
+	;	Ostar_names=array([])
+	),
 	% build triple docuemnt
 	TripleDoc=[
 		['s', S_query], ['p', string(P1)], ['o', V_query],
 		['p*', Pstar], ['o*', Ostar],
+		['s#', S_name], ['p*#', Pstar_names], ['o*#', Ostar_names],
 		['graph', string(Graph)],
 		['scope', string('$v_scope')]
 	],
@@ -182,7 +206,7 @@ compile_assert(triple(S,P,O), Ctx, Pipeline) :-
 			]]]]]
 		% lookup documents that overlap with triple into 'next' field,
 		% and toggle their delete flag to true
-		;	delete_overlapping(triple(S,P,O), Ctx0, Step)
+		;	delete_overlapping(triple(S,P,O), Collection, Ctx0, Step)
 		% lookup parent documents into the 'parents' field
 		;	lookup_parents(triple(S,P1,O), Ctx0, Step)
 		% update v_scope.time.since
@@ -202,6 +226,17 @@ compile_assert(triple(S,P,O), Ctx, Pipeline) :-
 		Pipeline
 	).
 
+%%
+% Triples of volatile graphs are written into a separate collection.
+%
+assert_collection(Graph, Ctx, VolatileColl) :-
+	option(volatile_collection(VolatileColl), Ctx),
+	lang_db:volatile_graph(Graph),
+	!.
+
+assert_collection(_, Ctx, Coll) :-
+	option(collection(Coll), Ctx).
+
 %%
 time_scope_values(Scope, SinceValue, UntilValue) :-
 	time_scope_data(Scope, [Since,Until]),
@@ -223,7 +258,6 @@ time_scope_value2(Atom, string(Atom)) :- atom(Atom).
 %%
 lookup_triple(triple(S,P,V), Ctx, Step) :-
 	\+ memberchk(transitive, Ctx),
-	memberchk(collection(Coll), Ctx),
 	memberchk(step_vars(StepVars), Ctx),
 	% FIXME: revise below
 	mng_triple_doc(triple(S,P,V), QueryDoc, Ctx),
@@ -239,9 +273,11 @@ lookup_triple(triple(S,P,V), Ctx, Step) :-
 	findall(MatchQuery,
 		% first match what is grounded in compile context
 		(	MatchQuery=QueryDoc
-		% next match variables grounded in call context
+		% next match variables grounded in call context.
+		% variables not referred to before are known to be unbound.
 		;	(	member([Arg,FieldValue],[[S,'$s'],[P,Key_p],[V,Key_o]]),
 				triple_arg_var(Arg, ArgVar),
+				mongolog:is_referenced(ArgVar, Ctx),
 				mongolog:var_key(ArgVar, Ctx, ArgKey),
 				atom_concat('$$',ArgKey,ArgValue),
 				atom_concat(ArgValue,'.type',ArgType),
@@ -253,7 +289,6 @@ lookup_triple(triple(S,P,V), Ctx, Step) :-
 				])]]
 			)
 		;	scope_match(Ctx, MatchQuery)
-		;	graph_match(Ctx, MatchQuery)
 		),
 		MatchQueries
 	),
@@ -274,12 +309,14 @@ lookup_triple(triple(S,P,V), Ctx, Step) :-
 	% pass input document values to lookup
 	mongolog:lookup_let_doc(StepVars, LetDoc),
 	% lookup matching documents and store in 'next' field
-    (	Step=['$lookup', [
-			['from',string(Coll)],
-			['as',string('next')],
-			['let',LetDoc],
-			['pipeline', array(InnerPipeline)]
-		]]
+    (	lookup_union(Ctx, 'next', LetDoc, InnerPipeline, Step)
+	% limit results of the union if requested
+	;	(	once(union_collection(Ctx, _, _)),
+			member(limit(Limit),Ctx),
+			Step=['$set', ['next', ['$slice',
+				array([string('$next'), int(Limit)])
+			]]]
+		)
 	% add additional results if P is a reflexive property
 	;	(	memberchk(reflexive,Ctx),
 			(	Step=['$unwind',string('$next')]
@@ -297,7 +334,6 @@ lookup_triple(triple(S,P,V), Ctx, Step) :-
 lookup_triple(triple(S,P,V), Ctx, Step) :-
 	% read options
 	option(transitive, Ctx),
-	option(collection(Coll), Ctx),
 	mng_one_db(_DB, OneColl),
 	% infer lookup parameters
 	query_value(P,Query_p),
@@ -324,15 +360,14 @@ lookup_triple(triple(S,P,V), Ctx, Step) :-
 		MatchDoc
 	),
 	% recursive lookup
-	(	Step=['$graphLookup', [
-			['from',                    string(Coll)],
-			['startWith',               Start],
-			['connectToField',          string(To)],
-			['connectFromField',        string(From)],
-			['as',                      string('t_paths')],
-			['depthField',              string('depth')],
-			['restrictSearchWithMatch', MatchDoc]
-		]]
+	(	graph_lookup_union(Ctx,
+			[	['startWith',               Start],
+				['connectToField',          string(To)],
+				['connectFromField',        string(From)],
+				['depthField',              string('depth')],
+				['restrictSearchWithMatch', MatchDoc]
+			],
+			Step)
 	% $graphLookup does not ensure order, so we need to order by recursion depth
 	% in a separate step
 	;	Step=['$lookup', [
@@ -391,14 +426,13 @@ reflexivity(StartValue, Ctx, Step) :-
 	).
 
 %%
-delete_overlapping(triple(S,P,V), Ctx,
+delete_overlapping(triple(S,P,V), Coll, Ctx,
 		['$lookup', [
 			['from',string(Coll)],
 			['as',string('next')],
 			['let',LetDoc],
 			['pipeline',array(Pipeline)]
 		]]) :-
-	memberchk(collection(Coll), Ctx),
 	memberchk(step_vars(StepVars), Ctx),
 	% read triple data
 	mongolog:var_key_or_val1(P, Ctx, P0),
@@ -469,24 +503,19 @@ lookup_parents_property(triple(_,P,_),                  [P,rdfs:subPropertyOf]).
 
 %%
 lookup_parents(Triple, Context, Step) :-
-	memberchk(collection(Coll), Context),
 	once(lookup_parents_property(Triple, [Child, Property])),
 	% make sure value is wrapped in type term
 	mng_typed_value(Child,   TypedValue),
 	mng_typed_value(Property,TypedProperty),
 	% first, lookup matching documents and yield o* in parents array
-	(	Step=['$lookup', [
-			['from',string(Coll)],
-			['as',string('parents')],
-			['pipeline',array([
-				['$match', [
-					['s',TypedValue],
-					['p',TypedProperty]
-				]],
-				['$project', [['o*', int(1)]]],
-				['$unwind', string('$o*')]
-			])]
-		]]
+	(	lookup_union(Context, 'parents', [], [
+			['$match', [
+				['s',TypedValue],
+				['p',TypedProperty]
+			]],
+			['$project', [['o*', int(1)]]],
+			['$unwind', string('$o*')]
+		], Step)
 	% convert parents from list of documents to list of strings.
 	;	Step=['$set',['parents',['$map',[
 			['input',string('$parents')],
@@ -498,7 +527,6 @@ lookup_parents(Triple, Context, Step) :-
 
 %%
 propagate_assert(S, Context, Step) :-
-	memberchk(collection(Collection), Context),
 	mng_typed_value(S,TypedS),
 	% the inner lookup matches documents with S in o*
 	findall(X,
@@ -506,10 +534,15 @@ propagate_assert(S, Context, Step) :-
 		(	X=['$match', [['o*',TypedS]]]
 		% and add parent field from input documents to o*
 		;	array_concat('o*', string('$$parents'), X)
+		;	(	local_names_expr(string('$$parents'), ParentNames),
+				array_concat('o*#', ParentNames, X)
+			)
 		% only replace o*
-		;	X=['$project',[['o*',int(1)]]]
+		;	X=['$project',[['o*',int(1)],['o*#',int(1)]]]
 		),
 		Inner),
+	% documents are updated in the collection they are stored in
+	triple_collection(Context, Collection),
 	% first, lookup matching documents and update o*
 	(	Step=['$lookup', [
 			['from',string(Collection)],
@@ -525,6 +558,165 @@ propagate_assert(S, Context, Step) :-
 must_propagate_assert(rdfs:subClassOf).
 must_propagate_assert(rdfs:subPropertyOf).
 
+%% update_parents(+Classes, +Properties) is det.
+%
+% Recompute the "o*" and "p*" fields of triples after
+% rdfs:subClassOf relations of Classes, and rdfs:subPropertyOf
+% relations of Properties have been removed.
+% Only documents that refer to one of the classes or properties
+% in these fields are updated.
+% Their parents are looked up server-side, and written back
+% into the collection in the same aggregate pipeline.
+%
+update_parents([], []) :- !.
+update_parents(Classes, Properties) :-
+	mng_get_db(DB, TriplesColl, 'triples'),
+	forall(
+		(	member(Name, [triples, volatile_triples]),
+			(	Name == triples
+			;	setting(lang_db:volatile_graphs, [_|_])
+			),
+			mng_get_db(DB, Coll, Name),
+			update_parents_pipeline(Classes, Properties,
+				TriplesColl, Coll, Pipeline)
+		),
+		setup_call_cleanup(
+			mng_cursor_create(DB, Coll, Cursor),
+			(	mng_cursor_aggregate(Cursor, ['pipeline', array(Pipeline)]),
+				ignore(mng_cursor_next(Cursor, _))
+			),
+			mng_cursor_destroy(Cursor)
+		)
+	).
+
+%%
+update_parents_pipeline(Classes, Properties, From, Into, Pipeline) :-
+	rdf_equal(rdf:type, RDFType),
+	rdf_equal(rdfs:subClassOf, SubClassOf),
+	rdf_equal(rdfs:subPropertyOf, SubPropertyOf),
+	findall(string(X), member(X, Classes),    Cs),
+	findall(string(X), member(X, Properties), Ps),
+	% each solution yields the pipeline for one kind of documents
+	(	Cs \== [],
+		Match=[
+			['p', ['$in', array([string(SubClassOf), string(RDFType)])]],
+			['$or', array([
+				[['s',  ['$in', array(Cs)]]],
+				[['o*', ['$in', array(Cs)]]]
+			])]
+		],
+		Field='o', Taxonomy=SubClassOf
+	;	Ps \== [],
+		Match=[
+			['p', string(SubPropertyOf)],
+			['$or', array([
+				[['s',  ['$in', array(Ps)]]],
+				[['o*', ['$in', array(Ps)]]]
+			])]
+		],
+		Field='o', Taxonomy=SubPropertyOf
+	;	Ps \== [],
+		Match=[['p*', ['$in', array(Ps)]]],
+		Field='p', Taxonomy=SubPropertyOf
+	),
+	atom_concat(Field, '*', StarField),
+	atom_concat(StarField, '#', NamesField),
+	atom_concat('$', Field, FieldValue),
+	atom_concat('$', StarField, StarValue),
+	local_names_expr(string(StarValue), NamesExpr),
+	findall(Step,
+		(	Step=['$match', Match]
+		% lookup all parents of the field value
+		;	Step=['$graphLookup', [
+				['from',                    string(From)],
+				['startWith',               string(FieldValue)],
+				['connectFromField',        string('o')],
+				['connectToField',          string('s')],
+				['as',                      string('t_parents')],
+				['restrictSearchWithMatch', [['p', string(Taxonomy)]]]
+			]]
+		;	Step=['$set', [StarField, ['$setUnion', array([
+				array([string(FieldValue)]),
+				string('$t_parents.o')
+			])]]]
+		;	Step=['$set', [NamesField, NamesExpr]]
+		;	Step=['$project', [[StarField, int(1)], [NamesField, int(1)]]]
+		;	Step=['$merge', [
+				['into',           string(Into)],
+				['on',             string('_id')],
+				['whenMatched',    string(merge)],
+				['whenNotMatched', string(discard)]
+			]]
+		),
+		Pipeline
+	).
+
+%% update_local_names is det.
+%
+% Store the local names of IRIs in triple documents that were
+% written without them, e.g. by an older version of KnowRob,
+% or restored from a dump.
+% Only documents without the "s#" field are updated, and these
+% are looked up using the index of this field.
+% Nothing is done for read only databases, or in case local names
+% are not used.
+%
+update_local_names :-
+	(	setting(mng_client:read_only, true)
+	;	setting(lang_triple:local_names, false)
+	),
+	!.
+
+update_local_names :-
+	forall(
+		(	member(Name, [triples, volatile_triples]),
+			(	Name == triples
+			;	setting(lang_db:volatile_graphs, [_|_])
+			),
+			mng_get_db(DB, Coll, Name),
+			update_local_names_pipeline(Coll, Pipeline)
+		),
+		setup_call_cleanup(
+			mng_cursor_create(DB, Coll, Cursor),
+			(	mng_cursor_aggregate(Cursor, ['pipeline', array(Pipeline)]),
+				ignore(mng_cursor_next(Cursor, _))
+			),
+			mng_cursor_destroy(Cursor)
+		)
+	).
+
+%%
+update_local_names_pipeline(Into, Pipeline) :-
+	% objects of taxonomical properties are IRIs
+	rdf_equal(rdf:type, RDFType),
+	rdf_equal(rdfs:subClassOf, SubClassOf),
+	rdf_equal(rdfs:subPropertyOf, SubPropertyOf),
+	local_name_expr(string('$s'), S_name),
+	local_names_expr(string('$p*'), Pstar_names),
+	local_names_expr(string('$o*'), Ostar_names),
+	Pipeline=[
+		['$match', [['s#', ['$exists', bool(false)]]]],
+		['$project', [
+			['s#', S_name],
+			['p*#', Pstar_names],
+			['o*#', ['$cond', array([
+				['$in', array([string('$p'), array([
+					string(RDFType),
+					string(SubClassOf),
+					string(SubPropertyOf)
+				])])],
+				Ostar_names,
+				array([])
+			])]]
+		]],
+		['$merge', [
+			['into',           string(Into)],
+			['on',             string('_id')],
+			['whenMatched',    string(merge)],
+			['whenNotMatched', string(discard)]
+		]]
+	].
+
 %%%%%%%%%%%%%%%%%%%%%%%
 %%%%%%%%% triple/3 query pattern
 %%%%%%%%%%%%%%%%%%%%%%%
@@ -563,7 +755,11 @@ triple(S,P,O) :-
 mng_triple_doc(triple(S,P,V), Doc, Context) :-
 	%% read options
 	option(graph(Graph), Context, user),
-	option(scope(Scope), Context, dict{}),
+	% snapshots only hold facts valid at the time of the snapshot
+	(	option(snapshot(_), Context)
+	->	Scope=dict{}
+	;	option(scope(Scope), Context, dict{})
+	),
 	% special handling for some properties
 	(	taxonomical_property(P)
 	->	( Key_p='p',  Key_o='o*' )
@@ -576,9 +772,9 @@ mng_triple_doc(triple(S,P,V), Doc, Context) :-
 	% get the query pattern
 	% FIXME: query_value may silently fail on invalid input and this rule still succeeds
 	findall(X,
-		(	( query_value(S1,Query_s), X=['s',Query_s] )
-		;	( query_value(P1,Query_p), X=[Key_p,Query_p] )
-		;	( query_value(V1,Query_v), \+ is_term_query(Query_v), X=[Key_o,Query_v] )
+		(	( query_value(S1,Query_s), triple_query('s',Query_s,X) )
+		;	( query_value(P1,Query_p), triple_query(Key_p,Query_p,X) )
+		;	( query_value(V1,Query_v), \+ is_term_query(Query_v), triple_query(Key_o,Query_v,X) )
 		;	graph_doc(Graph,X)
 		;	scope_doc(Scope,X)
 		),
@@ -604,6 +800,102 @@ query_value(In, Out) :-
 	;	Out=X
 	).
 
+%%
+% Regex patterns are rewritten such that they can be answered
+% using indices:
+%   - `^.*#Name$` is answered by the local name fields
+%     of s, p* and o* (for taxonomical properties).
+%   - anchored prefix patterns `^Prefix.*` are translated into
+%     a range query, and the pattern is kept as a filter
+%     of the documents in the range.
+% NOTE: regex patterns are matched case insensitive.
+%       Local names are stored in lower case such that an equality
+%       match on them is case insensitive too. This is only done for
+%       ASCII names as $toLower is not defined for other characters.
+%       The range of a prefix is case sensitive as IRIs are,
+%       i.e. a prefix only matches IRIs with the same case.
+%
+triple_query(Key, regex(Pattern), [NameKey, string(Lower)]) :-
+	memberchk(Key, ['s', 'p*', 'o*']),
+	setting(lang_triple:local_names, true),
+	regex_local_name(Pattern, Name),
+	is_ascii(Name),
+	!,
+	downcase_atom(Name, Lower),
+	atom_concat(Key, '#', NameKey).
+
+triple_query(Key, regex(Pattern), [Key, [
+		['$gte',   string(Lower)],
+		['$lt',    string(Upper)],
+		['$regex', regex(Pattern)]
+	]]) :-
+	regex_prefix_range(Pattern, Lower, Upper),
+	!.
+
+triple_query(Key, Query, [Key, Query]).
+
+%%
+regex_local_name(Pattern, Name) :-
+	atom_concat('^.*#', Rest, Pattern),
+	atom_codes(Rest, Codes),
+	phrase(regex_literal(NameCodes), Codes, `$`),
+	NameCodes \== [],
+	atom_codes(Name, NameCodes).
+
+%%
+regex_prefix_range(Pattern, Lower, Upper) :-
+	atom_codes(Pattern, [0'^|Codes]),
+	phrase(regex_literal(PrefixCodes), Codes, Remainder),
+	memberchk(Remainder, [``, `.*`, `.*$`]),
+	PrefixCodes \== [],
+	% the upper bound is the prefix with incremented last character
+	append(Init, [Last], PrefixCodes),
+	Next is Last + 1,
+	Next =< 0x10FFFF,
+	append(Init, [Next], UpperCodes),
+	atom_codes(Lower, PrefixCodes),
+	atom_codes(Upper, UpperCodes).
+
+%%
+% a sequence of characters without special meaning in regex patterns.
+%
+regex_literal([X|Xs]) -->
+	[0'\\, X],
+	{ \+ code_type(X, alnum) },
+	!,
+	regex_literal(Xs).
+regex_literal([X|Xs]) -->
+	[X],
+	{ \+ regex_special(X) },
+	!,
+	regex_literal(Xs).
+regex_literal([]) --> [].
+
+regex_special(X) :- memberchk(X, `\\^$.|?*+()[]{}`).
+
+%%
+is_ascii(Atom) :-
+	atom_codes(Atom, Codes),
+	forall(member(X, Codes), X < 128).
+
+%%
+% expression that evaluates to the local name of an IRI in lower case.
+%
+local_name_expr(IRI, ['$toLower', ['$arrayElemAt', array([
+		['$split', array([IRI, string('#')])],
+		int(-1)
+	])]]).
+
+local_names_expr(array(IRIs), array(Names)) :-
+	!,
+	maplist(local_name_expr, IRIs, Names).
+
+local_names_expr(IRIs, ['$map', [
+		['input', IRIs],
+		['in', Name]
+	]]) :-
+	local_name_expr(string('$$this'), Name).
+
 %%
 triple_arg_var(Arg, ArgVar) :-
 	mng_strip_variable(Arg, X),
@@ -629,17 +921,6 @@ graph_doc(=(GraphName), ['graph',string(GraphName)]) :- !.
 graph_doc(  GraphName,  ['graph',['$in',array(Graphs)]]) :-
 	get_supgraphs(GraphName,Graphs).
 
-%%
-graph_match(Ctx, ['$expr', [Operator,
-		array([ string(GraphValue), ArgVal ])
-	]]) :-
-	option(graph(Graph), Ctx, user),
-	graph_doc(Graph, [GraphKey, Arg]),
-	atom_concat('$',GraphKey,GraphValue),
-	(	(   is_list(Arg), Arg=[Operator,ArgVal])
-	;	(\+ is_list(Arg), Arg=[ArgVal], Operator='$eq')
-	).
-
 %%
 scope_doc(QScope, [Key,Value]) :-
 	scope_doc1(QScope, [Key,Value]),
@@ -665,6 +946,7 @@ scope_doc(Value, '', Query) :-
 
 %%
 scope_match(Ctx, ['$expr', ['$and', array(List)]]) :-
+	\+ option(snapshot(_), Ctx),
 	option(scope(Scope), Ctx),
 	findall([Operator, array([string(ScopeValue),string(Val)])],
 		(	scope_doc1(Scope, [ScopeKey,Arg]),
@@ -722,9 +1004,19 @@ scope_intersect(VarKey, Since1, Until1, Options, Step) :-
 
 %%
 extend_context(triple(_,P,_), P1, Context, Context0) :-
-	% get the collection name
+	% get the collection name.
+	% the collection with triples of volatile graphs is only
+	% used in case no collection was given explicitly.
 	(	option(collection(Coll), Context)
-	;	mng_get_db(_DB, Coll, 'triples')
+	->	( Volatile=[], TBox=[] )
+	;	mng_get_db(_DB, Coll, 'triples'),
+		% snapshots include triples of volatile graphs
+		(	option(snapshot(_), Context)
+		->	Volatile=[]
+		;	volatile_options(Volatile)
+		),
+		% episodes read the TBox from the shared collection
+		tbox_options(Context, Coll, TBox)
 	),
 	% read options from argument terms
 	% e.g. properties can be wrapped in transitive/1 term to
@@ -736,11 +1028,130 @@ extend_context(triple(_,P,_), P1, Context, Context0) :-
 	bagof(Opt,
 		(	Opt=property(P1)
 		;	Opt=collection(Coll)
+		;	member(Opt, Volatile)
+		;	member(Opt, TBox)
 		;	member(Opt, P_opts)
 		;	member(Opt, Context)
 		),
 		Context0).
 
+%%
+volatile_options([volatile_collection(VolatileColl)]) :-
+	setting(lang_db:volatile_graphs, [_|_]),
+	!,
+	mng_get_db(_DB, VolatileColl, 'volatile_triples').
+volatile_options([]).
+
+%%
+% The TBox of an episode is not stored in its own triple collection,
+% it is read from the triple collection of the process instead.
+%
+tbox_options(Context, Coll, [tbox_collection(TBoxColl)]) :-
+	option(episode(_), Context),
+	lang_episodes:tbox_collection(_DB, TBoxColl),
+	TBoxColl \== Coll,
+	!.
+tbox_options(_, _, []).
+
+%%
+% The collections from which triples are read.
+%
+triple_collection(Ctx, Coll) :-
+	option(collection(Coll), Ctx).
+triple_collection(Ctx, Coll) :-
+	option(volatile_collection(Coll), Ctx).
+
+%%
+% Collections from which triples are read in addition to the
+% triple collection. Lookups into these collections write into a field
+% with the suffix, and are concatenated with the lookup into the triple
+% collection.
+% Triples are only written into the triple and volatile collections.
+%
+union_collection(Ctx, '_v', Coll) :-
+	option(volatile_collection(Coll), Ctx).
+union_collection(Ctx, '_t', Coll) :-
+	option(tbox_collection(Coll), Ctx).
+
+%%
+% Lookup documents from all triple collections into
+% the field Key. The lookup is performed separately in each collection,
+% and the results are concatenated.
+%
+lookup_union(Ctx, Key, LetDoc, Pipeline, Step) :-
+	\+ union_collection(Ctx, _, _),
+	!,
+	option(collection(Coll), Ctx),
+	lookup_step(Coll, Key, LetDoc, Pipeline, Step).
+
+lookup_union(Ctx, Key, LetDoc, Pipeline, Step) :-
+	option(collection(Coll), Ctx),
+	findall(Suffix-UnionColl,
+		union_collection(Ctx, Suffix, UnionColl),
+		Unions),
+	union_keys(Key, Unions, UnionKeys, UnionValues),
+	atom_concat('$', Key, KeyValue),
+	(	lookup_step(Coll, Key, LetDoc, Pipeline, Step)
+	;	member(Suffix-UnionColl, Unions),
+		atom_concat(Key, Suffix, UnionKey),
+		lookup_step(UnionColl, UnionKey, LetDoc, Pipeline, Step)
+	;	Step=['$set', [Key, ['$concatArrays',
+			array([string(KeyValue) | UnionValues])
+		]]]
+	;	Step=['$unset', array(UnionKeys)]
+	).
+
+%%
+union_keys(Key, Unions, UnionKeys, UnionValues) :-
+	findall(string(UnionKey)-string(UnionValue),
+		(	member(Suffix-_, Unions),
+			atom_concat(Key, Suffix, UnionKey),
+			atom_concat('$', UnionKey, UnionValue)
+		),
+		Pairs),
+	pairs_keys_values(Pairs, UnionKeys, UnionValues).
+
+%%
+lookup_step(Coll, Key, [], Pipeline,
+		['$lookup', [
+			['from',string(Coll)],
+			['as',string(Key)],
+			['pipeline',array(Pipeline)]
+		]]) :- !.
+lookup_step(Coll, Key, LetDoc, Pipeline,
+		['$lookup', [
+			['from',string(Coll)],
+			['as',string(Key)],
+			['let',LetDoc],
+			['pipeline',array(Pipeline)]
+		]]).
+
+%%
+% Recursive lookup into the field "t_paths".
+% Note that paths are not followed across collections.
+%
+graph_lookup_union(Ctx, Params, ['$graphLookup', [
+		['from', string(Coll)],
+		['as',   string('t_paths')] | Params ]]) :-
+	option(collection(Coll), Ctx).
+
+graph_lookup_union(Ctx, Params, Step) :-
+	findall(Suffix-UnionColl,
+		union_collection(Ctx, Suffix, UnionColl),
+		Unions),
+	Unions \== [],
+	union_keys('t_paths', Unions, UnionKeys, UnionValues),
+	(	member(Suffix-UnionColl, Unions),
+		atom_concat('t_paths', Suffix, UnionKey),
+		Step=['$graphLookup', [
+			['from', string(UnionColl)],
+			['as',   string(UnionKey)] | Params ]]
+	;	Step=['$set', ['t_paths', ['$concatArrays',
+			array([string('$t_paths') | UnionValues])
+		]]]
+	;	Step=['$unset', array(UnionKeys)]
+	).
+
 %%
 get_triple_vars(S, P, O, Ctx, Vars) :-
 	findall([Key,Field],
@@ -13,6 +13,13 @@
 :- use_module(library('lang/query')).
 :- use_module(library('lang/db')).
 :- use_module(library('lang/scope')).
+:- use_module(library('lang/snapshot')).
+:- use_module(library('lang/episodes'),
+		[ episode_unmount/1 ]).
+:- use_module(library('db/mongo/client'),
+		[ mng_get_db/3, mng_find/4, mng_update/4,
+		  mng_with_collection_prefix/2,
+		  mng_regex_prefix/2, mng_read_stats/1, mng_uri/1 ]).
 
 % register namespaces for following tests
 :- rdf_register_ns(swrl_tests,
@@ -284,4 +291,142 @@ test('call_with_context(+Triple,+Context)') :-
 			[ scope(dict{ time: dict{ since: =<(Time), until: >=(Time) } }) ]
 		), Time, 999)).
 
+test('triple(regex(+Name),+,+)') :-
+	test_regex_local_name,
+	% the regex is used as is without local names
+	setting(lang_triple:local_names, LocalNames),
+	setup_call_cleanup(
+		set_setting(lang_triple:local_names, false),
+		test_regex_local_name,
+		set_setting(lang_triple:local_names, LocalNames)).
+
+test_regex_local_name :-
+	% matching is case insensitive
+	assert_true(kb_call(triple(
+		regex('^.*#rex$'),
+		swrl_tests:isParentOf,
+		swrl_tests:'Ernest'))),
+	assert_true(kb_call(triple(
+		regex('^.*#Rex$'),
+		swrl_tests:isParentOf,
+		swrl_tests:'Ernest'))),
+	assert_true(kb_call(triple(
+		swrl_tests:'Rex',
+		rdf:type,
+		regex('^.*#Man$')))),
+	assert_false(kb_call(triple(
+		regex('^.*#Ernest$'),
+		swrl_tests:isParentOf,
+		swrl_tests:'Ernest'))).
+
+test('triple(regex(+Prefix),+,+)') :-
+	rdf_global_term(swrl_tests:'Re', Prefix),
+	mng_regex_prefix(Prefix, Pattern),
+	assert_true(kb_call(triple(
+		regex(Pattern),
+		swrl_tests:isParentOf,
+		swrl_tests:'Ernest'))),
+	rdf_global_term(swrl_tests:'Er', Prefix1),
+	mng_regex_prefix(Prefix1, Pattern1),
+	assert_false(kb_call(triple(
+		regex(Pattern1),
+		swrl_tests:isParentOf,
+		swrl_tests:'Ernest'))),
+	% prefixes are matched case sensitive as IRIs are
+	rdf_global_term(swrl_tests:'re', Prefix2),
+	mng_regex_prefix(Prefix2, Pattern2),
+	assert_false(kb_call(triple(
+		regex(Pattern2),
+		swrl_tests:isParentOf,
+		swrl_tests:'Ernest'))).
+
+test('triple(regex(+Prefix)) range query') :-
+	lang_triple:triple_query(s, regex('^http.*'), Query),
+	assert_equals(Query, [s, [
+		['$gte',   string('http')],
+		['$lt',    string('httq')],
+		['$regex', regex('^http.*')]
+	]]).
+
+test('update_local_names') :-
+	rdf_global_term(swrl_tests:'Rex', Rex),
+	mng_get_db(DB, Coll, 'triples'),
+	% remove the local names as if the triples were written without them
+	mng_update(DB, Coll, [['s', string(Rex)]],
+		['$unset', [['s#', string('')], ['p*#', string('')], ['o*#', string('')]]]),
+	lang_triple:update_local_names,
+	assert_true(mng_find(DB, Coll, [
+		['s', string(Rex)],
+		['s#', string(rex)]
+	], _)),
+	test_regex_local_name.
+
+test('triple(+,+,-) read_preference(+)') :-
+	current_scope(QScope),
+	% the primary serves the query in case there are no secondaries
+	assert_true(kb_call(triple(swrl_tests:'Rex', swrl_tests:isParentOf, _),
+		QScope, _, [read_preference(secondaryPreferred)])),
+	mng_read_stats(Stats),
+	assert_true(memberchk(read(secondaryPreferred,_,_), Stats)).
+
+% reads are only routed to secondaries when connected to a replica set
+has_secondaries :-
+	mng_uri(URI),
+	sub_atom(URI, _, _, _, 'replicaSet=').
+
+test('triple(+,+,-) read_preference(secondary)', [condition(has_secondaries)]) :-
+	current_scope(QScope),
+	assert_true(kb_call(triple(swrl_tests:'Rex', swrl_tests:isParentOf, _),
+		QScope, _, [read_preference(primary)])),
+	assert_true(kb_call(triple(swrl_tests:'Rex', swrl_tests:isParentOf, _),
+		QScope, _, [read_preference(secondary)])),
+	mng_read_stats(Stats),
+	assert_true(memberchk(read(primary,Primary,_), Stats)),
+	assert_true(memberchk(read(secondary,Secondary,_), Stats)),
+	assert_true(Primary \== Secondary).
+
+test('triple(+,+,+) in volatile graph') :-
+	universal_scope(Scope),
+	current_scope(QScope),
+	setting(lang_db:volatile_graphs, Graphs),
+	setup_call_cleanup(
+		set_setting(lang_db:volatile_graphs, [user]),
+		(	assert_true(kb_project(triple(v_a,v_b,v_c), Scope, [graph(user)])),
+			assert_true(kb_call(triple(v_a,v_b,v_c), QScope, _, [graph(user)])),
+			assert_false(is_unique_name(v_a)),
+			assert_true(drop_graph(user)),
+			assert_true(is_unique_name(v_a)),
+			assert_false(kb_call(triple(v_a,v_b,v_c), QScope, _, [graph(user)]))
+		),
+		set_setting(lang_db:volatile_graphs, Graphs)
+	).
+
+test('triple(+,+,+) in snapshot') :-
+	time_scope(=(double(100)), =(double(200)), Scope),
+	current_scope(QScope),
+	kb_project(triple(s_a,s_b,s_c), Scope),
+	setup_call_cleanup(
+		(	kb_snapshot_create(150, Snapshot1),
+			kb_snapshot_create(250, Snapshot2)
+		),
+		(	assert_true(kb_call(triple(s_a,s_b,s_c), QScope, _, [snapshot(Snapshot1)])),
+			assert_false(kb_call(triple(s_a,s_b,s_c), QScope, _, [snapshot(Snapshot2)]))
+		),
+		(	kb_snapshot_destroy(Snapshot1),
+			kb_snapshot_destroy(Snapshot2)
+		)
+	).
+
+test('triple(+,+,+) episode(+) reads the shared TBox') :-
+	current_scope(QScope),
+	assert_true(kb_project(triple(test_tbox_s, test_tbox_p, test_tbox_o))),
+	assert_true(kb_call(triple(test_tbox_s, test_tbox_p, test_tbox_o),
+		QScope, _, [episode(test_tbox_episode)])),
+	% the triple is not copied into the episode
+	mng_with_collection_prefix(test_tbox_episode,
+		mng_get_db(DB, Coll, 'triples')),
+	assert_false(mng_find(DB, Coll, [['s', string(test_tbox_s)]], _)),
+	episode_unmount(test_tbox_episode),
+	assert_true(kb_unproject(triple(test_tbox_s, test_tbox_p, test_tbox_o))).
+
 :- end_tests('lang_triple').
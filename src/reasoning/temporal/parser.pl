@@ -6,6 +6,7 @@
       parser_stop/1,
       parser_stop/2,
       parser_push_token/2,
+      parser_push_tokens/2,
       parser_pop_finalized/2,
       parser_intermediate_results/2,
       parser_jsonify/2,
@@ -24,6 +25,7 @@ can be casted as grammar for the parser.
 % TODO: activitiy composer should use projection interface!
 
 :- use_module(library('debug')).
+:- use_module(library(settings)).
 :- use_module(library('http/json')).
 :- use_module(library('semweb/rdf_db')).
 
@@ -41,6 +43,12 @@ can be casted as grammar for the parser.
 	[ interval_constraint/3 ]).
 :- use_module('esg').
 
+:- use_foreign_library('libparser_knowrob.so').
+
+% define some settings
+:- setting(token_lateness, number, 0.5,
+  'Time in seconds tokens are held back to restore their temporal order.').
+
 :- rdf_meta endpoint_type_(t,r),
             parser_grammar_(?,r,r,t),
             parser_create_grammar_(+,r),
@@ -49,7 +57,8 @@ can be casted as grammar for the parser.
             parser_start(+),
             parser_stop(+),
             parser_stop(+,-),
-            parser_push_token(+,t).
+            parser_push_token(+,t),
+            parser_push_tokens(+,t).
 
 :- dynamic parser_grammar_/4, % Parser, Workflow, Task Concept, Sequence Graph
            parser_queue_/3,
@@ -186,15 +195,18 @@ parser_start(Parser) :-
   assertz(parser_queue_(Parser,In,Out)),
   assertz(composer_queue_(Parser,Composed)),
   composer_set_intermediate_(Parser,[]),
-  %% obtain tokens from ROS topic '/parser/token'
-  ignore(ros_subscribe('/parser/token',
-      'knowrob/EventToken',
-      activity_parser:ros_push_token(Parser),
-      Subscriber)),
-  assertz(parser_subscriber_(Parser,Subscriber)),
   %% run the parser
   thread_create(parser_run_(Parser),Thread),
   assertz(parser_thread_(Parser,Thread)),
+  %% obtain tokens from ROS topic '/parser/token'.
+  %% tokens are reordered by their timestamp, and pushed
+  %% to the parser in batches.
+  setting(activity_parser:token_lateness,Lateness),
+  ( parser_token_subscribe(Parser,'/parser/token',Lateness) ->
+    ( thread_create(parser_feed_(Parser),Feeder),
+      assertz(parser_subscriber_(Parser,Feeder)) ) ;
+    true
+  ),
   %% run composer
   thread_create(activity_composer_run_(Parser),ComposeThread),
   assertz(composer_thread_(Parser,ComposeThread)),
@@ -224,9 +236,7 @@ parser_time_(Parser,Time) :-
 %
 parser_stop(Parser) :-
   %% stop listining to ROS topics
-  parser_subscriber_(Parser,Subscriber),
-  ros_unsubscribe(Subscriber,'/parser/token'),
-  retractall(parser_subscriber_(Parser,_)),
+  parser_unsubscribe_(Parser),
   %% wait until parser thread exits
   parser_stop_threads_(Parser),
   %% and destroy queues
@@ -235,6 +245,8 @@ parser_stop(Parser) :-
   parser_info_(stopped(Parser)).
 
 parser_stop(Parser,Outputs) :-
+  %% stop listining to ROS topics
+  parser_unsubscribe_(Parser),
   %% wait until parser threads have finished
   parser_stop_threads_(Parser),
   %% get composed actions
@@ -244,6 +256,15 @@ parser_stop(Parser,Outputs) :-
   %%
   parser_info_(stopped(Parser)).
 
+%%
+parser_unsubscribe_(Parser) :-
+  parser_subscriber_(Parser,Feeder), !,
+  %% remaining tokens are pushed before the feeder exits
+  ignore(parser_token_unsubscribe(Parser)),
+  thread_join(Feeder,_),
+  retractall(parser_subscriber_(Parser,_)).
+parser_unsubscribe_(_).
+
 %%
 parser_stop_threads_(Parser) :-
   ( parser_thread_(Parser,Thread) ->
@@ -296,6 +317,34 @@ parser_push_token(Parser,Token) :-
   is_active_thread_(Thread),
   thread_send_message(Thread,Token).
 
+%% parser_push_tokens(+Parser,+Tokens) is semidet.
+%
+% Stream a batch of tokens into the parser thread.
+% Tokens must be ordered by their timestamp.
+% Invalid tokens are skipped.
+% Will fail in case no parser thread is running.
+%
+% @param Parser The id of an activity parser.
+% @param Tokens A list of event endpoint tokens.
+%
+parser_push_tokens(Parser,Tokens) :-
+  parser_thread_(Parser,Thread),
+  is_active_thread_(Thread),
+  forall(member(Token,Tokens), (
+    is_token_(Token) ->
+    thread_send_message(Thread,Token) ;
+    parser_message_(warning, invalid_token(Token))
+  )).
+
+%% receive reordered token batches from the native subscriber
+parser_feed_(Parser) :-
+  parser_token_pop(Parser,0.1,Tokens), !,
+  ( Tokens == [] -> true ;
+    ignore(parser_push_tokens(Parser,Tokens))
+  ),
+  parser_feed_(Parser).
+parser_feed_(_).
+
 %%
 ros_push_token(Parser,Tok) :-
   %% read input
@@ -315,7 +364,11 @@ ros_push_token(Parser,Tok) :-
     Endoint = +(EventType_atom)
   ),
   %%
-  parser_push_token(Parser,tok(Time,Endoint,Object_Atoms)).
+  Token=tok(Time,Endoint,Object_Atoms),
+  %% tokens are reordered in case the parser listens to the token topic
+  ( parser_token_push(Parser,Token) -> true ;
+    parser_push_token(Parser,Token)
+  ).
 
 is_token_(tok(Time,_Endpoint,_Objects)) :-
   %% 1.ARG
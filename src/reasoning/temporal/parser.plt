@@ -14,6 +14,21 @@
             test_composer_run(t,t),
             test_parser_run_asynch(t,t).
 
+test('parser_token_pop reorders tokens') :-
+  activity_parser:parser_token_subscribe(test_reorder,'/test/parser/token',0.5),
+  activity_parser:parser_token_push(test_reorder,tok(1.0,-(a),[x])),
+  activity_parser:parser_token_push(test_reorder,tok(3.0,-(b),[x])),
+  % tok(1.0) can be released as a later token was received,
+  % tok(3.0) is held back for the lateness bound
+  activity_parser:parser_token_pop(test_reorder,0.0,Batch0),
+  assert_equals(Batch0,[tok(1.0,-(a),[x])]),
+  activity_parser:parser_token_push(test_reorder,tok(2.0,+(a),[x])),
+  % remaining tokens are released ordered by time once the buffer was closed
+  activity_parser:parser_token_unsubscribe(test_reorder),
+  activity_parser:parser_token_pop(test_reorder,0.0,Batch1),
+  assert_equals(Batch1,[tok(2.0,+(a),[x]),tok(3.0,-(b),[x])]),
+  assert_false(activity_parser:parser_token_pop(test_reorder,0.0,_)).
+
 test('parser_assert') :-
   parser_create(Parser, [
       test:'Grasping_WF0',
@@ -0,0 +1,230 @@
+#include <knowrob/reasoning/temporal/token_buffer.h>
+
+#include <limits>
+#include <chrono>
+#include <memory>
+// SWI Prolog
+#define PL_SAFE_ARG_MACROS
+#include <SWI-cpp.h>
+
+TokenBuffer::TokenBuffer(ros::NodeHandle &node, const std::string &topic, double lateness) :
+		subscriber_(node.subscribe(topic, 1000, &TokenBuffer::callback, this)),
+		lateness_(lateness),
+		max_time_(-std::numeric_limits<double>::infinity()),
+		watermark_(-std::numeric_limits<double>::infinity()),
+		num_late_(0),
+		is_closed_(false)
+{
+}
+
+TokenBuffer::~TokenBuffer()
+{
+	close();
+}
+
+void TokenBuffer::close()
+{
+	subscriber_.shutdown();
+	std::lock_guard<std::mutex> lock(mutex_);
+	is_closed_ = true;
+	cond_.notify_all();
+}
+
+void TokenBuffer::set_lateness(double lateness)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	lateness_ = lateness;
+}
+
+double TokenBuffer::get_lateness() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return lateness_;
+}
+
+unsigned long TokenBuffer::get_num_late() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return num_late_;
+}
+
+void TokenBuffer::callback(const knowrob::EventToken::ConstPtr &msg)
+{
+	push(*msg);
+}
+
+void TokenBuffer::push(const knowrob::EventToken &token)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(is_closed_) return;
+	if(token.timestamp < watermark_) {
+		// the token is older than tokens that were released before.
+		// it is released with the next batch, but cannot be ordered anymore.
+		num_late_ += 1;
+		ROS_WARN("Token received %f seconds too late.", watermark_ - token.timestamp);
+	}
+	BufferedToken buffered;
+	buffered.token = token;
+	buffered.arrival = ros::WallTime::now();
+	buffer_.insert(std::make_pair(token.timestamp, buffered));
+	max_time_ = std::max(max_time_, token.timestamp);
+	cond_.notify_all();
+}
+
+bool TokenBuffer::can_release(const BufferedToken &buffered, const ros::WallTime &now) const
+{
+	const double &stamp = buffered.token.timestamp;
+	return stamp <= watermark_ ||
+	       stamp <= max_time_ - lateness_ ||
+	       (now - buffered.arrival).toSec() >= lateness_;
+}
+
+void TokenBuffer::release(std::vector<knowrob::EventToken> &batch)
+{
+	ros::WallTime now = ros::WallTime::now();
+	while(!buffer_.empty()) {
+		std::multimap<double,BufferedToken>::iterator it = buffer_.begin();
+		if(!is_closed_ && !can_release(it->second, now)) break;
+		batch.push_back(it->second.token);
+		watermark_ = std::max(watermark_, it->first);
+		buffer_.erase(it);
+	}
+}
+
+bool TokenBuffer::pop(std::vector<knowrob::EventToken> &batch, double timeout)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(timeout));
+	while(true) {
+		release(batch);
+		if(!batch.empty()) return true;
+		if(is_closed_) return false;
+		if(cond_.wait_until(lock, deadline) == std::cv_status::timeout) {
+			release(batch);
+			return !(batch.empty() && is_closed_);
+		}
+	}
+}
+
+/*********************************/
+/********** Prolog API ***********/
+/*********************************/
+
+static ros::NodeHandle node;
+// buffers are shared with the callers such that a buffer
+// is not deleted while another thread is using it.
+static std::map<std::string,std::shared_ptr<TokenBuffer>> token_buffers;
+static std::mutex token_buffers_mtx;
+
+static std::shared_ptr<TokenBuffer> get_token_buffer(const std::string &parser)
+{
+	std::lock_guard<std::mutex> lock(token_buffers_mtx);
+	std::map<std::string,std::shared_ptr<TokenBuffer>>::iterator it = token_buffers.find(parser);
+	if(it == token_buffers.end()) {
+		return std::shared_ptr<TokenBuffer>();
+	}
+	return it->second;
+}
+
+static void read_token(const PlTerm &term, knowrob::EventToken &token)
+{
+	// tok(Time,Endpoint,Participants)
+	token.timestamp = (double)term[1];
+	PlTerm endpoint = term[2];
+	token.polarization = (std::string(endpoint.name())=="-" ?
+		knowrob::EventToken::EVENT_BEGIN :
+		knowrob::EventToken::EVENT_END);
+	token.event_type = std::string((char*)endpoint[1]);
+	PlTail participants(term[3]);
+	PlTerm participant;
+	while(participants.next(participant)) {
+		token.participants.push_back(std::string((char*)participant));
+	}
+}
+
+static PlTerm token_term(const knowrob::EventToken &token)
+{
+	// endpoint term: -(Type) for polarization 0, else +(Type)
+	PlTerm endpoint = PlCompound(
+		token.polarization==0 ? "-" : "+",
+		PlTermv(PlAtom(token.event_type.c_str())));
+	PlTerm participants;
+	PlTail participants_tail(participants);
+	for(std::vector<std::string>::const_iterator
+			it=token.participants.begin(); it!=token.participants.end(); ++it)
+	{
+		participants_tail.append(PlAtom(it->c_str()));
+	}
+	participants_tail.close();
+	return PlCompound("tok", PlTermv(PlTerm((double)token.timestamp), endpoint, participants));
+}
+
+// parser_token_subscribe(Parser,Topic,Lateness)
+PREDICATE(parser_token_subscribe, 3) {
+	std::string parser((char*)PL_A1);
+	std::string topic((char*)PL_A2);
+	double lateness = (double)PL_A3;
+	std::lock_guard<std::mutex> lock(token_buffers_mtx);
+	if(token_buffers.find(parser) != token_buffers.end()) {
+		return false;
+	}
+	token_buffers[parser] = std::make_shared<TokenBuffer>(node, topic, lateness);
+	return true;
+}
+
+// parser_token_push(Parser,Token)
+PREDICATE(parser_token_push, 2) {
+	std::string parser((char*)PL_A1);
+	std::shared_ptr<TokenBuffer> buffer = get_token_buffer(parser);
+	if(!buffer) {
+		return false;
+	}
+	knowrob::EventToken token;
+	read_token(PL_A2, token);
+	buffer->push(token);
+	return true;
+}
+
+// parser_token_unsubscribe(Parser)
+PREDICATE(parser_token_unsubscribe, 1) {
+	std::string parser((char*)PL_A1);
+	std::shared_ptr<TokenBuffer> buffer = get_token_buffer(parser);
+	if(!buffer) {
+		return false;
+	}
+	// remaining tokens can still be popped until the buffer is empty
+	buffer->close();
+	return true;
+}
+
+// parser_token_pop(Parser,Timeout,Tokens)
+PREDICATE(parser_token_pop, 3) {
+	std::string parser((char*)PL_A1);
+	double timeout = (double)PL_A2;
+	std::shared_ptr<TokenBuffer> buffer = get_token_buffer(parser);
+	if(!buffer) {
+		return false;
+	}
+	std::vector<knowrob::EventToken> batch;
+	if(!buffer->pop(batch, timeout)) {
+		// the buffer was closed and is empty.
+		// it is deleted once the last caller released it.
+		std::lock_guard<std::mutex> lock(token_buffers_mtx);
+		std::map<std::string,std::shared_ptr<TokenBuffer>>::iterator it = token_buffers.find(parser);
+		if(it != token_buffers.end() && it->second == buffer) {
+			token_buffers.erase(it);
+		}
+		return false;
+	}
+	PlTerm tokens;
+	PlTail tokens_tail(tokens);
+	for(std::vector<knowrob::EventToken>::const_iterator
+			it=batch.begin(); it!=batch.end(); ++it)
+	{
+		tokens_tail.append(token_term(*it));
+	}
+	tokens_tail.close();
+	return PL_A3 = tokens;
+}
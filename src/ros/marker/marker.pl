@@ -104,22 +104,33 @@ show_markers(Timepoint) :-
 	%	kb_call(is_physical_object(PO)),
 	%	show_marker(PO, PO, [scope(Scope)])
 	%).
+	object_messages(MessageList),
+	publish_messages(MessageList).
+
+%%
+% Republish all object markers.
+%
+republish :-
+	get_time(Now),
+	show_markers(Now).
+
+%%
+% Marker messages of all objects.
+%
+object_messages(MessageList) :-
 	findall(Msg,
 		(	object_marker(_Obj,ID,Data),
 			marker_message_new(ID,Data,Msg)
 		),
 		MessageList
-	),
-	(	MessageList=[] -> true
-	;	marker_array_publish(MessageList)
 	).
 
 %%
-% Republish all object markers.
+% Publish a list of marker messages at once.
 %
-republish :-
-	get_time(Now),
-	show_markers(Now).
+publish_messages([]) :- !.
+publish_messages(MessageList) :-
+	marker_array_publish(MessageList).
 
 
 %% hide_marker(+MarkerID) is det.
@@ -0,0 +1,313 @@
+#include <knowrob/ros/tf/episode_cache.h>
+#include <knowrob/db/mongo/MongoInterface.h>
+#include <ros/ros.h>
+#include <cmath>
+#include <cstring>
+
+static void read_transform(const bson_t *doc, geometry_msgs::TransformStamped &ts)
+{
+	bson_iter_t iter;
+	if(!bson_iter_init(&iter,doc)) {
+		return;
+	}
+
+	while(bson_iter_next(&iter)) {
+		const char *key = bson_iter_key(&iter);
+
+		if(strcmp("child_frame_id",key)==0) {
+			ts.child_frame_id = std::string(bson_iter_utf8(&iter,NULL));
+		}
+
+		else if(strcmp("header",key)==0) {
+			bson_iter_t header_iter;
+			bson_iter_recurse(&iter, &header_iter);
+			while(bson_iter_next(&header_iter)) {
+				const char *header_key = bson_iter_key(&header_iter);
+				if(strcmp("seq",header_key)==0) {
+					ts.header.seq = bson_iter_int32(&header_iter);
+				}
+				else if(strcmp("frame_id",header_key)==0) {
+					ts.header.frame_id = std::string(bson_iter_utf8(&header_iter,NULL));
+				}
+				else if(strcmp("stamp",header_key)==0) {
+					int64_t msec_since_epoch = bson_iter_date_time(&header_iter);
+					ts.header.stamp.sec  = msec_since_epoch / 1000;
+					ts.header.stamp.nsec = (msec_since_epoch % 1000) * 1000 * 1000;
+				}
+			}
+		}
+
+		else if(strcmp("transform",key)==0) {
+			bson_iter_t transform_iter;
+			bson_iter_recurse(&iter, &transform_iter);
+			while(bson_iter_next(&transform_iter)) {
+				const char *transform_key = bson_iter_key(&transform_iter);
+				//
+				bson_iter_t iter1;
+				bson_iter_recurse(&transform_iter, &iter1);
+
+				if(strcmp("translation",transform_key)==0) {
+					while(bson_iter_next(&iter1)) {
+						const char *key1 = bson_iter_key(&iter1);
+						if(strcmp("x",key1)==0) {
+							ts.transform.translation.x = bson_iter_double(&iter1);
+						}
+						else if(strcmp("y",key1)==0) {
+							ts.transform.translation.y = bson_iter_double(&iter1);
+						}
+						else if(strcmp("z",key1)==0) {
+							ts.transform.translation.z = bson_iter_double(&iter1);
+						}
+					}
+				}
+
+				else if(strcmp("rotation",transform_key)==0) {
+					while(bson_iter_next(&iter1)) {
+						const char *key1 = bson_iter_key(&iter1);
+						if(strcmp("x",key1)==0) {
+							ts.transform.rotation.x = bson_iter_double(&iter1);
+						}
+						else if(strcmp("y",key1)==0) {
+							ts.transform.rotation.y = bson_iter_double(&iter1);
+						}
+						else if(strcmp("z",key1)==0) {
+							ts.transform.rotation.z = bson_iter_double(&iter1);
+						}
+						else if(strcmp("w",key1)==0) {
+							ts.transform.rotation.w = bson_iter_double(&iter1);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+static std::string collection_key(const std::string &db_name,
+		const std::string &db_collection)
+{
+	return db_name + "/" + db_collection + "/";
+}
+
+static std::string segment_key(const std::string &db_name,
+		const std::string &db_collection, long index)
+{
+	return collection_key(db_name,db_collection) + std::to_string(index);
+}
+
+TFEpisodeCache::TFEpisodeCache(double segment_duration, unsigned int num_recent) :
+		segment_duration_(segment_duration),
+		num_recent_(num_recent),
+		num_decoded_(0)
+{
+}
+
+TFEpisodeCache& TFEpisodeCache::get()
+{
+	static TFEpisodeCache cache;
+	return cache;
+}
+
+long TFEpisodeCache::segment_index(double time) const
+{
+	return (long)std::floor(time / segment_duration_);
+}
+
+std::shared_ptr<TFEpisodeCache::Slot> TFEpisodeCache::get_slot(const std::string &key)
+{
+	std::lock_guard<std::mutex> scoped_lock(lock_);
+	// remove slots of segments that are not used anymore
+	for(auto it=slots_.begin(); it!=slots_.end();) {
+		if(it->second.use_count()==1 && it->second->segment.expired()) {
+			it = slots_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+	std::shared_ptr<Slot> &slot = slots_[key];
+	if(!slot) {
+		slot = std::make_shared<Slot>();
+	}
+	return slot;
+}
+
+void TFEpisodeCache::keep_recent(const std::shared_ptr<Slot> &slot, const TFSegmentPtr &segment)
+{
+	std::lock_guard<std::mutex> scoped_lock(lock_);
+	// the collection was invalidated while the segment was decoded
+	if(slot->invalidated) return;
+	recent_.remove_if([&segment](const std::pair<std::shared_ptr<Slot>, TFSegmentPtr> &entry) {
+		return entry.second == segment;
+	});
+	recent_.emplace_front(slot, segment);
+	while(recent_.size() > num_recent_) {
+		recent_.pop_back();
+	}
+}
+
+void TFEpisodeCache::invalidate(const std::string &db_name, const std::string &db_collection)
+{
+	const std::string prefix = collection_key(db_name,db_collection);
+	std::lock_guard<std::mutex> scoped_lock(lock_);
+	for(auto it=slots_.begin(); it!=slots_.end();) {
+		if(it->first.compare(0, prefix.size(), prefix)==0) {
+			it->second->invalidated = true;
+			it = slots_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+	recent_.remove_if([](const std::pair<std::shared_ptr<Slot>, TFSegmentPtr> &entry) {
+		return entry.first->invalidated;
+	});
+}
+
+TFSegmentPtr TFEpisodeCache::get_segment(
+		const std::string &db_name, const std::string &db_collection, long index)
+{
+	std::shared_ptr<Slot> slot = get_slot(segment_key(db_name,db_collection,index));
+	TFSegmentPtr segment;
+	{
+		// other sessions requesting the same segment wait here
+		// until it was decoded
+		std::lock_guard<std::mutex> slot_lock(slot->lock);
+		segment = slot->segment.lock();
+		if(!segment) {
+			std::shared_ptr<TFSegment> loaded = std::make_shared<TFSegment>();
+			loaded->index = index;
+			loaded->begin = index*segment_duration_;
+			loaded->end = (index+1)*segment_duration_;
+			if(!load_segment(db_name, db_collection, *loaded)) {
+				// a failed segment is not published such that
+				// the next request decodes it again
+				return TFSegmentPtr();
+			}
+			num_decoded_ += 1;
+			segment = loaded;
+			// transforms may still be written into the segment that
+			// includes the current time, so it is not cached
+			if(segment->end > ros::Time::now().toSec()) {
+				return segment;
+			}
+			slot->segment = segment;
+		}
+	}
+	keep_recent(slot, segment);
+	return segment;
+}
+
+bool TFEpisodeCache::load_segment(
+		const std::string &db_name, const std::string &db_collection, TFSegment &segment)
+{
+	// the initial transforms can be computed from the previous segment
+	// without another query in case it is still cached
+	TFSegmentPtr previous;
+	{
+		std::lock_guard<std::mutex> scoped_lock(lock_);
+		auto it = slots_.find(segment_key(db_name,db_collection,segment.index-1));
+		if(it != slots_.end()) {
+			previous = it->second->segment.lock();
+		}
+	}
+	if(previous) {
+		std::map<std::string, const geometry_msgs::TransformStamped*> latest;
+		for(auto &ts : previous->initial) latest[ts.child_frame_id] = &ts;
+		for(auto &ts : previous->transforms) latest[ts.child_frame_id] = &ts;
+		segment.initial.reserve(latest.size());
+		for(auto &entry : latest) segment.initial.push_back(*entry.second);
+	}
+	else if(!load_initial(db_name.c_str(), db_collection.c_str(), segment)) {
+		return false;
+	}
+	return load_transforms(db_name.c_str(), db_collection.c_str(), segment);
+}
+
+bool TFEpisodeCache::load_initial(
+		const char *db_name, const char *db_collection, TFSegment &segment)
+{
+	int64_t mng_time = (int64_t)(1000.0*segment.begin);
+	bson_t *opts = BCON_NEW("allowDiskUse", BCON_BOOL(true));
+	// lookup latest transform of each frame before the segment.
+	// the sort order is chosen such that the index on
+	// (child_frame_id, header.stamp) can be used.
+	bson_t *pipeline = BCON_NEW ("pipeline", "[",
+		"{", "$match", "{", "header.stamp", "{", "$lt", BCON_DATE_TIME(mng_time), "}", "}", "}",
+		"{", "$sort", "{",
+			"child_frame_id", BCON_INT32(-1),
+			"header.stamp",   BCON_INT32(-1),
+		"}", "}",
+		"{", "$group", "{",
+			"_id", BCON_UTF8("$child_frame_id"),
+			"doc", "{", "$first", BCON_UTF8("$$ROOT"), "}",
+		"}", "}",
+		"{", "$replaceRoot", "{", "newRoot", BCON_UTF8("$doc"), "}", "}",
+	"]");
+	MongoCollection *collection = MongoInterface::get_collection(db_name, db_collection);
+	collection->appendSession(opts);
+	mongoc_cursor_t *cursor = mongoc_collection_aggregate(
+		(*collection)(), MONGOC_QUERY_NONE, pipeline, opts, NULL);
+	bool success = false;
+	if(cursor!=NULL) {
+		const bson_t *doc;
+		while(mongoc_cursor_next(cursor,&doc)) {
+			segment.initial.emplace_back();
+			read_transform(doc, segment.initial.back());
+		}
+		bson_error_t cursor_error;
+		if (mongoc_cursor_error(cursor, &cursor_error)) {
+			ROS_ERROR("[TFEpisodeCache] mongo cursor error: %s.", cursor_error.message);
+		}
+		else {
+			success = true;
+		}
+		mongoc_cursor_destroy(cursor);
+	}
+	// cleanup
+	bson_destroy(pipeline);
+	bson_destroy(opts);
+	delete collection;
+	return success;
+}
+
+bool TFEpisodeCache::load_transforms(
+		const char *db_name, const char *db_collection, TFSegment &segment)
+{
+	// ascending order
+	bson_t *opts = BCON_NEW(
+		"sort", "{", "header.stamp", BCON_INT32 (1), "}"
+	);
+	// filter documents outside of the segment
+	bson_t *filter = BCON_NEW(
+		"header.stamp", "{",
+			"$gte", BCON_DATE_TIME((int64_t)(1000.0*segment.begin)),
+			"$lt",  BCON_DATE_TIME((int64_t)(1000.0*segment.end)),
+		"}"
+	);
+	MongoCollection *collection = MongoInterface::get_collection(db_name, db_collection);
+	collection->appendSession(opts);
+	mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
+		(*collection)(), filter, opts, NULL /* read_prefs */ );
+	bool success = false;
+	if(cursor!=NULL) {
+		const bson_t *doc;
+		while(mongoc_cursor_next(cursor,&doc)) {
+			segment.transforms.emplace_back();
+			read_transform(doc, segment.transforms.back());
+		}
+		bson_error_t cursor_error;
+		if (mongoc_cursor_error(cursor, &cursor_error)) {
+			ROS_ERROR("[TFEpisodeCache] mongo cursor error: %s.", cursor_error.message);
+		}
+		else {
+			success = true;
+		}
+		mongoc_cursor_destroy(cursor);
+	}
+	// cleanup
+	bson_destroy(filter);
+	bson_destroy(opts);
+	delete collection;
+	return success;
+}
@@ -24,6 +24,13 @@ TFLogger::~TFLogger()
 
 void TFLogger::store_document(bson_t *doc)
 {
+	// write-behind in case a journal is used
+	std::shared_ptr<MongoJournal> journal = MongoInterface::get().journal();
+	if(journal && journal->append(db_name_.c_str(),topic_.c_str(),
+			MongoJournal::OP_INSERT,doc))
+	{
+		return;
+	}
 	bson_error_t err;
 	MongoCollection *collection = MongoInterface::get_collection(db_name_.c_str(),topic_.c_str());
 	if(!mongoc_collection_insert(
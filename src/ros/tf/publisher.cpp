@@ -3,11 +3,13 @@
 
 // TODO: handle static object transforms (e.g. for features, srdl components also have static transforms relative to base link)
 
-TFPublisher::TFPublisher(TFMemory &memory, double frequency, bool clear_after_publish) :
+TFPublisher::TFPublisher(TFMemory &memory, double frequency, bool clear_after_publish,
+		const std::string &topic) :
 		memory_(memory),
 		is_running_(true),
 		clear_after_publish_(clear_after_publish),
 		frequency_(frequency),
+		topic_(topic),
 	    thread_(&TFPublisher::loop, this)
 {
 }
@@ -20,12 +22,23 @@ TFPublisher::~TFPublisher()
 
 void TFPublisher::loop()
 {
-	tf2_ros::TransformBroadcaster tf_broadcaster;
 	ros::Rate r(frequency_);
-	while(ros::ok()) {
-		publishTransforms(tf_broadcaster);
-		r.sleep();
-		if(!is_running_) break;
+	if(topic_.empty()) {
+		tf2_ros::TransformBroadcaster tf_broadcaster;
+		while(ros::ok()) {
+			publishTransforms(tf_broadcaster);
+			r.sleep();
+			if(!is_running_) break;
+		}
+	}
+	else {
+		ros::NodeHandle node;
+		ros::Publisher publisher(node.advertise<tf::tfMessage>(topic_,10));
+		while(ros::ok()) {
+			publishTransforms(publisher);
+			r.sleep();
+			if(!is_running_) break;
+		}
 	}
 }
 
@@ -35,3 +48,12 @@ void TFPublisher::publishTransforms(tf2_ros::TransformBroadcaster &tf_broadcaste
 	memory_.loadTF(tf_msg, clear_after_publish_);
 	tf_broadcaster.sendTransform(tf_msg.transforms);
 }
+
+void TFPublisher::publishTransforms(ros::Publisher &publisher)
+{
+	tf::tfMessage tf_msg;
+	memory_.loadTF(tf_msg, clear_after_publish_);
+	if(!tf_msg.transforms.empty()) {
+		publisher.publish(tf_msg);
+	}
+}
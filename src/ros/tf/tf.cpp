@@ -1,8 +1,13 @@
 
+#include <map>
+#include <memory>
+#include <mutex>
+
 #include <knowrob/ros/tf/memory.h>
 #include <knowrob/ros/tf/logger.h>
 #include <knowrob/ros/tf/publisher.h>
 #include <knowrob/ros/tf/republisher.h>
+#include <knowrob/ros/tf/episode_cache.h>
 
 static ros::NodeHandle node;
 static TFMemory memory;
@@ -15,9 +20,57 @@ double angular_threshold=0.001;
 double time_threshold=-1.0;
 std::string logger_db_name="roslog";
 
-TFRepublisher& get_republisher() {
-	static TFRepublisher republisher;
-	return republisher;
+// republisher sessions, the default session has the handle 0
+std::map<long, std::shared_ptr<TFRepublisher>> republisher_sessions;
+std::mutex republisher_sessions_mtx;
+long republisher_next_session=1;
+
+std::shared_ptr<TFRepublisher> get_republisher(long session=0) {
+	std::lock_guard<std::mutex> scoped_lock(republisher_sessions_mtx);
+	auto it = republisher_sessions.find(session);
+	if(it != republisher_sessions.end()) {
+		return it->second;
+	}
+	else if(session == 0) {
+		std::shared_ptr<TFRepublisher> republisher = std::make_shared<TFRepublisher>();
+		republisher_sessions[0] = republisher;
+		return republisher;
+	}
+	else {
+		throw PlException(PlCompound("tf_error",
+				PlCompound("no_such_session", PlTerm(session))));
+	}
+}
+
+// tf_republish_session_create(Namespace,Session)
+PREDICATE(tf_republish_session_create, 2) {
+	std::string ns((char*)PL_A1);
+	std::shared_ptr<TFRepublisher> republisher = std::make_shared<TFRepublisher>(10.0,ns);
+	long session;
+	{
+		std::lock_guard<std::mutex> scoped_lock(republisher_sessions_mtx);
+		session = republisher_next_session++;
+		republisher_sessions[session] = republisher;
+	}
+	PL_A2 = session;
+	return true;
+}
+
+// tf_republish_session_destroy(Session)
+PREDICATE(tf_republish_session_destroy, 1) {
+	long session = (long)PL_A1;
+	std::shared_ptr<TFRepublisher> republisher;
+	{
+		std::lock_guard<std::mutex> scoped_lock(republisher_sessions_mtx);
+		auto it = republisher_sessions.find(session);
+		if(session == 0 || it == republisher_sessions.end()) {
+			return false;
+		}
+		republisher = it->second;
+		republisher_sessions.erase(it);
+	}
+	// the threads of the session are joined when the last reference is released
+	return true;
 }
 
 // tf_republish_set_goal(DBName,CollectionName,Time0,Time1)
@@ -26,39 +79,97 @@ PREDICATE(tf_republish_set_goal, 4) {
 	std::string coll_name((char*)PL_A2);
 	double time_min = (double)PL_A3;
 	double time_max = (double)PL_A4;
-	get_republisher().set_db_name(db_name);
-	get_republisher().set_db_collection(coll_name);
-	get_republisher().set_goal(time_min,time_max);
+	std::shared_ptr<TFRepublisher> republisher = get_republisher();
+	republisher->set_db_name(db_name);
+	republisher->set_db_collection(coll_name);
+	republisher->set_goal(time_min,time_max);
+	return true;
+}
+
+// tf_republish_set_goal(Session,DBName,CollectionName,Time0,Time1)
+PREDICATE(tf_republish_set_goal, 5) {
+	std::string db_name((char*)PL_A2);
+	std::string coll_name((char*)PL_A3);
+	double time_min = (double)PL_A4;
+	double time_max = (double)PL_A5;
+	std::shared_ptr<TFRepublisher> republisher = get_republisher((long)PL_A1);
+	republisher->set_db_name(db_name);
+	republisher->set_db_collection(coll_name);
+	republisher->set_goal(time_min,time_max);
 	return true;
 }
 
 PREDICATE(tf_republish_set_time, 1) {
 	double time = (double)PL_A1;
-	get_republisher().set_now(time);
+	get_republisher()->set_now(time);
+	return true;
+}
+
+PREDICATE(tf_republish_set_time, 2) {
+	double time = (double)PL_A2;
+	get_republisher((long)PL_A1)->set_now(time);
 	return true;
 }
 
 PREDICATE(tf_republish_set_progress, 1) {
 	double percent = (double)PL_A1;
-	get_republisher().set_progress(percent);
+	get_republisher()->set_progress(percent);
+	return true;
+}
+
+PREDICATE(tf_republish_set_progress, 2) {
+	double percent = (double)PL_A2;
+	get_republisher((long)PL_A1)->set_progress(percent);
 	return true;
 }
 
 PREDICATE(tf_republish_clear, 0) {
-	get_republisher().clear();
+	get_republisher()->clear();
+	return true;
+}
+
+PREDICATE(tf_republish_clear, 1) {
+	get_republisher((long)PL_A1)->clear();
 	return true;
 }
 
 // tf_republish_set_loop(RealtimeFactor)
 PREDICATE(tf_republish_set_loop, 1) {
-	get_republisher().set_loop((int)PL_A1);
+	get_republisher()->set_loop((int)PL_A1);
+	return true;
+}
+
+// tf_republish_set_loop(Session,RealtimeFactor)
+PREDICATE(tf_republish_set_loop, 2) {
+	get_republisher((long)PL_A1)->set_loop((int)PL_A2);
 	return true;
 }
 
 // tf_republish_set_realtime_factor(RealtimeFactor)
 PREDICATE(tf_republish_set_realtime_factor, 1) {
 	double realtime_factor = (double)PL_A1;
-	get_republisher().set_realtime_factor(realtime_factor);
+	get_republisher()->set_realtime_factor(realtime_factor);
+	return true;
+}
+
+// tf_republish_set_realtime_factor(Session,RealtimeFactor)
+PREDICATE(tf_republish_set_realtime_factor, 2) {
+	double realtime_factor = (double)PL_A2;
+	get_republisher((long)PL_A1)->set_realtime_factor(realtime_factor);
+	return true;
+}
+
+// tf_republish_num_decoded(Count)
+PREDICATE(tf_republish_num_decoded, 1) {
+	PL_A1 = (long)TFEpisodeCache::get().num_decoded();
+	return true;
+}
+
+// tf_mng_invalidate(DBName,CollectionName)
+PREDICATE(tf_mng_invalidate, 2) {
+	std::string db_name((char*)PL_A1);
+	std::string db_collection((char*)PL_A2);
+	TFEpisodeCache::get().invalidate(db_name, db_collection);
 	return true;
 }
 
@@ -138,7 +249,39 @@ PREDICATE(tf_mem_set_pose, 3) {
 // tf_republish_set_pose(ObjFrame,PoseData)
 PREDICATE(tf_republish_set_pose, 2) {
 	std::string frame((char*)PL_A1);
-	get_republisher().memory().set_pose_term(frame,PL_A2,-1.0);
+	get_republisher()->memory().set_pose_term(frame,PL_A2,-1.0);
+	return true;
+}
+
+// tf_republish_set_pose(Session,ObjFrame,PoseData)
+PREDICATE(tf_republish_set_pose, 3) {
+	std::string frame((char*)PL_A2);
+	get_republisher((long)PL_A1)->memory().set_pose_term(frame,PL_A3,-1.0);
+	return true;
+}
+
+static void republish_set_poses(TFRepublisher &republisher, PlTerm poses) {
+	PlTail list(poses);
+	PlTerm entry;
+	while(list.next(entry)) {
+		PlTail entry_list(entry);
+		PlTerm frame_term, pose_term;
+		entry_list.next(frame_term);
+		entry_list.next(pose_term);
+		std::string frame((char*)frame_term);
+		republisher.memory().set_pose_term(frame,pose_term,-1.0);
+	}
+}
+
+// tf_republish_set_poses([[ObjFrame,PoseData], ...])
+PREDICATE(tf_republish_set_poses, 1) {
+	republish_set_poses(*get_republisher(), PL_A1);
+	return true;
+}
+
+// tf_republish_set_poses(Session,[[ObjFrame,PoseData], ...])
+PREDICATE(tf_republish_set_poses, 2) {
+	republish_set_poses(*get_republisher((long)PL_A1), PL_A2);
 	return true;
 }
 
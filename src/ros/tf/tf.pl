@@ -5,14 +5,29 @@
 	  tf_mem_get_pose/3,
   	  tf_mem_clear/0,
 	  tf_republish_set_pose/2,
+	  tf_republish_set_pose/3,
+	  tf_republish_set_poses/1,
+	  tf_republish_set_poses/2,
 	  tf_republish_set_goal/2,
+	  tf_republish_set_goal/3,
 	  tf_republish_set_time/1,
+	  tf_republish_set_time/2,
 	  tf_republish_set_progress/1,
+	  tf_republish_set_progress/2,
 	  tf_republish_set_loop/1,
+	  tf_republish_set_loop/2,
 	  tf_republish_set_realtime_factor/1,
+	  tf_republish_set_realtime_factor/2,
 	  tf_republish_clear/0,
+	  tf_republish_clear/1,
+	  tf_republish_session_create/2,
+	  tf_republish_session_destroy/1,
+	  tf_republish_num_decoded/1,
 	  tf_logger_enable/0,
-	  tf_logger_disable/0
+	  tf_logger_disable/0,
+	  tf_replication_start/0,
+	  tf_replication_stop/0,
+	  tf_replication_lag/1
 	]).
 
 :- use_foreign_library('libtf_knowrob.so').
@@ -32,13 +47,18 @@
 :- use_module(library('lang/computable'),
 	[ add_computable_predicate/2 ]).
 :- use_module('tf_mongo',
-	[ tf_mng_lookup/6,
-	  tf_mng_lookup_all/2
-	]).
+	[ tf_mng_lookup/6 ]).
 
 % define some settings
 :- setting(use_logger, boolean, true,
 	'Toggle whether TF messages are logged into the mongo DB.').
+:- setting(use_replication, boolean, false,
+	'Toggle whether the TF memory is kept in sync with transforms written into the mongo DB by another process.').
+
+% the change stream used for TF memory replication
+:- dynamic replication_watcher/1.
+% timestamp of the latest transform received through replication
+:- dynamic replication_stamp/1.
 
 %%
 :-	mng_db_name(DB),
@@ -58,6 +78,16 @@
 % within the time interval provided.
 %
 tf_republish_set_goal(Time_min, Time_max) :-
+	tf_republish_set_goal(0, Time_min, Time_max).
+
+%% tf_republish_set_goal(+Session, +TimeStart, +TimeEnd) is det.
+%
+% Same as tf_republish_set_goal/2 for a republisher session
+% created by tf_republish_session_create/2.
+% The session starts with the latest pose of each frame
+% before TimeStart.
+%
+tf_republish_set_goal(Session, Time_min, Time_max) :-
 	tf_mongo:tf_db(DBName, CollectionName),
 	( number(Time_min)
 	->	Min is Time_min
@@ -67,26 +97,55 @@ tf_republish_set_goal(Time_min, Time_max) :-
 	->	Max is Time_max
 	;	atom_number(Time_max,Max)
 	),
-	% initialize poses to last pose before Min.
-	% TODO: might be faster to do this in C++ code of republisher.
-	tf_republish_load_transforms(Min),
 	% start republishing range [Min,Max]
-	tf_republish_set_goal(DBName, CollectionName, Min, Max).
+	tf_republish_set_goal(Session, DBName, CollectionName, Min, Max).
+
+%% tf_republish_session_create(+Namespace, -Session) is det.
+%
+% Create a new TF republisher session.
+% Each session has its own time window, clock, and realtime factor,
+% and publishes transforms on the topic `Namespace/tf`.
+% Sessions that replay the same episode share the data
+% decoded from the database, i.e. each segment of an episode is
+% decoded only once no matter how many sessions replay it.
+% The default session used by the predicates without a
+% session argument has the handle 0.
+%
+% @param Namespace the topic namespace of the session.
+% @param Session the session handle.
+%
+
+%% tf_republish_session_destroy(+Session) is semidet.
+%
+% Stop a TF republisher session.
+% Fails for the default session, and for unknown sessions.
+%
+% @param Session the session handle.
+%
 
 %%
-tf_republish_load_transforms(Time) :-
-	tf_mng_lookup_all(Transforms, Time),
-	forall(
+% Map transforms [Ref,Frame,Pos,Rot] to the
+% argument of tf_republish_set_poses/1.
+%
+tf_republish_poses(Transforms, Poses) :-
+	findall([Frame,[Ref,Pos,Rot]],
 	    (   member([Ref,Frame,Pos,Rot],Transforms),
 	        % FIXME avoid this elsewhere
 	        Ref \= Frame,
 	        \+ atom_concat('/',Ref,Frame),
 	        \+ atom_concat('/',Frame,Ref)
 	    ),
-		tf_republish_set_pose(Frame,[Ref,Pos,Rot])
+		Poses
 	).
 
+%% tf_republish_num_decoded(-Count) is det.
+%
+% The number of episode segments that were decoded
+% by all republisher sessions since startup.
+%
+
 %% tf_republish_set_progress(+Progress) is det.
+%% tf_republish_set_progress(+Session, +Progress) is det.
 %
 % Advance republisher to some point in time.
 % Progress is a number between zero and one used
@@ -94,28 +153,40 @@ tf_republish_load_transforms(Time) :-
 %
 
 %% tf_republish_clear is det.
+%% tf_republish_clear(+Session) is det.
 %
 % Reset the TF republisher.
 %
 
 %% tf_republish_set_loop(+Loop) is det.
+%% tf_republish_set_loop(+Session, +Loop) is det.
 %
 % Toggle looping from end time to start time.
 %
 
 %% tf_republish_set_time(+Time) is det.
+%% tf_republish_set_time(+Session, +Time) is det.
 %
 % Set the current time of the TF republisher.
 %
 
 %% tf_republish_set_pose(+ObjFrame, +PoseData) is det.
+%% tf_republish_set_pose(+Session, +ObjFrame, +PoseData) is det.
 %
 % Update the transform of a frame in the TF republisher.
 % This is useful to initialize transforms from data not within
 % the range of the republisher.
 %
 
+%% tf_republish_set_poses(+Poses) is det.
+%% tf_republish_set_poses(+Session, +Poses) is det.
+%
+% Same as tf_republish_set_pose/2 for a list of
+% terms [ObjFrame,PoseData] in a single call.
+%
+
 %% tf_republish_set_realtime_factor(+Factor) is det.
+%% tf_republish_set_realtime_factor(+Session, +Factor) is det.
 %
 % Change the realtime factor.
 % Default is 1.0, i.e. realtime republishing.
@@ -149,6 +220,82 @@ tf_republish_load_transforms(Time) :-
 % Read the transform of a frame from local memory.
 %
 
+%%%%%%%%%%%%%%%%%%%%%%%
+%%%%%%%%% TF REPLICATION
+%%%%%%%%%%%%%%%%%%%%%%%
+
+%% tf_replication_start is det.
+%
+% Keep the TF memory in sync with transforms that are written
+% into the mongo DB, e.g. by the TF logger of another KnowRob instance.
+% This is done through a change stream on the TF collection
+% such that this process does not need to subscribe to TF messages.
+% The memory is initialized with the latest transform of each frame.
+% Replication is delayed by the polling rate of the change stream.
+%
+tf_replication_start :-
+	replication_watcher(_),
+	!.
+
+tf_replication_start :-
+	tf_mongo:tf_db(DB, Coll),
+	% start watching before the memory is initialized such that no
+	% transform is missed. older transforms are ignored by the memory.
+	mng_watch(DB, Coll,
+		'tf:tf_replication_event',
+		[pipeline, array([
+			['$match', ['operationType', ['$in',
+				array([string(insert), string(replace)])
+			]]]
+		])],
+		WatcherID),
+	assertz(replication_watcher(WatcherID)),
+	forall(
+		tf_mongo:tf_mng_lookup_latest(_, Frame, Stamp, PoseData),
+		tf_mem_set_pose(Frame, PoseData, Stamp)
+	).
+
+%% tf_replication_stop is det.
+%
+% Stop the TF memory replication.
+%
+tf_replication_stop :-
+	forall(
+		retract(replication_watcher(WatcherID)),
+		mng_unwatch(WatcherID)
+	),
+	retractall(replication_stamp(_)).
+
+%% tf_replication_lag(-Lag) is semidet.
+%
+% The time in seconds passed since the timestamp of the
+% latest transform received through replication.
+% Fails if no transform was received yet.
+%
+tf_replication_lag(Lag) :-
+	replication_stamp(Stamp),
+	get_time(Now),
+	Lag is Now - Stamp.
+
+%%
+% Called for each document written into the TF collection.
+%
+tf_replication_event(_WatcherID, Event) :-
+	dict_pairs(Dict, _, Event),
+	get_dict(fullDocument, Dict, Pairs),
+	dict_pairs(Doc, _, Pairs),
+	tf_mongo:tf_mng_doc_pose(Doc, Frame, Stamp, PoseData),
+	tf_mem_set_pose(Frame, PoseData, Stamp),
+	(	replication_stamp(Last), Last >= Stamp
+	->	true
+	;	retractall(replication_stamp(_)),
+		assertz(replication_stamp(Stamp))
+	).
+
+:- setting(tf:use_replication, true)
+   ->	tf_replication_start
+   ;	true.
+
 % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % %
 % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % %
 % % % % % is_at
@@ -70,6 +70,14 @@ test_lookup(Frame,Stamp,Expected) :-
 test_lookup_fails(Frame,Stamp) :-
 	assert_false(tf:tf_mng_lookup(Frame,Stamp,Stamp,_,_,_)).
 
+test_wait_for_pose(Frame,_) :-
+	tf_mem_get_pose(Frame,_,_), !.
+test_wait_for_pose(_,0) :- !.
+test_wait_for_pose(Frame,Count) :-
+	sleep(0.1),
+	Count0 is Count - 1,
+	test_wait_for_pose(Frame,Count0).
+
 test_is_unlocalized(Object,Stamp) :-
 	time_scope(=<(Stamp), >=(Stamp), QScope),
 	assert_false(tf:tf_get_pose(Object,_,QScope,_)).
@@ -116,6 +124,25 @@ test('tf_trajectory') :-
 	test_trajectory(test:'Fred',Stamp1,Stamp2,
 		[Stamp1-Pose1, Stamp2-Pose2]).
 
+test('tf_mng_pose_at') :-
+	test_pose_fred0(_,Stamp0),
+	test_pose_fred1(_,Stamp1),
+	test_pose_fred2(Pose2,Stamp2),
+	Stamp01 is 0.5*(Stamp0 + Stamp1),
+	Future is Stamp2 + 1.0,
+	Past is Stamp0 - 1.0,
+	assert_true(tf_mng_pose_at('Fred',Stamp01,_)),
+	(	tf_mng_pose_at('Fred',Stamp01,[Ref,[X,Y,Z],_])
+	->	assert_equals(Ref,world),
+		assert_true(abs(X - 1.5) < 1.0e-6),
+		assert_true(abs(Y - 0.4) < 1.0e-6),
+		assert_true(abs(Z - 2.32) < 1.0e-6)
+	;	true
+	),
+	assert_true(tf_mng_pose_at('Fred',Future,Pose2)),
+	assert_false(tf_mng_pose_at('Fred',Past,_)),
+	assert_true(tf_mng_poses_at(['Fred','NotAFrame'],Stamp01,[[world,'Fred',_,_]])).
+
 test('tf_transform_pose') :-
 	test_pose_alex1(Pose1,Stamp1),
 	test_set_pose(test:'Alex',Pose1,Stamp1),
@@ -123,6 +150,25 @@ test('tf_transform_pose') :-
 	test_transform_pose(test:'Alex',Stamp1,[world,[2.0,1.4,2.32],_]),
 	test_transform_pose(test:'Fred',Stamp1,['Alex',_,_]).
 
+test('tf_republish_session') :-
+	test_pose_fred0(_,Stamp0),
+	test_pose_fred2(_,Stamp2),
+	assert_true(tf_republish_session_create(test_session,Session)),
+	assert_true(tf_republish_set_goal(Session,Stamp0,Stamp2)),
+	assert_true(tf_republish_set_progress(Session,0.5)),
+	assert_true(tf_republish_session_destroy(Session)),
+	assert_false(tf_republish_session_destroy(Session)),
+	assert_false(tf_republish_session_destroy(0)).
+
+test('tf_replication') :-
+	test_pose_fred2([Ref,Pos,Rot],Stamp),
+	tf_replication_start,
+	tf_mng_store('Replicated',[Ref,Pos,Rot],Stamp),
+	% wait until the change stream has delivered the transform
+	test_wait_for_pose('Replicated',20),
+	tf_replication_stop,
+	assert_true(tf_mem_get_pose('Replicated',[Ref,Pos,Rot],_)).
+
 %test('tf_is_at') :-
 %	test_pose_fred0(Pose0,Stamp0),
 %	assert_true(kb_call(
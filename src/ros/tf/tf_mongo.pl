@@ -3,6 +3,8 @@
 	  tf_mng_lookup/6,
 	  tf_mng_lookup_all/1,
 	  tf_mng_lookup_all/2,
+	  tf_mng_pose_at/3,
+	  tf_mng_poses_at/3,
 	  tf_mng_trajectory/4,
 	  tf_mng_drop/0,
 	  tf_mng_tree/2,
@@ -15,7 +17,8 @@
 	[ rdf_split_url/3 ]).
 :- use_module(library('utility/algebra'),
 	[ transform_between/3,
-	  transform_multiply/3
+	  transform_multiply/3,
+	  transform_interpolate/4
 	]).
 :- use_module(library('db/mongo/client')).
 
@@ -72,10 +75,13 @@ tf_db(DB, Name) :-
 %% tf_mng_drop is det.
 %
 % Drops all documents in the TF database collection.
+% Episode segments of the collection that were cached for
+% republishing are removed too.
 %
 tf_mng_drop :-
 	tf_db(DB, Name),
-	mng_drop(DB,Name).
+	mng_drop(DB,Name),
+	tf_mng_invalidate(DB,Name).
 
 %% tf_mng_lookup(+ObjFrame, +QuerySince, +QueryUntil, -PoseData, -FactSince, -FactUntil) is nondet.
 %
@@ -147,6 +153,15 @@ tf_mng_lookup_all(Transforms) :-
 % Documents later than Stamp are ignored.
 %
 tf_mng_lookup_all(Transforms, Stamp) :-
+	findall([Ref,Frame,Pos,Rot],
+		tf_mng_lookup_latest(Stamp, Frame, _, [Ref,Pos,Rot]),
+		Transforms
+	).
+
+%%
+% Yields the latest transform of each frame together with its timestamp.
+%
+tf_mng_lookup_latest(Stamp, Frame, Time, PoseData) :-
 	tf_db(DB,Coll),
 	% first create lookup $match steps
 	findall(MatchStep,
@@ -185,14 +200,136 @@ tf_mng_lookup_all(Transforms, Stamp) :-
 	setup_call_cleanup(
 		mng_cursor_create(DB,Coll,Cursor),
 		(	mng_cursor_aggregate(Cursor,['pipeline',array(Pipeline)]),
-			findall([Ref,Frame,Pos,Rot],
+			findall(Frame-Time-PoseData,
+				(	mng_cursor_materialize(Cursor,Doc),
+					tf_mng_doc_pose(Doc,Frame,Time,PoseData)
+				),
+				Results
+			)
+		),
+		mng_cursor_destroy(Cursor)
+	),
+	member(Frame-Time-PoseData, Results).
+
+
+% % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % %
+% % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % % %
+% % % % % interpolated lookup
+
+
+%% tf_mng_pose_at(+Frame, +Stamp, -PoseData) is semidet.
+%
+% Retrieve the pose of a frame at some timepoint.
+% The pose is interpolated between the latest transform
+% before Stamp and the earliest transform after Stamp.
+% The latest transform is used in case there is no transform after Stamp,
+% or if the reference frame differs between the two transforms.
+% Fails if there is no transform before Stamp.
+%
+% @param Frame the frame name.
+% @param Stamp the timepoint.
+% @param PoseData a list [RefFrame,Position,Rotation].
+%
+tf_mng_pose_at(Frame, Stamp, [Ref,Pos,Rot]) :-
+	tf_mng_poses_at([Frame], Stamp, [[Ref,Frame,Pos,Rot]]).
+
+
+%% tf_mng_poses_at(+Frames, +Stamp, -Transforms) is det.
+%
+% Same as tf_mng_pose_at/3 for a list of frames.
+% The transforms are retrieved in a single aggregate query.
+% Transforms is a list of terms [RefFrame,Frame,Position,Rotation]
+% in the order of Frames, frames without a pose at Stamp are omitted.
+%
+% @param Frames list of frame names.
+% @param Stamp the timepoint.
+% @param Transforms list of transform terms.
+%
+tf_mng_poses_at([], _, []) :-
+	!.
+
+tf_mng_poses_at(Frames, Stamp, Transforms) :-
+	tf_db(DB,Coll),
+	tf_bracket_pipeline(Coll, Frames, Stamp, Pipeline),
+	setup_call_cleanup(
+		mng_cursor_create(DB,Coll,Cursor),
+		(	mng_cursor_aggregate(Cursor,['pipeline',array(Pipeline)]),
+			findall(Frame-Time-PoseData,
 				(	mng_cursor_materialize(Cursor,Doc),
-					tf_mng_doc_pose(Doc,Frame,_,[Ref,Pos,Rot])
+					tf_mng_doc_pose(Doc,Frame,Time,PoseData)
 				),
-				Transforms
+				Samples
 			)
 		),
 		mng_cursor_destroy(Cursor)
+	),
+	findall([Ref,Frame,Pos,Rot],
+		(	member(Frame, Frames),
+			tf_interpolate_samples(Frame, Stamp, Samples, [Ref,Pos,Rot])
+		),
+		Transforms
+	).
+
+%%
+% Yields the latest transform before and the earliest transform
+% after Stamp for each of the frames.
+% Each frame and direction is retrieved by a separate branch
+% that matches the frame name, and sorts and limits the samples such
+% that the (child_frame_id, header.stamp) index is used and at most
+% one document is read per branch.
+% The branches are concatenated with $unionWith.
+%
+tf_bracket_pipeline(Coll, Frames, Stamp, Pipeline) :-
+	findall(Steps,
+		(	member(Frame, Frames),
+			member(Direction, [before, after]),
+			tf_bracket_steps(Frame, Direction, Stamp, Steps)
+		),
+		[FirstSteps|Branches]),
+	findall(['$unionWith', [
+			['coll', string(Coll)],
+			['pipeline', array(Steps)]
+		]],
+		member(Steps, Branches),
+		Unions),
+	append(FirstSteps, Unions, Pipeline).
+
+tf_bracket_steps(Frame, before, Stamp, [
+		['$match', [
+			['child_frame_id', string(Frame)],
+			['header.stamp', ['$lte', time(Stamp)]]
+		]],
+		['$sort', [['child_frame_id', int(1)], ['header.stamp', int(-1)]]],
+		['$limit', int(1)]
+	]).
+
+tf_bracket_steps(Frame, after, Stamp, [
+		['$match', [
+			['child_frame_id', string(Frame)],
+			['header.stamp', ['$gt', time(Stamp)]]
+		]],
+		['$sort', [['child_frame_id', int(1)], ['header.stamp', int(1)]]],
+		['$limit', int(1)]
+	]).
+
+%%
+tf_interpolate_samples(Frame, Stamp, Samples, PoseData) :-
+	once((
+		member(Frame-T0-PoseData0, Samples),
+		T0 =< Stamp
+	)),
+	(	member(Frame-T1-PoseData1, Samples),
+		T1 > Stamp,
+		PoseData0=[Ref,Pos0,Rot0],
+		PoseData1=[Ref,Pos1,Rot1]
+	->	Factor is (Stamp - T0) / (T1 - T0),
+		transform_interpolate(
+			[Ref,Frame,Pos0,Rot0],
+			[Ref,Frame,Pos1,Rot1],
+			Factor,
+			[Ref,Frame,Pos,Rot]),
+		PoseData=[Ref,Pos,Rot]
+	;	PoseData=PoseData0
 	).
 
 
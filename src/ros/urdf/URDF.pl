@@ -10,6 +10,7 @@
 	  has_parent_link(r,r),
 	  urdf_set_pose(r,+),
 	  urdf_set_pose_to_origin(r,+),
+	  urdf_model_handle/2,
 	  urdf_robot_name/2,
 	  urdf_link_names/2,
 	  urdf_joint_names/2,
@@ -32,7 +33,9 @@
 	  urdf_joint_friction/3,
 	  is_urdf_link(r),
 	  is_urdf_joint(r),
-	  urdf_init/0
+	  urdf_init/0,
+	  urdf_init/1,
+	  urdf_manifest/1
     ]).
 
 :- use_module(library('semweb/rdf_db'),
@@ -62,6 +65,8 @@
 :- dynamic has_urdf/2.
 :- dynamic urdf_server/1.
 :- dynamic urdf_prefix/2.
+% urdf_source_(Object, Identifier, XML)
+:- dynamic urdf_source_/3.
 
 %%
 % Initialize prefix for downloading URDF via HTTP
@@ -81,6 +86,7 @@ urdf_server_init :-
 urdf_init :-
 	retractall(has_urdf(_,_)),
 	retractall(urdf_prefix(_,_)),
+	retractall(urdf_source_(_,_,_)),
 	forall(
 		has_kinematics_file(Object,Identifier,'URDF'),
 		urdf_init(Object,Identifier)
@@ -106,6 +112,7 @@ urdf_init(Object,Identifier) :-
 			fail
 		)
 	),
+	assertz(urdf_source_(Object,Identifier,XML_data)),
 	% create has_urdf facts
 	forall(
 		(	Y=Object
@@ -118,6 +125,43 @@ urdf_init(Object,Identifier) :-
 	log_info(urdf(initialized(Object,Identifier))),
 	!.
 
+%% urdf_manifest(-Entries) is det.
+%
+% The URDF descriptions loaded by urdf_init/0.
+% Entries is a list of terms urdf(Object,Identifier,XML,Parts)
+% where Parts are the objects that are assigned to the URDF
+% description of Object.
+% The list can be used to restore the descriptions
+% with urdf_init/1 without downloading them again.
+%
+% @param Entries list of URDF descriptions
+%
+urdf_manifest(Entries) :-
+	findall(urdf(Object,Identifier,XML,Parts),
+		(	urdf_source_(Object,Identifier,XML),
+			findall(Y, has_urdf(Y,Object), Parts)
+		),
+		Entries).
+
+%% urdf_init(+Entries) is det.
+%
+% Restore URDF descriptions from a list generated by urdf_manifest/1.
+%
+% @param Entries list of URDF descriptions
+%
+urdf_init(Entries) :-
+	retractall(has_urdf(_,_)),
+	retractall(urdf_prefix(_,_)),
+	retractall(urdf_source_(_,_,_)),
+	forall(
+		member(urdf(Object,Identifier,XML,Parts),Entries),
+		(	urdf_load_xml(Object,XML)
+		->	assertz(urdf_source_(Object,Identifier,XML)),
+			forall(member(Y,Parts), assertz(has_urdf(Y,Object)))
+		;	log_warn(urdf(parsing_failed(Object,Identifier)))
+		)
+	).
+
 %% urdf_load(+Object,+File) is semidet.
 %
 % Same as urdf_load/3 with empty options list.
@@ -210,25 +254,26 @@ urdf_set_pose(Object,Pose) :-
 	(	has_urdf_prefix(Object,Prefix)
 	;	Prefix=''
 	),!,
+	urdf_model_handle(Object,Handle),
 	% set root link pose
-	urdf_root_link(Object,RootLinkName),
+	urdf_root_link(Handle,RootLinkName),
 	urdf_iri(Object,Prefix,RootLinkName,RootLink),
 	% update tf memory
 	rdf_split_url(_,RootFrame,RootLink),
 	tf_mem_set_pose(RootFrame,Pose,0),
 	% set pose of other links
-	urdf_link_names(Object,Links),
+	urdf_link_names(Handle,Links),
 	forall(
 		member(LinkName,Links), 
 		(	LinkName=RootLinkName
-		;	set_link_pose_(Object,Prefix,LinkName)
+		;	set_link_pose_(Object,Handle,Prefix,LinkName)
 		)
 	).
 
-set_link_pose_(Object,Prefix,LinkName) :-
-	urdf_link_parent_joint(Object,LinkName,JointName),
-	urdf_joint_origin(Object,JointName,[_,Pos,Rot]),
-	urdf_joint_parent_link(Object,JointName,ParentName),
+set_link_pose_(Object,Handle,Prefix,LinkName) :-
+	urdf_link_parent_joint(Handle,LinkName,JointName),
+	urdf_joint_origin(Handle,JointName,[_,Pos,Rot]),
+	urdf_joint_parent_link(Handle,JointName,ParentName),
 	urdf_iri(Object,Prefix,LinkName,Link),
 	atom_concat(Prefix,ParentName,ParentFrame),
 	% update tf memory
@@ -423,8 +468,9 @@ get_object_shape_(Root,BaseName,EndName,
 		(has_urdf_prefix(Root,Prefix);Prefix=''),
 		assertz(urdf_prefix(Root,Prefix))
 	))),
-	urdf_catch(urdf_chain(Root,BaseName,EndName,LinkName)),
-	urdf_catch(urdf_link_visual_shape(Root,LinkName,
+	urdf_model_handle(Root,Handle),
+	urdf_catch(urdf_chain(Handle,BaseName,EndName,LinkName)),
+	urdf_catch(urdf_link_visual_shape(Handle,LinkName,
 		ShapeTerm,[Name,Pos,Rot],MaterialTerm,ShapeID)),
 	atom_concat(Prefix,Name,Frame).
 
@@ -450,6 +496,16 @@ urdf_catch(Goal) :-
 %
 % Unloads a previously loaded URDF.
 
+%% urdf_model_handle(+Object,-Handle) is semidet.
+%
+% Get the integer handle of a loaded URDF.
+% The handle can be used instead of Object in the other
+% predicates of the foreign library, which avoids a lookup
+% of the URDF by name.
+% The handle of an object does not change if its URDF is reloaded.
+% Throws urdf_error(no_such_model(Handle)) if the URDF
+% was unloaded when the handle is used.
+
 %% urdf_robot_name(+Object,-Name) is semidet.
 %
 % Get the name of the currently loaded robot.
@@ -218,7 +218,20 @@ test(link_collision_origin_pr2_r_gripper_r_finger_link) :-
 	urdf_link_collision_shape(pr2, r_gripper_r_finger_link, _,
 		[r_gripper_r_finger_link, [0.0, 0.0, 0.0], [1.0, 0.0, 0.0, 0.0]]).
 
+test(model_handle_pr2) :-
+  urdf_model_handle(pr2,Handle),
+  integer(Handle),
+  urdf_robot_name(Handle,pr2),
+  urdf_joint_child_link(Handle,torso_lift_joint,torso_lift_link).
+
+test(nonexisting_model) :-
+  catch(urdf_robot_name(foo,_), urdf_error(Msg), true),
+  ground(Msg).
+
 test(urdf_unload) :-
   urdf_unload_file(pr2).
 
+test(model_handle_unloaded, [fail]) :-
+  urdf_model_handle(pr2,_).
+
 :- end_rdf_tests('ros_urdf').
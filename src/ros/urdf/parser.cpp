@@ -28,6 +28,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
 #include <mutex>
 #include <urdf/model.h>
 // SWI Prolog
@@ -134,28 +136,117 @@ PlTerm to_prolog_material(const urdf::MaterialSharedPtr& material) {
 /********** INIT URDF *****************/
 /**************************************/
 
-std::map<std::string,urdf::Model> robot_models;
+/**
+ * A URDF model together with hash indexes of its links and joints.
+ * Models are not modified anymore once they were published
+ * in the registry such that they can be read without locking.
+ */
+struct RobotModel {
+	urdf::Model model;
+	std::unordered_map<std::string, urdf::LinkConstSharedPtr> links;
+	std::unordered_map<std::string, urdf::JointConstSharedPtr> joints;
+};
+typedef std::shared_ptr<const RobotModel> RobotModelPtr;
+
+/**
+ * A snapshot of all loaded models.
+ * Models are indexed by their identifier, and by an integer handle.
+ * The handle of an identifier does not change when the model is reloaded.
+ */
+struct RobotModelRegistry {
+	std::unordered_map<std::string, RobotModelPtr> models;
+	std::unordered_map<long, RobotModelPtr> models_by_handle;
+	std::unordered_map<std::string, long> handles;
+	long next_handle = 1;
+};
+typedef std::shared_ptr<const RobotModelRegistry> RobotModelRegistryPtr;
+
+// the current registry snapshot, readers load it atomically,
+// and writers replace it with a modified copy.
+RobotModelRegistryPtr robot_models = std::make_shared<RobotModelRegistry>();
+// serializes writers
 std::mutex robot_models_mtx;
 
-urdf::Model& get_robot_model(const char *id) {
-    std::unique_lock<std::mutex> lock(robot_models_mtx);
-    return robot_models[std::string(id)];
+RobotModelRegistryPtr get_robot_models() {
+	return std::atomic_load(&robot_models);
 }
 
-urdf::LinkConstSharedPtr get_link(const char* urdf_id, const char* link_name) {
-    urdf::LinkConstSharedPtr link = get_robot_model(urdf_id).getLink(std::string(link_name));
-    if (!link)
+void create_indexes(RobotModel &robot_model) {
+	for (auto const& link_entry: robot_model.model.links_)
+		robot_model.links[link_entry.first] = link_entry.second;
+	for (auto const& joint_entry: robot_model.model.joints_)
+		robot_model.joints[joint_entry.first] = joint_entry.second;
+}
+
+void set_robot_model(const std::string &urdf_id, const RobotModelPtr &robot_model) {
+	std::lock_guard<std::mutex> lock(robot_models_mtx);
+	std::shared_ptr<RobotModelRegistry> registry =
+			std::make_shared<RobotModelRegistry>(*get_robot_models());
+	auto it = registry->handles.find(urdf_id);
+	long handle;
+	if(it == registry->handles.end()) {
+		handle = registry->next_handle++;
+		registry->handles[urdf_id] = handle;
+	}
+	else {
+		handle = it->second;
+	}
+	registry->models[urdf_id] = robot_model;
+	registry->models_by_handle[handle] = robot_model;
+	std::atomic_store(&robot_models, RobotModelRegistryPtr(registry));
+}
+
+void remove_robot_model(const std::string &urdf_id) {
+	std::lock_guard<std::mutex> lock(robot_models_mtx);
+	RobotModelRegistryPtr current = get_robot_models();
+	if(current->models.find(urdf_id) == current->models.end()) {
+		return;
+	}
+	std::shared_ptr<RobotModelRegistry> registry =
+			std::make_shared<RobotModelRegistry>(*current);
+	registry->models.erase(urdf_id);
+	registry->models_by_handle.erase(registry->handles.at(urdf_id));
+	std::atomic_store(&robot_models, RobotModelRegistryPtr(registry));
+}
+
+// the model is either referred to by its identifier or by its handle
+RobotModelPtr find_robot_model(PlTerm urdf_id) {
+	RobotModelRegistryPtr registry = get_robot_models();
+	if(urdf_id.type() == PL_INTEGER) {
+		auto it = registry->models_by_handle.find((long)urdf_id);
+		if(it != registry->models_by_handle.end()) return it->second;
+	}
+	else {
+		auto it = registry->models.find(std::string((char*)urdf_id));
+		if(it != registry->models.end()) return it->second;
+	}
+	return RobotModelPtr();
+}
+
+RobotModelPtr get_robot_model(PlTerm urdf_id) {
+	RobotModelPtr robot_model = find_robot_model(urdf_id);
+	if (!robot_model)
+		throw PlException(PlCompound("urdf_error",
+				PlCompound("no_such_model", urdf_id)));
+	return robot_model;
+}
+
+urdf::LinkConstSharedPtr get_link(PlTerm urdf_id, const char* link_name) {
+    RobotModelPtr robot_model = get_robot_model(urdf_id);
+    auto it = robot_model->links.find(std::string(link_name));
+    if (it == robot_model->links.end() || !it->second)
         throw PlException(PlCompound("urdf_error",
         		PlCompound("no_such_link", PlTerm(link_name))));
-    return link;
+    return it->second;
 }
 
-urdf::JointConstSharedPtr get_joint(const char* urdf_id, const char* joint_name) {
-    urdf::JointConstSharedPtr joint = get_robot_model(urdf_id).getJoint(std::string(joint_name));
-    if (!joint)
+urdf::JointConstSharedPtr get_joint(PlTerm urdf_id, const char* joint_name) {
+    RobotModelPtr robot_model = get_robot_model(urdf_id);
+    auto it = robot_model->joints.find(std::string(joint_name));
+    if (it == robot_model->joints.end() || !it->second)
         throw PlException(PlCompound("urdf_error",
         		PlCompound("no_such_joint", PlTerm(joint_name))));
-    return joint;
+    return it->second;
 }
 
 bool link_has_visual_with_index(const urdf::LinkConstSharedPtr link, long index) {
@@ -206,42 +297,54 @@ const char* get_joint_type(urdf::JointConstSharedPtr joint) {
 
 // urdf_load_file(Object, File)
 PREDICATE(urdf_load_file, 2) {
+	std::string urdf_id((char*)PL_A1);
 	std::string filename((char*)PL_A2);
-	if(get_robot_model(PL_A1).initFile(filename)) {
+	std::shared_ptr<RobotModel> robot_model = std::make_shared<RobotModel>();
+	if(robot_model->model.initFile(filename)) {
+		create_indexes(*robot_model);
+		set_robot_model(urdf_id, robot_model);
 		return true;
 	} else {
-		std::unique_lock<std::mutex> lock(robot_models_mtx);
-		std::string urdf_id((char*)PL_A1);
-		robot_models.erase(urdf_id);
+		remove_robot_model(urdf_id);
 		return false;
 	}
 }
 
 // urdf_load_xml(Object, XML_data)
 PREDICATE(urdf_load_xml, 2) {
+	std::string urdf_id((char*)PL_A1);
 	std::string xml_data((char*)PL_A2);
-	if(get_robot_model(PL_A1).initString(xml_data)) {
+	std::shared_ptr<RobotModel> robot_model = std::make_shared<RobotModel>();
+	if(robot_model->model.initString(xml_data)) {
+		create_indexes(*robot_model);
+		set_robot_model(urdf_id, robot_model);
 		return true;
 	} else {
-		std::unique_lock<std::mutex> lock(robot_models_mtx);
-		std::string urdf_id((char*)PL_A1);
-		robot_models.erase(urdf_id);
+		remove_robot_model(urdf_id);
 		return false;
 	}
 }
 
 // urdf_is_loaded(Object)
 PREDICATE(urdf_is_loaded,1) {
-	std::string urdf_id((char*)PL_A1);
-	std::unique_lock<std::mutex> lock(robot_models_mtx);
-	return robot_models.find(urdf_id) != robot_models.end();
+	return (bool)find_robot_model(PL_A1);
 }
 
 // urdf_unload_file(Object)
 PREDICATE(urdf_unload_file, 1) {
 	std::string urdf_id((char*)PL_A1);
-	std::unique_lock<std::mutex> lock(robot_models_mtx);
-	robot_models.erase(urdf_id);
+	remove_robot_model(urdf_id);
+	return true;
+}
+
+// urdf_model_handle(Object, Handle)
+PREDICATE(urdf_model_handle, 2) {
+	std::string urdf_id((char*)PL_A1);
+	RobotModelRegistryPtr registry = get_robot_models();
+	if(registry->models.find(urdf_id) == registry->models.end()) {
+		return false;
+	}
+	PL_A2 = registry->handles.at(urdf_id);
 	return true;
 }
 
@@ -259,29 +362,35 @@ PREDICATE(urdf_unload_file, 1) {
 
 // urdf_robot_name(Object, Name)
 PREDICATE(urdf_robot_name, 2) {
-	PL_A2 = get_robot_model(PL_A1).name_.c_str();
+	PL_A2 = get_robot_model(PL_A1)->model.name_.c_str();
 	return true;
 }
 
 // urdf_link_names(Object, LinkNames)
 PREDICATE(urdf_link_names, 2) {
+	RobotModelPtr robot_model = get_robot_model(PL_A1);
 	PlTail names(PL_A2);
-	for (auto const& link_entry: get_robot_model(PL_A1).links_)
+	for (auto const& link_entry: robot_model->model.links_)
 		names.append(link_entry.first.c_str());
 	return names.close();
 }
 
 // urdf_joint_names(Object, JointNames)
 PREDICATE(urdf_joint_names, 2) {
+	RobotModelPtr robot_model = get_robot_model(PL_A1);
 	PlTail names(PL_A2);
-	for (auto const& joint_entry: get_robot_model(PL_A1).joints_)
+	for (auto const& joint_entry: robot_model->model.joints_)
 		names.append(joint_entry.first.c_str());
 	return names.close();
 }
 
 // urdf_root_link(Object, RootLink)
 PREDICATE(urdf_root_link, 2) {
-	PL_A2 = get_robot_model(PL_A1).root_link_->name.c_str();
+	RobotModelPtr robot_model = get_robot_model(PL_A1);
+	if (!robot_model->model.root_link_) {
+		return false;
+	}
+	PL_A2 = robot_model->model.root_link_->name.c_str();
 	return true;
 }
 
@@ -62,7 +62,18 @@ transform_between([F,TgFrame, [T1x,T1y,T1z],Q1],
   Diff_z is T2z - T1z,
   quaternion_transform(Q1, [Diff_x,Diff_y,Diff_z], TN).
 
-%%
+%% transform_interpolate(+Transform1:term, +Transform2:term, +Factor:number, ?Interpolated:term) is det.
+%
+% True if Interpolated is the transform between Transform1 and Transform2
+% at Factor, i.e. Transform1 if Factor is 0.0, and Transform2 if Factor is 1.0.
+% The translation is interpolated linearly, and the rotation
+% with spherical linear interpolation.
+%
+% @param Transform1 A Prolog term [Ref,Tg,Pos1,Rot1]
+% @param Transform2 A Prolog term [Ref,Tg,Pos2,Rot2]
+% @param Factor The interpolation factor
+% @param Interpolated A Prolog term [Ref,Tg,Pos,Rot]
+%
 transform_interpolate(
     [Ref,Tg,T1,Q1],
     [Ref,Tg,T2,Q2],
@@ -75,7 +86,7 @@ transform_interpolate(
 
 %%
 lerp(X0,X1,Factor,X) :-
-  X is Factor*X0 + (1.0 - Factor)*X1.
+  X is X0 + Factor*(X1 - X0).
 
 lerp_list([],[],_,[]) :- !.
 lerp_list([X0|Xs0],[X1|Xs1],Factor,[X|Xs]) :-
@@ -33,6 +33,10 @@ prolog:message(kb(initialization(started))) -->
 	[ 'The knowledge base is starting up, that may take a few moments!' ].
 prolog:message(kb(initialization(finished))) -->
 	[ 'The knowledge base has finished starting up!' ].
+prolog:message(kb(startup_task(Name,Duration,true))) -->
+	[ 'Startup task ~w took ~3f seconds.'-[Name,Duration] ].
+prolog:message(kb(startup_task(Name,Duration,Result))) -->
+	[ 'Startup task ~w failed after ~3f seconds: ~q'-[Name,Duration,Result] ].
 
 %% log_message(+Level,+Term) is det.
 %% log_error(+Term) is det.
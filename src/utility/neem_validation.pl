@@ -10,11 +10,19 @@
       get_joints_without_proper_links(r),
       first_n_list(r,r,r),
       load_logs(r),
-      validate_episode(r)
+      validate_episode(r),
+      neem_check(?,?,t),
+      neem_validate(+,-),
+      neem_validate(+,+,-)
     ]).
 
+:- use_module(library('semweb/rdf_db'),
+    [ rdf_meta/1 ]).
 :- use_module(library('db/mongo/client')).
 :- use_module(library('lang/scope')).
+:- use_module(library('lang/mongolog/mongolog')).
+:- use_module(library('utility/threads'),
+    [ worker_pool_start_work/3 ]).
 :- use_module(library('model/DUL')).
 :- use_module(library('model/SOMA')).
 :- use_module(library('ros/tf/tf')).
@@ -135,11 +143,191 @@ load_logs(Folder) :-
   tf_mng_remember(Path).
 
 validate_episode(_WorldFrame):- % Set the name of the folder with the logs as Foldername, the desired world frame
-  get_actions_without_timeinterval(_),
-  get_actions_with_participants_without_role(_),
-  get_actions_without_tasks(_),
-  get_actions_without_participants(_),
-  %get_child_frames_without_link_to_world_frame(WorldFrame, _),
-  get_objects_without_location(_),
-  get_objects_without_shape(_),
-  get_joints_without_proper_links(_).
+  neem_validate([], Report),
+  forall(member(Check, Report), print_check(Check)).
+
+print_check(check(Name, Result)) :-
+  neem_check(Name, _, _),
+  ( option(error(Error), Result) ->
+    print_message(warning, neem_check_failed(Name, Error)) ;
+    option(count(0), Result) ->
+    print_message(info, neem_check_passed(Name)) ;
+    option(count(Count), Result),
+    option(samples(Samples), Result),
+    print_message(warning, neem_check_violated(Name, Count)),
+    forall(member(X, Samples), print_message(warning, X))
+  ).
+
+:- multifile prolog:message//1.
+prolog:message(neem_check_failed(Name, Error)) -->
+  [ 'NEEM check ~w failed: ~q'-[Name, Error] ].
+prolog:message(neem_check_passed(Name)) -->
+  [ 'NEEM check ~w passed.'-[Name] ].
+prolog:message(neem_check_violated(Name, Count)) -->
+  [ 'NEEM check ~w: ~w violations, e.g.:'-[Name, Count] ].
+
+:- rdf_meta(neem_check(?,?,t)).
+
+%% neem_check(?Name, ?Entity, ?Goal) is nondet.
+%
+% A validation check of NEEM data.
+% Each solution of Goal is a violation of the check, Entity
+% is the entity that violates it.
+% Goal must be compilable into a single aggregation pipeline,
+% negations are compiled into anti-joins on the server.
+%
+% @param Name the name of the check.
+% @param Entity the entity violating the check.
+% @param Goal the violation goal.
+%
+neem_check(actions_without_timeinterval, Action,
+  ( is_action(Action),
+    \+ has_time_interval(Action, _) )).
+
+neem_check(participants_without_role, Participant,
+  ( triple(Action, rdf:type, dul:'Event'),
+    triple(Action, dul:hasParticipant, Participant),
+    \+ has_role(Participant, _) )).
+
+neem_check(actions_without_tasks, Action,
+  ( is_action(Action),
+    \+ executes_task(Action, _) )).
+
+neem_check(actions_without_participants, Action,
+  ( is_action(Action),
+    \+ has_participant(Action, _) )).
+
+neem_check(objects_without_location, Object,
+  ( is_physical_object(Object),
+    \+ object_localization(Object, _) )).
+
+% NOTE: only shapes asserted in the knowledge base are considered,
+%       shapes of URDF links are not stored in the database.
+neem_check(objects_without_shape, Object,
+  ( is_physical_object(Object),
+    \+ object_shape_type(Object, _) )).
+
+neem_check(joints_without_links, Joint,
+  ( has_type(Joint, urdf:'Joint'),
+    \+ has_parent_link(Joint, _),
+    \+ has_child_link(Joint, _) )).
+
+%% neem_validate(+Options, -Report) is det.
+%
+% Run NEEM checks concurrently, each as a single aggregation
+% pipeline, on the NEEM selected by the collection_prefix setting.
+% Report is a list of terms check(Name, Result) where Result is
+% either [count(Count), samples(Samples), time(Seconds)], or
+% [error(Error), time(Seconds)] if the check could not be performed.
+% Options are:
+%
+%   - checks(Names): the checks to run (default: all checks).
+%     An existence error is raised for unknown names.
+%   - samples(N): the maximum number of samples per check (default: 10).
+%   - scope(Scope): the query scope (default: current scope).
+%
+% @param Options list of options.
+% @param Report the validation report.
+%
+neem_validate(Options, Report) :-
+  setting(mng_client:collection_prefix, Prefix),
+  neem_validate([Prefix], Options, [neem(Prefix, Report)]).
+
+%% neem_validate(+Prefixes, +Options, -Reports) is det.
+%
+% Same as neem_validate/2 but validates multiple NEEMs in parallel.
+% Each NEEM is identified by its collection prefix.
+% Reports is a list of terms neem(Prefix, Report).
+%
+% @param Prefixes list of collection prefixes.
+% @param Options list of options.
+% @param Reports list of validation reports.
+%
+neem_validate(Prefixes, Options, Reports) :-
+  ( option(checks(Names), Options) ->
+    forall(member(Name, Names), must_be_check(Name)) ;
+    findall(Name, neem_check(Name, _, _), Names) ),
+  findall(Prefix-Name, (member(Prefix, Prefixes), member(Name, Names)), Jobs),
+  lang_query:query_thread_pool(Pool),
+  setup_call_cleanup(
+    message_queue_create(Queue),
+    ( forall(
+        member(Prefix-Name, Jobs),
+        worker_pool_start_work(Pool, check(Queue, Prefix, Name),
+          neem_validation:run_check(Queue, Prefix, Name, Options))
+      ),
+      length(Jobs, NumJobs),
+      findall(Prefix-check(Name, Result),
+        ( between(1, NumJobs, _),
+          thread_get_message(Queue, result(Prefix, Name, Result)) ),
+        Results)
+    ),
+    message_queue_destroy(Queue)
+  ),
+  findall(neem(Prefix, Report),
+    ( member(Prefix, Prefixes),
+      findall(Check,
+        ( member(Name, Names), Check=check(Name,_),
+          memberchk(Prefix-Check, Results) ),
+        Report) ),
+    Reports).
+
+%%
+must_be_check(Name) :-
+  ( ground(Name), neem_check(Name, _, _) ) -> true ;
+  throw(error(existence_error(neem_check, Name), neem_validate/3)).
+
+%%
+% A result message is sent in any case, the caller waits for it.
+%
+run_check(Queue, Prefix, Name, Options) :-
+  get_time(T0),
+  catch(
+    ( mng_with_collection_prefix(Prefix,
+        run_check(Name, Options, Count, Samples)) ->
+      Result0=[count(Count), samples(Samples)] ;
+      Result0=[error(failed)] ),
+    Error,
+    Result0=[error(Error)]
+  ),
+  get_time(T1),
+  Time is T1 - T0,
+  append(Result0, [time(Time)], Result),
+  thread_send_message(Queue, result(Prefix, Name, Result)).
+
+%%
+% Compile the check into an aggregation pipeline with an additional
+% $facet stage that computes the number of violations and some samples.
+%
+run_check(Name, Options, Count, Samples) :-
+  once(neem_check(Name, Entity, Goal)),
+  option(samples(NumSamples), Options, 10),
+  ( option(scope(Scope), Options) -> true ; current_scope(Scope) ),
+  mongolog:mongolog_compile(Goal,
+    pipeline(Pipeline0, Vars), [scope(Scope)]),
+  once(( member([Key,Var], Vars), Var == Entity )),
+  append(Pipeline0, [
+    ['$group', [['_id', string(Ref)]]],
+    ['$facet', [
+      ['count',   array([['$count', string(n)]])],
+      ['samples', array([['$limit', int(NumSamples)]])]
+    ]]
+  ], Pipeline),
+  atom_concat('$', Key, Ref),
+  mng_one_db(DB, Coll),
+  setup_call_cleanup(
+    mng_cursor_create(DB, Coll, Cursor),
+    ( mng_cursor_aggregate(Cursor, ['pipeline', array(Pipeline)]),
+      mng_cursor_next(Cursor, Doc) ),
+    mng_cursor_destroy(Cursor)
+  ),
+  mng_get_dict(count, Doc, array(CountDocs)),
+  ( CountDocs=[CountDoc|_], memberchk(n-TypedCount, CountDoc) ->
+    mng_strip_type(TypedCount, _, Count) ;
+    Count=0 ),
+  mng_get_dict(samples, Doc, array(SampleDocs)),
+  findall(Sample,
+    ( member(SampleDoc, SampleDocs),
+      memberchk('_id'-TypedSample, SampleDoc),
+      mng_strip_type(TypedSample, _, Sample) ),
+    Samples).
@@ -0,0 +1,32 @@
+:- use_module(library('rostest')).
+:- use_module(library('db/mongo/client')).
+:- use_module('neem_validation').
+
+:- begin_tests('neem_validation',
+		[ cleanup(neem_validation_cleanup) ]).
+
+neem_validation_cleanup :-
+	mng_with_collection_prefix(test_neem_validation,
+		forall(
+			member(Type, [triples, inferred]),
+			( mng_get_db(DB, Coll, Type), mng_drop(DB, Coll) )
+		)).
+
+test('neem_validate(+UnknownCheck)',
+		[ throws(error(existence_error(neem_check, no_such_check), _)) ]) :-
+	neem_validate([test_neem_validation],
+		[ checks([no_such_check]) ], _).
+
+test('neem_validate(+Check) without violations') :-
+	neem_validate([test_neem_validation],
+		[ checks([actions_without_timeinterval, joints_without_links]) ],
+		Reports),
+	assert_unifies(Reports, [neem(test_neem_validation, [
+		check(actions_without_timeinterval, Result0),
+		check(joints_without_links, Result1)
+	])]),
+	assert_true(option(count(0), Result0)),
+	assert_true(option(samples([]), Result0)),
+	assert_true(option(count(0), Result1)).
+
+:- end_tests('neem_validation').
@@ -0,0 +1,205 @@
+:- module(startup,
+    [ startup_task/3,      % +Name, +Dependencies, :Goal
+      startup_task/4,      % +Name, +Dependencies, :Goal, +Options
+      startup_wait/1,      % +Names
+      startup_barrier/0,
+      startup_ready/0,
+      startup_profile/1    % -Profile
+    ]).
+/** <module> Concurrent initialization tasks.
+
+Initialization work is declared as a graph of named tasks.
+A task is started in a worker thread as soon as all the tasks
+it depends on have finished, such that independent tasks
+run concurrently while the remaining modules are loaded.
+Background tasks (e.g. building search indices) do not
+delay the end of the startup, but startup_ready/0
+can be used to wait until they have finished.
+The time spent in each task is recorded, and reported
+when startup_barrier/0 is called.
+
+@author Daniel Beßler
+@license BSD
+*/
+
+:- use_module('threads',
+	[ worker_pool_create/2,
+	  worker_pool_start_work/3
+	]).
+:- use_module('logging',
+	[ log_info/1,
+	  log_warning/1
+	]).
+
+:- meta_predicate startup_task(+,+,0).
+:- meta_predicate startup_task(+,+,0,+).
+
+% task_(Name, Dependencies, Goal, Options)
+:- dynamic task_/4.
+% task_status_(Name, Status), Status is one of pending, running or done
+:- dynamic task_status_/2.
+% task_profile_(Name, Begin, Duration, Result)
+:- dynamic task_profile_/4.
+% task_waiting_(Name, Thread)
+:- dynamic task_waiting_/2.
+
+% the pool grows with the number of tasks that can run at the same time
+:- worker_pool_create(startup_pool, [initial_pool_size(0)]).
+
+%% startup_task(+Name, +Dependencies, :Goal) is det.
+%
+% Same as startup_task/4 with empty options list.
+%
+startup_task(Name, Dependencies, Goal) :-
+	startup_task(Name, Dependencies, Goal, []).
+
+%% startup_task(+Name, +Dependencies, :Goal, +Options) is det.
+%
+% Declare an initialization task.
+% Goal is called in a worker thread once all tasks in Dependencies
+% have finished. Dependencies that are not declared are ignored.
+% A task is not called again if it was declared before.
+% Options include:
+%
+%     - background(Flag)
+%     If true, startup_barrier/0 does not wait for the task. Default is false.
+%
+% @param Name the task name.
+% @param Dependencies list of task names.
+% @param Goal the goal called by the task.
+% @param Options list of options.
+%
+startup_task(Name, Dependencies, Goal, Options) :-
+	with_mutex(startup, (
+		(	task_(Name, _, _, _)
+		->	true
+		;	assertz(task_(Name, Dependencies, Goal, Options)),
+			assertz(task_status_(Name, pending)),
+			schedule_tasks
+		)
+	)).
+
+%%
+% Start all pending tasks whose dependencies have finished.
+% Must be called while the startup mutex is locked.
+%
+schedule_tasks :-
+	forall(
+		(	task_status_(Name, pending),
+			task_(Name, Dependencies, _, _),
+			forall(member(X, Dependencies), task_finished(X))
+		),
+		(	retract(task_status_(Name, pending)),
+			assertz(task_status_(Name, running)),
+			worker_pool_start_work(startup_pool, task(Name),
+				startup:run_task(Name))
+		)
+	).
+
+%%
+task_finished(Name) :-
+	\+ task_(Name, _, _, _),
+	!.
+task_finished(Name) :-
+	task_status_(Name, done).
+
+%%
+run_task(Name) :-
+	task_(Name, _, Goal, _),
+	get_time(Begin),
+	catch(
+		(	call(Goal) -> Result=true ; Result=false ),
+		Error,
+		Result=Error
+	),
+	get_time(End),
+	Duration is End - Begin,
+	with_mutex(startup, (
+		assertz(task_profile_(Name, Begin, Duration, Result)),
+		retract(task_status_(Name, running)),
+		assertz(task_status_(Name, done)),
+		forall(
+			retract(task_waiting_(Name, Thread)),
+			thread_send_message(Thread, startup_done(Name))
+		),
+		schedule_tasks
+	)).
+
+%% startup_wait(+Names) is det.
+%
+% Block until the tasks have finished.
+% Tasks that are not declared are ignored.
+%
+% @param Names a task name or a list of task names.
+%
+startup_wait(Names) :-
+	is_list(Names),
+	!,
+	forall(member(Name, Names), startup_wait1(Name)).
+
+startup_wait(Name) :-
+	startup_wait1(Name).
+
+%%
+startup_wait1(Name) :-
+	thread_self(Self),
+	with_mutex(startup, (
+		(	task_finished(Name)
+		->	IsFinished=true
+		;	assertz(task_waiting_(Name, Self)),
+			IsFinished=false
+		)
+	)),
+	(	IsFinished == true
+	->	true
+	;	thread_get_message(startup_done(Name))
+	).
+
+%% startup_barrier is det.
+%
+% Block until all declared tasks have finished except for
+% background tasks, and report the time spent in each task.
+%
+startup_barrier :-
+	findall(Name,
+		(	task_(Name, _, _, Options),
+			\+ option(background(true), Options)
+		),
+		Names),
+	startup_wait(Names),
+	forall(
+		(	member(Name, Names),
+			task_profile_(Name, _, Duration, Result)
+		),
+		(	Result == true
+		->	log_info(kb(startup_task(Name, Duration, Result)))
+		;	log_warning(kb(startup_task(Name, Duration, Result)))
+		)
+	).
+
+%% startup_ready is det.
+%
+% Block until all declared tasks have finished including
+% background tasks.
+% This can be used as readiness barrier before
+% serving queries.
+%
+startup_ready :-
+	findall(Name, task_(Name, _, _, _), Names),
+	startup_wait(Names).
+
+%% startup_profile(-Profile) is det.
+%
+% The time spent in each task that has finished.
+% Profile is a list of terms task(Name,Begin,Duration,Result)
+% ordered by the time when the task was started,
+% where Result is true, false, or an exception term.
+%
+% @param Profile list of task profiles.
+%
+startup_profile(Profile) :-
+	findall(Begin-task(Name,Begin,Duration,Result),
+		task_profile_(Name, Begin, Duration, Result),
+		Pairs),
+	keysort(Pairs, Sorted),
+	pairs_values(Sorted, Profile).
@@ -31,6 +31,7 @@
       data_vis/2,
       data_vis_remove/1,
       timeline/1,
+      timeline/3,
       timeline_data/1,
       timeline_data/2
     ]).
@@ -47,6 +48,16 @@
 */
 :- use_module(library('semweb/rdfs')).
 :- use_module(library('semweb/rdf_db')).
+:- use_module(library(settings)).
+:- use_module(library('db/mongo/client'),
+  [ mng_get_db/3,
+    mng_cursor_create/3,
+    mng_cursor_destroy/1,
+    mng_cursor_aggregate/2,
+    mng_cursor_materialize/2
+  ]).
+:- use_module(library('lang/scope'),
+  [ current_scope/1 ]).
 
 %% data_vis(+Term:term, +Properties:list) is det
 %
@@ -94,6 +105,231 @@ timeline(Events) :-
   data_vis(timeline(event_timeline),
           [values:[EvtNames,EventExtends]]).
 
+%% timeline(?Since:float, ?Until:float, +Options:list) is det
+%
+% Creates a new data_vis timeline message for all events
+% whose time interval overlaps with Since and Until,
+% and publishes it via _|/data_vis_msgs|_ ROS topic.
+% Since and Until may be unbound in which case the interval is open.
+%
+% The timeline is generated with a single aggregate query
+% on the triple collections that yields the event label and
+% time interval of each event.
+% Options include:
+%
+%     - label(Label)
+%     One of task or participant. Events are labeled with the local
+%     name of the task classifying the event, or with its participant.
+%     Default is task.
+%     - participant(Participant)
+%     Only include events in which Participant participates.
+%     - min_duration(Seconds)
+%     Omit events that are shorter than Seconds.
+%     - bucket(Seconds)
+%     Merge events with the same label that begin in the same bucket of
+%     size Seconds into a single entry spanning all of them.
+%     This is useful to reduce the level of detail for large intervals.
+%     - graph(Graph)
+%     Only read triples of Graph and its sub-graphs. Default is user.
+%     - scope(QScope)
+%     Only read triples whose scope matches QScope.
+%     Default is the current scope.
+%
+% Options of the form key:value are data_vis properties as in data_vis/2.
+%
+% @param Since begin of the interval
+% @param Until end of the interval
+% @param Options list of options
+%
+timeline(Since, Until, Options) :-
+  timeline_entries(Since, Until, Options, Entries),
+  pairs_keys_values(Entries, EvtNames, EventExtends),
+  findall(Key:Value, member(Key:Value, Options), Properties),
+  data_vis(timeline(event_timeline),
+          [values:[EvtNames,EventExtends] | Properties]).
+
+%%
+% The entries of a timeline as pairs of event name and
+% time interval of the form `Begin_End`.
+%
+timeline_entries(Since, Until, Options, Entries) :-
+  mng_get_db(DB, Coll, 'triples'),
+  timeline_pipeline(Since, Until, Options, Pipeline),
+  setup_call_cleanup(
+    mng_cursor_create(DB, Coll, Cursor),
+    ( mng_cursor_aggregate(Cursor, ['pipeline', array(Pipeline)]),
+      findall(EvtName-Time, (
+        mng_cursor_materialize(Cursor, Doc),
+        get_dict(name, Doc, string(EvtName)),
+        get_dict(time, Doc, string(Time))
+      ), Entries)
+    ),
+    mng_cursor_destroy(Cursor)
+  ).
+
+%%
+timeline_pipeline(Since, Until, Options, Pipeline) :-
+  rdf_equal(dul:hasTimeInterval, HasTimeInterval),
+  rdf_equal(dul:isClassifiedBy, IsClassifiedBy),
+  rdf_equal(dul:hasParticipant, HasParticipant),
+  rdf_equal(soma:hasIntervalBegin, HasIntervalBegin),
+  rdf_equal(soma:hasIntervalEnd, HasIntervalEnd),
+  timeline_filter(Options, Filter),
+  timeline_collections(Colls),
+  option(label(LabelKey), Options, task),
+  timeline_value('$evt', IsClassifiedBy, Task),
+  timeline_value('$evt', HasParticipant, Participant),
+  ( LabelKey == participant
+  -> Label=['$ifNull', array([Participant, Task])]
+  ;  Label=Task
+  ),
+  findall(Step, (
+    % the time interval triples of events in all triple collections
+    Step=['$match', [['p*', string(HasTimeInterval)] | Filter]]
+  ; get_dict(volatile, Colls, VolatileColl),
+    Step=['$unionWith', [
+      ['coll', string(VolatileColl)],
+      ['pipeline', array([
+        ['$match', [['p*', string(HasTimeInterval)] | Filter]]
+      ])]
+    ]]
+  % join the time interval of each event
+  ; timeline_lookup(Colls, '$o', interval, Filter, Step)
+  ; timeline_value('$interval', HasIntervalBegin, Begin),
+    timeline_value('$interval', HasIntervalEnd, End),
+    Step=['$project', [
+      ['event', string('$s')],
+      ['begin', Begin],
+      ['end', End]
+    ]]
+  ; ground(Until),
+    Step=['$match', ['begin', ['$lte', double(Until)]]]
+  ; ground(Since),
+    Step=['$match', ['end', ['$gte', double(Since)]]]
+  % join the triples of each event
+  ; timeline_lookup(Colls, '$event', evt, Filter, Step)
+  ; option(participant(P), Options),
+    Step=['$match', ['evt', ['$elemMatch', [
+      ['p*', string(HasParticipant)],
+      ['o', string(P)]
+    ]]]]
+  ; Step=['$project', [
+      ['begin', int(1)],
+      ['end', int(1)],
+      ['label', Label]
+    ]]
+  ; Step=['$match', [
+      ['label', ['$exists', bool(true)]],
+      ['begin', ['$exists', bool(true)]],
+      ['end', ['$exists', bool(true)]]
+    ]]
+  % reduce the level of detail
+  ; option(min_duration(MinDuration), Options),
+    Step=['$match', ['$expr', ['$gte', array([
+      ['$subtract', array([string('$end'), string('$begin')])],
+      double(MinDuration)
+    ])]]]
+  ; option(bucket(BucketSize), Options),
+    ( ground(Since) -> Origin=Since ; Origin=0 ),
+    Step=['$group', [
+      ['_id', [
+        ['label', string('$label')],
+        ['bucket', ['$floor', ['$divide', array([
+          ['$subtract', array([string('$begin'), double(Origin)])],
+          double(BucketSize)
+        ])]]]
+      ]],
+      ['label', ['$first', string('$label')]],
+      ['begin', ['$min', string('$begin')]],
+      ['end', ['$max', string('$end')]]
+    ]]
+  % generate the entries of the data_vis message
+  ; Step=['$sort', ['begin', int(1)]]
+  ; Step=['$project', [
+      ['name', ['$arrayElemAt', array([
+        ['$split', array([string('$label'), string('#')])],
+        int(-1)
+      ])]],
+      ['time', ['$concat', array([
+        ['$toString', string('$begin')],
+        string('_'),
+        ['$toString', string('$end')]
+      ])]]
+    ]]
+  ), Pipeline).
+
+%%
+% The collections that hold triples, the "volatile_triples"
+% collection is only used if volatile graphs are configured.
+%
+timeline_collections(Colls) :-
+  mng_get_db(_, Triples, 'triples'),
+  ( setting(lang_db:volatile_graphs, [_|_])
+  -> mng_get_db(_, Volatile, 'volatile_triples'),
+     Colls=colls{triples: Triples, volatile: Volatile}
+  ;  Colls=colls{triples: Triples}
+  ).
+
+%%
+% The graph and scope restrictions of triples.
+%
+timeline_filter(Options, Filter) :-
+  option(graph(Graph), Options, user),
+  ( option(scope(QScope), Options) -> true
+  ; current_scope(QScope)
+  ),
+  findall(X, (
+    lang_triple:graph_doc(Graph, X)
+  ; lang_triple:scope_doc(QScope, X)
+  ), Filter).
+
+%%
+% Lookup the triples with subject Subject from all
+% triple collections into the field Key.
+%
+timeline_lookup(Colls, Subject, Key, Filter, Step) :-
+  Pipeline=[['$match', [
+    ['$expr', ['$eq', array([string('$s'), string('$$subject')])]]
+    | Filter
+  ]]],
+  atom_concat(Key, '_v', VolatileKey),
+  atom_concat('$', Key, KeyValue),
+  atom_concat('$', VolatileKey, VolatileValue),
+  ( Step=['$lookup', [
+      ['from', string(Colls.triples)],
+      ['as', string(Key)],
+      ['let', [['subject', string(Subject)]]],
+      ['pipeline', array(Pipeline)]
+    ]]
+  ; get_dict(volatile, Colls, Volatile),
+    ( Step=['$lookup', [
+        ['from', string(Volatile)],
+        ['as', string(VolatileKey)],
+        ['let', [['subject', string(Subject)]]],
+        ['pipeline', array(Pipeline)]
+      ]]
+    ; Step=['$set', [Key, ['$concatArrays',
+        array([string(KeyValue), string(VolatileValue)])
+      ]]]
+    ; Step=['$unset', string(VolatileKey)]
+    )
+  ).
+
+%%
+% The object of the first triple with some property
+% in an array of triples.
+%
+timeline_value(Triples, Property, ['$arrayElemAt', array([
+    ['$map', [
+      ['input', ['$filter', [
+        ['input', string(Triples)],
+        ['cond', ['$in', array([string(Property), string('$$this.p*')])]]
+      ]]],
+      ['in', string('$$this.o')]
+    ]],
+    int(0)
+  ])]).
+
 %% timeline_data(+Events:list) is det
 %
 % Creates a new data_vis timeline message and publishes it via _|/data_vis_msgs|_
@@ -0,0 +1,58 @@
+:- use_module(library('rostest')).
+:- use_module(library('semweb/rdf_db')).
+:- use_module(library('lang/query')).
+:- use_module(library('lang/scope')).
+:- use_module('data_vis').
+
+:- begin_tests('data_vis',
+		[ setup(data_vis_test_setup),
+		  cleanup(data_vis_test_cleanup) ]).
+
+:- rdf_meta(test_event_triple(t)).
+
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#Evt1',
+	dul:hasTimeInterval, 'http://knowrob.org/kb/data_vis_test#I1')).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#I1',
+	soma:hasIntervalBegin, 10.0)).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#I1',
+	soma:hasIntervalEnd, 20.0)).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#Evt1',
+	dul:isClassifiedBy, 'http://knowrob.org/kb/data_vis_test#Grasping')).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#Evt2',
+	dul:hasTimeInterval, 'http://knowrob.org/kb/data_vis_test#I2')).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#I2',
+	soma:hasIntervalBegin, 30.0)).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#I2',
+	soma:hasIntervalEnd, 40.0)).
+test_event_triple(triple('http://knowrob.org/kb/data_vis_test#Evt2',
+	dul:isClassifiedBy, 'http://knowrob.org/kb/data_vis_test#Placing')).
+
+data_vis_test_setup :-
+	universal_scope(Scope),
+	forall(
+		test_event_triple(Triple),
+		kb_project(Triple, Scope, [graph(test_data_vis)])
+	).
+
+data_vis_test_cleanup :-
+	forall(
+		test_event_triple(Triple),
+		kb_unproject(Triple)
+	).
+
+test('timeline(?,?,+)') :-
+	data_vis:timeline_entries(_, _, [graph(=(test_data_vis))], Entries),
+	pairs_keys(Entries, Names),
+	assert_equals(Names, ["Grasping", "Placing"]).
+
+test('timeline(+,+,+)') :-
+	data_vis:timeline_entries(25.0, 50.0, [graph(=(test_data_vis))], Entries),
+	pairs_keys(Entries, Names),
+	assert_equals(Names, ["Placing"]).
+
+test('timeline(+,+,+) min_duration') :-
+	data_vis:timeline_entries(_, _,
+		[graph(=(test_data_vis)), min_duration(15.0)], Entries),
+	assert_equals(Entries, []).
+
+:- end_tests('data_vis').